@@ -0,0 +1,108 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+// pbrt_parser
+#include "pbrtParser/Scene.h"
+// stl
+#include <iostream>
+#include <vector>
+#include <string>
+
+namespace pbrt {
+  namespace semantic {
+    
+    void usage(const std::string &msg)
+    {
+      if (msg != "") std::cerr << "Error: " << msg << std::endl << std::endl;
+      std::cout << "./pbfmerge [<transform>] in1.pbf [<transform>] in2.pbf ... -o out.pbf <args>" << std::endl;
+      std::cout << std::endl;
+      std::cout << "merges the given .pbf files into one, with each input's world becoming" << std::endl;
+      std::cout << "an instance (with the transform given right before that input) in the" << std::endl;
+      std::cout << "merged scene's world; camera, film, etc come from the first input" << std::endl;
+      std::cout << std::endl;
+      std::cout << "  -o <out.pbf>   : where to write the output to" << std::endl;
+      std::cout << "  --translate <x> <y> <z> : place the next input at that offset" << std::endl;
+      std::cout << "  --xfm <12 floats> : place the next input with that affine transform" << std::endl;
+      std::cout << "                   (the matrix' three columns, followed by the offset)" << std::endl;
+      std::cout << "  --dedup        : store identical materials and textures only once" << std::endl;
+      std::cout << "  --shard-size <MB> : write large entities into separate shard files" << std::endl;
+      std::cout << "                   (<out.pbf>.1, <out.pbf>.2, ...) of about that size" << std::endl;
+      std::cout << std::endl;
+      exit(msg == "" ? 0 : 1);
+    }
+
+    void pbfmerge(int ac, char **av)
+    {
+      std::vector<MergeInput> inputs;
+      std::string outFileName;
+      SaveOptions saveOptions;
+      affine3f nextXfm = affine3f::identity();
+      for (int i=1;i<ac;i++) {
+        const std::string arg = av[i];
+        if (arg == "-o") {
+          if (i+1 >= ac) usage("-o needs an argument");
+          outFileName = av[++i];
+        } else if (arg == "--translate") {
+          if (i+3 >= ac) usage("--translate needs three arguments");
+          const float x = std::stof(av[++i]);
+          const float y = std::stof(av[++i]);
+          const float z = std::stof(av[++i]);
+          nextXfm = affine3f::translate(vec3f(x,y,z));
+        } else if (arg == "--xfm") {
+          if (i+12 >= ac) usage("--xfm needs twelve arguments");
+          float f[12];
+          for (int j=0;j<12;j++)
+            f[j] = std::stof(av[++i]);
+          nextXfm = affine3f(mat3f(vec3f(f[0],f[1],f[2]),
+                                   vec3f(f[3],f[4],f[5]),
+                                   vec3f(f[6],f[7],f[8])),
+                             vec3f(f[9],f[10],f[11]));
+        } else if (arg == "--dedup") {
+          saveOptions.mergeIdenticalMaterials = true;
+        } else if (arg == "--shard-size") {
+          if (i+1 >= ac) usage("--shard-size needs an argument");
+          saveOptions.shardSize = size_t(std::stoi(av[++i])) << 20;
+          if (saveOptions.shardSize == 0)
+            usage("shard size has to be at least 1MB");
+        } else if (arg[0] != '-') {
+          MergeInput input;
+          input.fileName = arg;
+          input.xfm      = nextXfm;
+          inputs.push_back(input);
+          nextXfm = affine3f::identity();
+        } else {
+          usage("invalid argument '"+arg+"'");
+        }
+      }
+
+      if (outFileName == "")
+        usage("no output file specified (-o <file.pbf>)");
+      if (inputs.empty())
+        usage("no input files specified");
+
+      std::cout << "merging " << inputs.size() << " files into " << outFileName << std::endl;
+      const size_t numBytes = mergePBF(inputs,outFileName,saveOptions);
+      std::cout << "\033[1;32m => done, wrote " << numBytes << " bytes\033[0m" << std::endl;
+    }
+
+    extern "C" int main(int ac, char **av)
+    {
+      pbfmerge(ac,av);
+      return 0;
+    }
+
+  } // ::pbrt::semantic
+} // ::pbrt
@@ -43,8 +43,9 @@ namespace pbrt {
 
     /* TODO: ignoring shading normals for now */
 
-    for (auto v : mesh->vertex) {
-      v = xfmPoint(xfm,v);
+    std::vector<vec3f> vertices(mesh->vertex.size());
+    xfmPoints(xfm,mesh->vertex.data(),vertices.data(),vertices.size());
+    for (auto v : vertices) {
       out << "v  " << v.x << " " << v.y << " " << v.z << std::endl;
       numVerticesWritten++;
     }
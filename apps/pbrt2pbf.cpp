@@ -38,6 +38,17 @@ namespace pbrt {
       std::cout << std::endl;
       std::cout << "  -o <out.pbf>   : where to write the output to" << std::endl;
       std::cout << "                   (tris to quads, removing reundant fields, etc)" << std::endl;
+      std::cout << "  --streaming    : write each shape's data straight to the file, rather" << std::endl;
+      std::cout << "                   than staging it in memory first (for huge scenes)" << std::endl;
+      std::cout << "  --codec <none|lz> : how to compress large arrays (default: none)" << std::endl;
+      std::cout << "  --level <1-9>  : compression level (1: fastest, 9: smallest)" << std::endl;
+      std::cout << "  --quantize <16-21> : store positions with that many bits per component," << std::endl;
+      std::cout << "                   normals with 2x16 bits, and texcoords as half floats (lossy!)" << std::endl;
+      std::cout << "  --shard-size <MB> : write large entities into separate shard files" << std::endl;
+      std::cout << "                   (<out.pbf>.1, <out.pbf>.2, ...) of about that size" << std::endl;
+      std::cout << "  --append       : if <out.pbf> exists, only append what changed to it" << std::endl;
+      std::cout << "                   (rewriting it once it has too much outdated data)" << std::endl;
+      std::cout << "  --direct-io    : write in large blocks that bypass the page cache" << std::endl;
       std::cout << std::endl;
       exit(msg == "" ? 0 : 1);
     }
@@ -51,11 +62,44 @@ namespace pbrt {
     {
       std::string inFileName;
       std::string outFileName;
+      SaveOptions saveOptions;
+      bool append = false;
       for (int i=1;i<ac;i++) {
         const std::string arg = av[i];
         if (arg == "-o") {
           assert(i+1 < ac);
           outFileName = av[++i];
+        } else if (arg == "--append") {
+          append = true;
+        } else if (arg == "--direct-io") {
+          saveOptions.directIO = true;
+        } else if (arg == "--streaming") {
+          saveOptions.streaming = true;
+        } else if (arg == "--codec") {
+          if (i+1 >= ac) usage("--codec needs an argument");
+          const std::string codec = av[++i];
+          if (codec == "none")
+            saveOptions.compression = SaveOptions::Compression_None;
+          else if (codec == "lz")
+            saveOptions.compression = SaveOptions::Compression_LZ;
+          else
+            usage("unknown codec '"+codec+"'");
+        } else if (arg == "--quantize") {
+          if (i+1 >= ac) usage("--quantize needs an argument");
+          saveOptions.quantize     = true;
+          saveOptions.positionBits = std::stoi(av[++i]);
+          if (saveOptions.positionBits < 16 || saveOptions.positionBits > 21)
+            usage("number of bits per position component has to be between 16 and 21");
+        } else if (arg == "--shard-size") {
+          if (i+1 >= ac) usage("--shard-size needs an argument");
+          saveOptions.shardSize = size_t(std::stoi(av[++i])) << 20;
+          if (saveOptions.shardSize == 0)
+            usage("shard size has to be at least 1MB");
+        } else if (arg == "--level") {
+          if (i+1 >= ac) usage("--level needs an argument");
+          saveOptions.compressionLevel = std::stoi(av[++i]);
+          if (saveOptions.compressionLevel < 1 || saveOptions.compressionLevel > 9)
+            usage("compression level has to be between 1 and 9");
         } else if (arg[0] != '-') {
           inFileName = arg;
         } else {
@@ -79,7 +123,10 @@ namespace pbrt {
         Scene::SP scene = importPBRT(inFileName);
         std::cout << "\033[1;32m done importing scene.\033[0m" << std::endl;
         std::cout << "writing to binary file " << outFileName << std::endl;
-        scene->saveTo(outFileName);
+        if (append)
+          scene->appendTo(outFileName,saveOptions);
+        else
+          scene->saveTo(outFileName,saveOptions);
         std::cout << "\033[1;32m => yay! writing successful...\033[0m" << std::endl;
       // } catch (std::runtime_error &e) {
       //   cout << "\033[1;31mError in parsing: " << e.what() << "\033[0m\n";
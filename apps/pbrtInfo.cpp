@@ -152,14 +152,45 @@ namespace pbrt {
       std::set<Material::SP> usedMaterials;
     };
   
+    /*! print what loadSceneInfo() told us */
+    void printSceneInfo(SceneInfo::SP info)
+    {
+      std::cout << "number of cameras " << info->cameras.size() << std::endl;
+      for (auto camera : info->cameras)
+        std::cout << " - fov " << camera->fov
+                  << ", from " << camera->simplified.lens_center
+                  << ", looking at " << camera->simplified.screen_center << std::endl;
+      if (info->film)
+        std::cout << "film " << info->film->resolution
+                  << " '" << info->film->fileName << "'" << std::endl;
+      if (info->sampler)
+        std::cout << "sampler with " << info->sampler->pixelSamples << " pixel samples" << std::endl;
+      if (info->integrator)
+        std::cout << "integrator with max depth " << info->integrator->maxDepth << std::endl;
+      if (info->pixelFilter)
+        std::cout << "pixel filter with radius " << info->pixelFilter->radius << std::endl;
+      std::cout << "number of objects " << math::prettyNumber(info->numObjects) << std::endl;
+      std::cout << "number of instances " << math::prettyNumber(info->numInstances) << std::endl;
+      std::cout << "number of lights " << math::prettyNumber(info->numLightSources) << std::endl;
+      std::cout << "shapes by type:" << std::endl;
+      for (auto it : info->numShapes)
+        std::cout << " - " << math::prettyNumber(it.second) << "x\t" << it.first
+                  << " (" << math::prettyNumber(info->numPrims[it.first]) << " prims)" << std::endl;
+      if (!info->bounds.empty())
+        std::cout << "scene bounds " << info->bounds << std::endl;
+    }
+
     void pbrtInfo(int ac, char **av)
     {
       std::string fileName;
       bool parseOnly = false;
+      bool metadataOnly = false;
       for (int i=1;i<ac;i++) {
         const std::string arg = av[i];
         if (arg == "--lint" || arg == "-lint") {
           parseOnly = true;
+        } else if (arg == "--metadata" || arg == "-metadata") {
+          metadataOnly = true;
         } else if (arg[0] == '-') {
           throw std::runtime_error("invalid argument '"+arg+"'");
         } else {
@@ -173,6 +204,11 @@ namespace pbrt {
     
       std::shared_ptr<Scene> scene;
       try {
+        if (metadataOnly) {
+          // camera, film, and counts only, without loading the scene
+          printSceneInfo(loadSceneInfo(fileName));
+          return;
+        }
         if (endsWith(fileName,".pbrt"))
           scene = importPBRT(fileName);
         else if (endsWith(fileName,".pbf"))
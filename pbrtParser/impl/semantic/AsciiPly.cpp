@@ -0,0 +1,522 @@
+// ======================================================================== //
+// Copyright 2019-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/*! \file AsciiPly.cpp Fast path for reading ascii PLY files: rather
+    than going through rply's per-value callbacks we map the file,
+    split the element section into lines (in parallel), and decode
+    all lines straight into the output arrays. Anything this path
+    does not understand (binary files, list properties in vertices,
+    elements spanning multiple lines, etc) makes it bail out, in
+    which case the caller falls back to rply */
+
+#include "SemanticParser.h"
+#include "../syntactic/FileMapping.h"
+#include "../syntactic/Parallel.h"
+// std
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+namespace pbrt {
+  namespace ply {
+
+    /*! one property of a ply element, as declared in the header */
+    struct AsciiProperty {
+      std::string name;
+      bool        isList;
+    };
+
+    /*! one element of a ply file, as declared in the header */
+    struct AsciiElement {
+      std::string                name;
+      size_t                     count;
+      std::vector<AsciiProperty> properties;
+      /*! index of the first line (within the element section) that
+          holds an instance of this element */
+      size_t                     firstLine;
+    };
+
+    inline bool isBlank(char c)
+    {
+      return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline void skipBlanks(const char *&s, const char *end)
+    {
+      while (s < end && isBlank(*s)) ++s;
+    }
+
+    /*! powers of ten that are exactly representable in a double */
+    static const double exactPowersOfTen[] = {
+      1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+      1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+      1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    /*! slow-but-safe path for numbers the fast path can't do exactly
+        (too many digits, large exponents, 'nan', 'inf', ...). Note
+        the mapped file isn't zero-terminated, so we have to copy the
+        token before calling strtod */
+    static bool parseNumberSlow(const char *&s, const char *end, double &result)
+    {
+      char token[128];
+      size_t len = 0;
+      while (s+len < end && !isBlank(s[len]) && s[len] != '\n') {
+        if (len+1 >= sizeof(token)) return false;
+        token[len] = s[len];
+        ++len;
+      }
+      if (len == 0) return false;
+      token[len] = 0;
+      char *tokenEnd = nullptr;
+      result = strtod(token,&tokenEnd);
+      if (tokenEnd != token+len) return false;
+      s += len;
+      return true;
+    }
+
+    /*! parse a (float or integer) number, leaving 's' right behind
+        it. If mantissa and exponent are small enough we can compute
+        the result exactly from one integer and one exact power of
+        ten, which gives the same (correctly rounded) double that
+        strtod - and thus rply - would have produced; everything else
+        goes through strtod */
+    static bool parseNumber(const char *&s, const char *end, double &result)
+    {
+      const char *begin = s;
+      const char *p     = s;
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) { negative = (*p == '-'); ++p; }
+
+      uint64_t mantissa  = 0;
+      int      numDigits = 0;
+      int      exponent  = 0;
+      while (p < end && *p >= '0' && *p <= '9') {
+        mantissa = 10*mantissa + (*p - '0');
+        ++numDigits; ++p;
+      }
+      if (p < end && *p == '.') {
+        ++p;
+        while (p < end && *p >= '0' && *p <= '9') {
+          mantissa = 10*mantissa + (*p - '0');
+          ++numDigits; --exponent; ++p;
+        }
+      }
+      if (numDigits == 0)
+        return parseNumberSlow(s=begin,end,result);
+      if (p < end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExp = false;
+        if (p < end && (*p == '-' || *p == '+')) { negativeExp = (*p == '-'); ++p; }
+        if (p >= end || *p < '0' || *p > '9')
+          return parseNumberSlow(s=begin,end,result);
+        int exp = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+          if (exp < 100000) exp = 10*exp + (*p - '0');
+          ++p;
+        }
+        exponent += negativeExp ? -exp : exp;
+      }
+      if (p < end && !isBlank(*p) && *p != '\n')
+        return parseNumberSlow(s=begin,end,result);
+      if (numDigits > 19 || mantissa > (1ull<<53) || exponent < -22 || exponent > 22)
+        return parseNumberSlow(s=begin,end,result);
+
+      double value = double(mantissa);
+      if (exponent < 0)
+        value /= exactPowersOfTen[-exponent];
+      else
+        value *= exactPowersOfTen[exponent];
+      result = negative ? -value : value;
+      s = p;
+      return true;
+    }
+
+    /*! parse a (non-negative or negative) integer; fails for
+        anything that isn't integral, or doesn't fit into an int */
+    static bool parseInt(const char *&s, const char *end, int &result)
+    {
+      const char *p = s;
+      bool negative = false;
+      if (p < end && (*p == '-' || *p == '+')) { negative = (*p == '-'); ++p; }
+      const char *digitsBegin = p;
+      int64_t value = 0;
+      while (p < end && *p >= '0' && *p <= '9') {
+        value = 10*value + (*p - '0');
+        if (value > INT_MAX) return false;
+        ++p;
+      }
+      if (p == digitsBegin || (p < end && !isBlank(*p) && *p != '\n')) {
+        // not a plain integer - might still be something like '3.0'
+        double asDouble;
+        if (!parseNumber(s,end,asDouble)) return false;
+        // (also catches NaNs)
+        if (!(asDouble >= -INT_MAX && asDouble <= INT_MAX) || asDouble != std::floor(asDouble))
+          return false;
+        result = (int)asDouble;
+        return true;
+      }
+      result = (int)(negative ? -value : value);
+      s = p;
+      return true;
+    }
+
+    /*! max number of vertices in any face we can handle */
+    static const int maxPolygonVertices = 256;
+    
+    /*! parse all properties of one face, and return the vertex
+        indices in 'faceVertex' */
+    static bool parseFaceLine(const char *&p, const char *eol,
+                              const AsciiElement &element,
+                              int indexProperty,
+                              int *faceVertex,
+                              int &numVertices)
+    {
+      for (size_t i=0;i<element.properties.size();i++) {
+        skipBlanks(p,eol);
+        if (!element.properties[i].isList) {
+          double ignore;
+          if (!parseNumber(p,eol,ignore)) return false;
+          continue;
+        }
+        int count = 0;
+        if (!parseInt(p,eol,count) || count < 0) return false;
+        if ((int)i == indexProperty) {
+          if (count > maxPolygonVertices) return false;
+          numVertices = count;
+          for (int j=0;j<count;j++) {
+            skipBlanks(p,eol);
+            if (!parseInt(p,eol,faceVertex[j])) return false;
+          }
+        } else {
+          for (int j=0;j<count;j++) {
+            double ignore;
+            skipBlanks(p,eol);
+            if (!parseNumber(p,eol,ignore)) return false;
+          }
+        }
+      }
+      return true;
+    }
+    
+    /*! read one header line; returns false at end of file */
+    static bool readHeaderLine(const char *&s, const char *end, std::string &line)
+    {
+      if (s >= end) return false;
+      const char *eol = (const char *)memchr(s,'\n',end-s);
+      if (!eol) eol = end;
+      const char *lineEnd = eol;
+      while (lineEnd > s && isBlank(lineEnd[-1])) --lineEnd;
+      line = std::string(s,lineEnd);
+      s = (eol < end) ? eol+1 : end;
+      return true;
+    }
+
+    bool parseAscii(const std::string &fileName,
+                    MappableArray<vec3f> &pos,
+                    MappableArray<vec3f> &nor,
+                    MappableArray<vec2f> &tex,
+                    MappableArray<vec3i> &idx,
+                    MappableArray<vec4i> &quads,
+                    bool triangulatePolygons)
+    {
+      std::shared_ptr<syntactic::FileMapping> file;
+      try {
+        file = std::make_shared<syntactic::FileMapping>(fileName);
+      } catch (std::runtime_error &) {
+        return false;
+      }
+      const char *s   = (const char *)file->data();
+      const char *end = s + file->nbytes();
+
+      // ------------------------------------------------------------------
+      // header
+      // ------------------------------------------------------------------
+      std::string line;
+      if (!readHeaderLine(s,end,line) || line != "ply") return false;
+      if (!readHeaderLine(s,end,line) || line.substr(0,13) != "format ascii ") return false;
+
+      std::vector<AsciiElement> elements;
+      while (true) {
+        if (!readHeaderLine(s,end,line)) return false;
+        std::stringstream ss(line);
+        std::string keyword;
+        ss >> keyword;
+        if (keyword == "end_header")
+          break;
+        else if (keyword == "comment" || keyword == "obj_info" || keyword == "")
+          continue;
+        else if (keyword == "element") {
+          AsciiElement element;
+          if (!(ss >> element.name >> element.count)) return false;
+          elements.push_back(element);
+        } else if (keyword == "property") {
+          if (elements.empty()) return false;
+          AsciiProperty property;
+          std::string type;
+          if (!(ss >> type)) return false;
+          property.isList = (type == "list");
+          if (property.isList) {
+            std::string countType, itemType;
+            if (!(ss >> countType >> itemType)) return false;
+          }
+          if (!(ss >> property.name)) return false;
+          elements.back().properties.push_back(property);
+        } else
+          return false;
+      }
+
+      // ------------------------------------------------------------------
+      // figure out which columns we need
+      // ------------------------------------------------------------------
+      const AsciiElement *vertexElement = nullptr;
+      const AsciiElement *faceElement   = nullptr;
+      size_t numLines = 0;
+      for (auto &element : elements) {
+        element.firstLine = numLines;
+        numLines += element.count;
+        if (element.name == "vertex") vertexElement = &element;
+        if (element.name == "face")   faceElement   = &element;
+      }
+      if (!vertexElement || !faceElement ||
+          vertexElement->count == 0 || faceElement->count == 0)
+        // let rply produce the proper error message
+        return false;
+
+      // for each vertex property, which float (0..7 = x,y,z,nx,ny,nz,u,v)
+      // it is going to be written to, or -1 if not used
+      enum { X=0, Y, Z, NX, NY, NZ, U, V, NUM_COLUMNS };
+      std::vector<int> vertexColumn(vertexElement->properties.size(),-1);
+      int lastColumnUse[NUM_COLUMNS];
+      for (int i=0;i<NUM_COLUMNS;i++) lastColumnUse[i] = -1;
+      for (size_t i=0;i<vertexElement->properties.size();i++) {
+        const AsciiProperty &property = vertexElement->properties[i];
+        if (property.isList) return false;
+        const std::string &pname = property.name;
+        int column = -1;
+        if (pname == "x") column = X;
+        else if (pname == "y") column = Y;
+        else if (pname == "z") column = Z;
+        else if (pname == "nx") column = NX;
+        else if (pname == "ny") column = NY;
+        else if (pname == "nz") column = NZ;
+        else if (pname == "u" || pname == "s" || pname == "texture_u" || pname == "texture_s")
+          column = U;
+        else if (pname == "v" || pname == "t" || pname == "texture_v" || pname == "texture_t")
+          column = V;
+        if (column >= 0) {
+          // same as with rply, the last property of a given name wins
+          if (lastColumnUse[column] >= 0) vertexColumn[lastColumnUse[column]] = -1;
+          lastColumnUse[column] = (int)i;
+          vertexColumn[i] = column;
+        }
+      }
+      if (lastColumnUse[X] < 0 || lastColumnUse[Y] < 0 || lastColumnUse[Z] < 0)
+        return false;
+      const bool hasNormals
+        = lastColumnUse[NX] >= 0 && lastColumnUse[NY] >= 0 && lastColumnUse[NZ] >= 0;
+      const bool hasUVs
+        = lastColumnUse[U] >= 0 && lastColumnUse[V] >= 0;
+      if (!hasNormals)
+        for (auto &c : vertexColumn) if (c >= NX && c <= NZ) c = -1;
+      if (!hasUVs)
+        for (auto &c : vertexColumn) if (c >= U) c = -1;
+
+      int indexProperty = -1;
+      for (size_t i=0;i<faceElement->properties.size();i++) {
+        const std::string &pname = faceElement->properties[i].name;
+        if (pname == "vertex_index" || pname == "vertex_indices") {
+          if (!faceElement->properties[i].isList) return false;
+          indexProperty = (int)i;
+        }
+      }
+
+      pos.resize(vertexElement->count);
+      if (hasNormals)      nor.resize(vertexElement->count);
+      if (hasUVs)          tex.resize(vertexElement->count);
+      if (indexProperty >= 0) idx.resize(faceElement->count);
+
+      // ------------------------------------------------------------------
+      // pre-split the element section into lines: first count the
+      // newlines in each block, then prefix-sum those to know which
+      // line each block starts with
+      // ------------------------------------------------------------------
+      const char  *dataBegin = s;
+      const size_t dataSize  = end - s;
+      const size_t blockSize = 1<<20;
+      const size_t numBlocks = (dataSize+blockSize-1)/blockSize;
+      std::vector<size_t> newlinesInBlock(numBlocks,0);
+      syntactic::parallel_for(numBlocks,[&](size_t blockID) {
+          const char *p = dataBegin + blockID*blockSize;
+          const char *blockEnd = std::min(end,p+blockSize);
+          size_t count = 0;
+          while ((p = (const char *)memchr(p,'\n',blockEnd-p)) != nullptr) {
+            ++count; ++p;
+          }
+          newlinesInBlock[blockID] = count;
+        });
+      std::vector<size_t> firstLineOfBlock(numBlocks+1,0);
+      for (size_t i=0;i<numBlocks;i++)
+        firstLineOfBlock[i+1] = firstLineOfBlock[i] + newlinesInBlock[i];
+      const size_t numLinesInFile
+        = firstLineOfBlock[numBlocks] + ((dataSize > 0 && end[-1] != '\n') ? 1 : 0);
+      if (numLinesInFile < numLines) {
+        pos.clear(); nor.clear(); tex.clear(); idx.clear(); quads.clear();
+        return false;
+      }
+
+      // ------------------------------------------------------------------
+      // helper that calls 'body(lineID,begin,end)' for every line
+      // that _starts_ in the given block; stops as soon as body
+      // returns false
+      // ------------------------------------------------------------------
+      std::atomic<bool> failed(false);
+      auto forEachLineInBlock = [&](size_t blockID, const std::function<bool(size_t,const char *,const char *)> &body) {
+        const char *blockBegin = dataBegin + blockID*blockSize;
+        const char *blockEnd   = std::min(end,blockBegin+blockSize);
+        const char *p = blockBegin;
+        size_t lineID = firstLineOfBlock[blockID];
+        if (p != dataBegin && p[-1] != '\n') {
+          // skip the line that started in the previous block
+          p = (const char *)memchr(p,'\n',blockEnd-p);
+          if (!p) return;
+          ++p; ++lineID;
+        }
+        while (p < blockEnd && !failed) {
+          const char *eol = (const char *)memchr(p,'\n',end-p);
+          if (!eol) eol = end;
+          if (lineID >= numLines) {
+            // trailing lines must not contain anything but whitespace
+            skipBlanks(p,eol);
+            if (p != eol) { failed = true; return; }
+          } else if (!body(lineID,p,eol)) {
+            failed = true;
+            return;
+          }
+          p = eol+1;
+          ++lineID;
+        }
+      };
+
+      // ------------------------------------------------------------------
+      // decode all lines straight into the output arrays. faces that
+      // aren't triangles only get counted in this pass; if there are
+      // any we'll do a second pass over the faces that writes quads -
+      // or, if there are only triangles and larger polygons, all
+      // faces as triangles
+      // ------------------------------------------------------------------
+      std::atomic<bool> needPolygonPass(false);
+      std::atomic<bool> haveQuads(false);
+      std::vector<size_t> numFacesInBlock(numBlocks,0);
+      syntactic::parallel_for(numBlocks,[&](size_t blockID) {
+          size_t elementID = 0;
+          size_t numFaces  = 0;
+          float vtx[NUM_COLUMNS];
+          int   faceVertex[maxPolygonVertices];
+          forEachLineInBlock(blockID,[&](size_t lineID, const char *p, const char *eol) {
+              while (lineID >= elements[elementID].firstLine + elements[elementID].count)
+                ++elementID;
+              const AsciiElement &element = elements[elementID];
+              const size_t itemID = lineID - element.firstLine;
+              if (&element == vertexElement) {
+                for (size_t i=0;i<vertexColumn.size();i++) {
+                  skipBlanks(p,eol);
+                  double value;
+                  if (!parseNumber(p,eol,value)) return false;
+                  if (vertexColumn[i] >= 0) vtx[vertexColumn[i]] = (float)value;
+                }
+                pos[itemID] = vec3f(vtx[X],vtx[Y],vtx[Z]);
+                if (hasNormals) nor[itemID] = vec3f(vtx[NX],vtx[NY],vtx[NZ]);
+                if (hasUVs)     tex[itemID] = vec2f(vtx[U],vtx[V]);
+              } else if (&element == faceElement) {
+                int numVertices = 0;
+                if (!parseFaceLine(p,eol,element,indexProperty,faceVertex,numVertices))
+                  return false;
+                if (indexProperty < 0)
+                  return true;
+                for (int i=0;i<numVertices;i++)
+                  if (faceVertex[i] < 0 || size_t(faceVertex[i]) >= vertexElement->count)
+                    // let rply produce the proper error message
+                    return false;
+                if (numVertices == 3) {
+                  idx[itemID] = vec3i(faceVertex[0],faceVertex[1],faceVertex[2]);
+                  numFaces += 1;
+                } else if (numVertices == 4) {
+                  needPolygonPass = true;
+                  haveQuads       = true;
+                  numFaces += 1;
+                } else if (numVertices > 4 && triangulatePolygons) {
+                  needPolygonPass = true;
+                  numFaces += numVertices-2;
+                } else
+                  // let rply produce the proper error message
+                  return false;
+              } else
+                // some other element we don't care about
+                return true;
+              skipBlanks(p,eol);
+              return p == eol;
+            });
+          numFacesInBlock[blockID] = numFaces;
+        });
+
+      if (!failed && needPolygonPass) {
+        idx.clear();
+        std::vector<size_t> firstFaceOfBlock(numBlocks+1,0);
+        for (size_t i=0;i<numBlocks;i++)
+          firstFaceOfBlock[i+1] = firstFaceOfBlock[i] + numFacesInBlock[i];
+        if (haveQuads)
+          quads.resize(firstFaceOfBlock[numBlocks]);
+        else
+          idx.resize(firstFaceOfBlock[numBlocks]);
+        syntactic::parallel_for(numBlocks,[&](size_t blockID) {
+            vec4i *outQuad = haveQuads ? quads.data() + firstFaceOfBlock[blockID] : nullptr;
+            vec3i *outTri  = haveQuads ? nullptr : idx.data() + firstFaceOfBlock[blockID];
+            int faceVertex[maxPolygonVertices];
+            forEachLineInBlock(blockID,[&](size_t lineID, const char *p, const char *eol) {
+                if (lineID <  faceElement->firstLine ||
+                    lineID >= faceElement->firstLine + faceElement->count)
+                  return true;
+                int numVertices = 0;
+                parseFaceLine(p,eol,*faceElement,indexProperty,faceVertex,numVertices);
+                if (!haveQuads)
+                  // fan-triangulate the polygons
+                  for (int i=1;i<numVertices-1;i++)
+                    *outTri++ = vec3i(faceVertex[0],faceVertex[i],faceVertex[i+1]);
+                else if (numVertices == 4)
+                  *outQuad++ = vec4i(faceVertex[0],faceVertex[1],faceVertex[2],faceVertex[3]);
+                else
+                  // triangles, and fan-triangulated polygons, become
+                  // degenerate quads
+                  for (int i=1;i<numVertices-1;i++)
+                    *outQuad++ = vec4i(faceVertex[0],faceVertex[i],faceVertex[i+1],faceVertex[i+1]);
+                return true;
+              });
+          });
+      }
+      
+      if (failed) {
+        pos.clear(); nor.clear(); tex.clear(); idx.clear(); quads.clear();
+        return false;
+      }
+      return true;
+    }
+
+  } // ::pbrt::ply
+} // ::pbrt
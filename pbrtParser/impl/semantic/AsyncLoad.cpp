@@ -0,0 +1,80 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "pbrtParser/Scene.h"
+#include "../syntactic/Parallel.h"
+#include "SemanticParser.h"
+// std
+#include <chrono>
+
+namespace pbrt {
+
+  /*! the threads that loadAsync() runs its loads on - two, so that a
+      load that's still busy noticing it got cancelled doesn't hold
+      up the one that replaces it */
+  static syntactic::TaskPool &asyncLoadPool()
+  {
+    static syntactic::TaskPool pool(2);
+    return pool;
+  }
+
+  bool AsyncLoad::isDone() const
+  {
+    return waitFor(0.);
+  }
+
+  bool AsyncLoad::waitFor(double seconds) const
+  {
+    return result.wait_for(std::chrono::duration<double>(seconds)) == std::future_status::ready;
+  }
+
+  Scene::SP AsyncLoad::get() const
+  {
+    return result.get();
+  }
+
+  AsyncLoad::SP loadAsync(const std::string &fileName,
+                          const LoadOptions &loadOptions,
+                          const ImportOptions &importOptions)
+  {
+    AsyncLoad::SP load = std::make_shared<AsyncLoad>();
+    load->progress = std::make_shared<LoadProgress>();
+    std::shared_ptr<std::promise<Scene::SP>> promise
+      = std::make_shared<std::promise<Scene::SP>>();
+    load->result = promise->get_future().share();
+
+    LoadOptions ourLoadOptions = loadOptions;
+    ourLoadOptions.progress = load->progress;
+    ImportOptions ourImportOptions = importOptions;
+    ourImportOptions.progress = load->progress;
+    asyncLoadPool().schedule([fileName,ourLoadOptions,ourImportOptions,promise]() {
+        // the load is all this thread does, so it may as well use
+        // all threads for its parallel loops
+        syntactic::insideParallelWorker() = false;
+        try {
+          if (endsWith(fileName,".pbf"))
+            promise->set_value(Scene::loadFrom(fileName,ourLoadOptions));
+          else
+            promise->set_value(importPBRT(fileName,ourImportOptions));
+        } catch (...) {
+          promise->set_exception(std::current_exception());
+        }
+        syntactic::insideParallelWorker() = true;
+      });
+    return load;
+  }
+
+} // ::pbrt
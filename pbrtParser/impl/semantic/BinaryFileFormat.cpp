@@ -15,14 +15,27 @@
 // ======================================================================== //
 
 #include "pbrtParser/Scene.h"
+#include "../syntactic/FileMapping.h"
+#include "../syntactic/Parallel.h"
+#include "SemanticParser.h"
+#include "Compression.h"
+#include "DirectIO.h"
 // std
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <stack>
 #include <string.h>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -33,9 +46,22 @@
 
 namespace pbrt {
 
-#define    PBRT_PARSER_SEMANTIC_FORMAT_ID 9
+#define    PBRT_PARSER_SEMANTIC_FORMAT_ID 20
 
   /* file version history
+     20: objects' and instances' bounds and primitive counts in the
+         shape table (\see Scene::loadRegion)
+     19: content hashes of all entities in the index, and updates
+         appended after the index (\see Scene::appendTo)
+     18: table of all shapes' bounds and primitive counts
+     17: large entities optionally in separate shard files
+     16: scene summary block, found through the entity index
+     15: 8- and 16-bit mesh indices
+     14: optionally quantized positions, normals, and texcoords
+     13: optionally compressed arrays
+     12: entity index at the end of the file
+     11: entity payloads and large arrays 64-byte aligned (for mapFrom)
+     10: QuadMesh::texcoord
      9: after merge of gitlab into github version
      8: added transform to distant lights
      6/7: mesh.alpha, and light sources with alpha
@@ -47,6 +73,102 @@ namespace pbrt {
   
   const uint32_t ourFormatTag = (PBRT_PARSER_SEMANTIC_FORMAT_ID);
 
+  /*! first format in which quad meshes have texture coordinates */
+  const uint32_t firstQuadTexcoordFormat = 10;
+  /*! first format in which each entity block's header is followed by
+      padding that makes its payload start at a multiple of
+      'arrayAlignment' in the file, and in which large arrays are
+      padded to that alignment within the payload */
+  const uint32_t firstAlignedFormat = 11;
+  /*! first format whose entity index also says where to find the
+      scene summary (\see SceneInfo) */
+  const uint32_t firstSummaryFormat = 16;
+  /*! first format whose entity index also lists the shard files */
+  const uint32_t firstShardedFormat = 17;
+  /*! first format whose entity index also says where to find the
+      shape table (\see StoredShapeInfo) */
+  const uint32_t firstShapeTableFormat = 18;
+  /*! first format whose entity index also has the entities' content
+      hashes (\see hashBytes) */
+  const uint32_t firstContentHashFormat = 19;
+  /*! alignment of entity payloads and large arrays */
+  const size_t   arrayAlignment = 64;
+  /*! arrays of at least that many bytes get aligned; smaller ones are
+      not worth the padding */
+  const size_t   alignedArrayMinBytes = 1024;
+
+  inline size_t alignUp(size_t offset)
+  { return (offset + arrayAlignment - 1) / arrayAlignment * arrayAlignment; }
+
+  /*! if set in an array's element count, the array's data is encoded
+      (\see EncodedArrayHeader) rather than stored as is */
+  const uint64_t encodedArrayFlag = uint64_t(1) << 63;
+  /*! arrays smaller than that don't get compressed */
+  const size_t   compressedArrayMinBytes = 4096;
+  /*! entities smaller than that stay in the main file, even if that
+      has shards (\see SaveOptions::shardSize) */
+  const size_t   shardedEntityMinBytes = 64*1024;
+  /*! (approximate) number of bytes per independently compressed block */
+  const size_t   compressionBlockSize = size_t(1) << 20;
+
+  /*! what comes after the element count of an encoded array; followed
+      by the compressed size of each block (as uint64_t's), and then
+      the blocks themselves. blocks whose compressed size is the same
+      as their uncompressed size are stored without compression */
+  struct EncodedArrayHeader {
+    typedef enum : uint8_t {
+      Filter_Delta   = 1,
+      Filter_Shuffle = 2
+    } Filter;
+    
+    /*! the SaveOptions::Compression codec */
+    uint8_t  codec;
+    /*! the filters applied before the codec (\see Filter) */
+    uint8_t  filters;
+    uint16_t reserved;
+    uint32_t elementSize;
+    uint64_t elementsPerBlock;
+    uint64_t numBlocks;
+  };
+
+  /*! if set in an array's element count, the array holds quantized
+      positions, normals, or texcoords (\see QuantizedArrayHeader) */
+  const uint64_t quantizedArrayFlag = uint64_t(1) << 62;
+
+  /*! what comes after the element count of a quantized array;
+      followed by the quantized values, as a regular (possibly
+      compressed) array of integers */
+  struct QuantizedArrayHeader {
+    typedef enum : uint8_t {
+      /*! each component relative to the array's bounds, with 'bits'
+          bits each; as uint16_t triplets for up to 16 bits, else
+          packed into one uint64_t per position */
+      Encoding_Positions = 1,
+      /*! octahedral encoding, two 16-bit values in a uint32_t */
+      Encoding_Normals,
+      /*! half floats, as uint16_t pairs */
+      Encoding_Texcoords,
+      /*! (lossless) mesh indices, with 'bits' (8 or 16) bits each, as
+          uint8_t's or uint16_t's */
+      Encoding_Indices
+    } Encoding;
+
+    uint8_t  encoding;
+    uint8_t  bits;
+    uint16_t reserved;
+    /*! lower corner of the positions' bounds */
+    vec3f    lower;
+    /*! distance between two quantized values */
+    vec3f    step;
+  };
+
+  /*! whether arrays of given type contain integers (which get delta
+      encoded before compression) */
+  template<typename T> struct IsIntegerArray : public std::is_integral<T> {};
+  template<> struct IsIntegerArray<vec2i> : public std::true_type {};
+  template<> struct IsIntegerArray<vec3i> : public std::true_type {};
+  template<> struct IsIntegerArray<vec4i> : public std::true_type {};
+
   enum {
     TYPE_ERROR=0,
     TYPE_SCENE,
@@ -101,6 +223,406 @@ namespace pbrt {
     TYPE_POINT_LIGHT_SOURCE,
 
     TYPE_PIXEL_FILTER = 80,
+
+    /*! not an entity, but the index of all entities, at the end of the file */
+    TYPE_ENTITY_INDEX = 90,
+    /*! not an entity either, but a summary of the scene (\see
+        SceneInfo), right before the index */
+    TYPE_SCENE_SUMMARY,
+    /*! an empty block at the start of a file whose large entities
+        are in separate shard files (\see SaveOptions::shardSize) */
+    TYPE_SHARDED_FILE,
+    /*! all shapes', objects', and instances' bounds and primitive
+        counts (\see StoredShapeInfo), right before the summary */
+    TYPE_SHAPE_TABLE,
+  };
+
+  inline bool isShapeTag(int32_t tag)
+  { return tag >= TYPE_TRIANGLE_MESH && tag <= TYPE_CURVE; }
+
+  inline bool isMaterialOrTextureTag(int32_t tag)
+  { return tag >= TYPE_MATERIAL && tag < TYPE_TRIANGLE_MESH; }
+
+  /*! whether a block with given tag holds an entity (and thus goes
+      into the entity index) */
+  inline bool isEntityTag(int32_t tag)
+  {
+    return tag != TYPE_ENTITY_INDEX && tag != TYPE_SCENE_SUMMARY
+      && tag != TYPE_SHARDED_FILE && tag != TYPE_SHAPE_TABLE;
+  }
+
+  /*! where in the file a given entity's data is */
+  struct EntityBlock {
+    /*! offset of the payload (not of the block header) */
+    uint64_t offset;
+    uint64_t size;
+    int32_t  tag;
+    /*! 0 if the block is in the file itself, otherwise the number
+        (starting at 1) of the shard file it is in */
+    int32_t  shard;
+  };
+
+  /*! what the shape table stores for each shape, so lazily loaded
+      shapes can report their bounds and primitive counts without
+      loading their data (\see Shape::storedBounds) - and, since
+      format 20, for each object and instance, so those don't have to
+      look at all their shapes to find theirs */
+  struct StoredShapeInfo {
+    int32_t  entityID;
+    int32_t  reserved;
+    box3f    bounds;
+    uint64_t numPrims;
+  };
+
+  /*! the last bytes of a file with an entity index: where to find
+      the index block's payload, and a magic number to recognize it */
+  struct IndexTrailer {
+    uint64_t indexOffset;
+    char     magic[8];
+  };
+  static const char indexMagic[8] = { 'P','B','F','I','N','D','E','X' };
+
+  inline uint64_t mixBits(uint64_t h)
+  {
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  /*! 64-bit hash of an entity's payload, which tells Scene::appendTo
+      whether the file already has that entity; the payload can get
+      added in pieces */
+  struct ContentHasher {
+    void add(const void *ptr, size_t numBytes)
+    {
+      const uint8_t *data = (const uint8_t *)ptr;
+      numAdded += numBytes;
+      // complete the word we've started, if any ...
+      if (numPending) {
+        const size_t numTaken = std::min(numBytes,sizeof(pending)-numPending);
+        memcpy(pending+numPending,data,numTaken);
+        numPending += numTaken;
+        data       += numTaken;
+        numBytes   -= numTaken;
+        if (numPending < sizeof(pending)) return;
+        addWord(pending);
+        numPending = 0;
+      }
+      // ... then take whole words straight from the data
+      for (;numBytes >= sizeof(pending);numBytes -= sizeof(pending), data += sizeof(pending))
+        addWord(data);
+      memcpy(pending+numPending,data,numBytes);
+      numPending += numBytes;
+    }
+
+    uint64_t finish() const
+    {
+      uint64_t tail = 0;
+      memcpy(&tail,pending,numPending);
+      return mixBits(hash ^ tail ^ mixBits(numAdded));
+    }
+
+  private:
+    inline void addWord(const uint8_t *ptr)
+    {
+      uint64_t word;
+      memcpy(&word,ptr,sizeof(word));
+      hash = (hash ^ mixBits(word)) * 0x9e3779b97f4a7c15ull;
+      hash ^= hash >> 29;
+    }
+
+    uint64_t hash       = 0x9e3779b97f4a7c15ull;
+    uint64_t numAdded   = 0;
+    uint8_t  pending[8];
+    size_t   numPending = 0;
+  };
+
+  inline uint64_t hashBytes(const uint8_t *data, size_t numBytes)
+  {
+    ContentHasher hasher;
+    hasher.add(data,numBytes);
+    return hasher.finish();
+  }
+
+  /*! where a BinaryReader gets its data from */
+  struct BinarySource {
+    typedef std::shared_ptr<BinarySource> SP;
+    virtual ~BinarySource() {}
+    virtual size_t size() const = 0;
+    /*! copy given range of the file to 'dst' */
+    virtual void read(size_t offset, void *dst, size_t numBytes) = 0;
+    /*! return pointer to the given range of the file: either straight
+        into the file mapping, or into 'buffer' */
+    virtual const uint8_t *get(size_t offset, size_t numBytes, std::vector<uint8_t> &buffer) = 0;
+    /*! the mapping the data lives in, if any */
+    std::shared_ptr<syntactic::FileMapping> mapping;
+  };
+
+  struct MappedBinarySource : public BinarySource {
+    MappedBinarySource(const std::string &fileName)
+    { mapping = std::make_shared<syntactic::FileMapping>(fileName,/*copyOnWrite*/true); }
+    size_t size() const override { return mapping->nbytes(); }
+    void read(size_t offset, void *dst, size_t numBytes) override
+    {
+      if (offset + numBytes > size())
+        throw std::runtime_error("invalid pbf file - read past end of file");
+      memcpy(dst,mapping->data()+offset,numBytes);
+    }
+    const uint8_t *get(size_t offset, size_t numBytes, std::vector<uint8_t> &) override
+    {
+      if (offset + numBytes > size())
+        throw std::runtime_error("invalid pbf file - read past end of file");
+      return mapping->data()+offset;
+    }
+  };
+
+  struct FileBinarySource : public BinarySource {
+    FileBinarySource(const std::string &fileName)
+      : in(fileName, std::ios_base::binary)
+    {
+      if (!in.good())
+        throw std::runtime_error("could not open pbf file '"+fileName+"'");
+      in.seekg(0,std::ios::end);
+      fileSize = (size_t)in.tellg();
+    }
+    size_t size() const override { return fileSize; }
+    void read(size_t offset, void *dst, size_t numBytes) override
+    {
+      if (offset + numBytes > fileSize)
+        throw std::runtime_error("invalid pbf file - read past end of file");
+      std::lock_guard<std::mutex> lock(mutex);
+      in.clear();
+      in.seekg(offset);
+      in.read((char*)dst,numBytes);
+      if (!in.good())
+        throw std::runtime_error("error reading pbf file");
+    }
+    const uint8_t *get(size_t offset, size_t numBytes, std::vector<uint8_t> &buffer) override
+    {
+      buffer.resize(numBytes);
+      read(offset,buffer.data(),numBytes);
+      return buffer.data();
+    }
+    std::ifstream in;
+    size_t        fileSize;
+    std::mutex    mutex;
+  };
+
+  /*! reads with large, aligned requests that bypass the page cache
+      (\see LoadOptions::directIO); unlike FileBinarySource, this one
+      doesn't need to lock, since it reads with pread() */
+  struct DirectBinarySource : public BinarySource {
+    DirectBinarySource(const std::string &fileName)
+      : file(fileName)
+    {}
+    size_t size() const override { return file.size(); }
+    void read(size_t offset, void *dst, size_t numBytes) override
+    {
+      std::vector<uint8_t> buffer;
+      memcpy(dst,file.get(offset,numBytes,buffer),numBytes);
+    }
+    const uint8_t *get(size_t offset, size_t numBytes, std::vector<uint8_t> &buffer) override
+    {
+      return file.get(offset,numBytes,buffer);
+    }
+    directio::InputFile file;
+  };
+
+  /*! the source to read given file through, according to given options */
+  inline BinarySource::SP openBinarySource(const std::string &fileName,
+                                           bool mapFile, bool directIO)
+  {
+    if (mapFile)
+      return std::make_shared<MappedBinarySource>(fileName);
+#ifndef _WIN32
+    if (directIO)
+      return std::make_shared<DirectBinarySource>(fileName);
+#endif
+    return std::make_shared<FileBinarySource>(fileName);
+  }
+
+  /*! the stream to write given file through (\see SaveOptions::directIO) */
+  inline std::shared_ptr<std::ostream> openOutputFile(const std::string &fileName,
+                                                      bool directIO, bool append = false)
+  {
+#ifndef _WIN32
+    if (directIO)
+      return std::make_shared<directio::OutputFile>(fileName,append);
+#endif
+    return std::make_shared<std::ofstream>
+      (fileName,append ? (std::ios_base::binary|std::ios_base::app) : std::ios_base::binary);
+  }
+
+  /*! the state shared by all readers that decode entities of the
+      same file */
+  struct ReadContext {
+    BinarySource::SP source;
+    int32_t          formatTag;
+    /*! \see LoadOptions::compactIndices */
+    bool             compactIndices;
+    /*! all entities of the file, by ID. this is empty in the context
+        that lazily loaded shapes keep: they read everything that
+        refers to other entities (\see Shape::readFrom) up front, and
+        holding on to the entities would keep the whole scene alive
+        through the shapes' loaders */
+    std::shared_ptr<std::vector<Entity::SP>> entities;
+
+    /*! the shard files' names (\see SaveOptions::shardSize), and
+        where to find them; shards only get opened once we first
+        need something from them */
+    std::vector<std::string>      shardFileNames;
+    std::string                   shardPath;
+    /*! map the shards, rather than read them (\see LoadOptions::mapFile) */
+    bool                          mapShards = false;
+    /*! \see LoadOptions::directIO */
+    bool                          directShards = false;
+    std::vector<BinarySource::SP> shardSources;
+    std::mutex                    shardMutex;
+
+    /*! the source that given block is in */
+    BinarySource &sourceFor(const EntityBlock &block)
+    {
+      if (block.shard == 0)
+        return *source;
+      std::lock_guard<std::mutex> lock(shardMutex);
+      if (block.shard < 0 || block.shard > (int32_t)shardFileNames.size())
+        throw std::runtime_error("invalid pbf file - entity in unknown shard");
+      BinarySource::SP &shard = shardSources[block.shard-1];
+      if (!shard) {
+        const std::string fileName = shardPath + shardFileNames[block.shard-1];
+        shard = openBinarySource(fileName,mapShards,directShards);
+      }
+      return *shard;
+    }
+  };
+
+  struct ShapePager;
+
+  /*! decodes a lazily loaded shape on first access */
+  struct LazyShapeLoader {
+    ~LazyShapeLoader();
+    void load(Shape *shape);
+    /*! load the shape if required, and - if it's paged - mark it as
+        just used, and add 'pinDelta' to its pin count */
+    void access(Shape *shape, int pinDelta);
+
+    std::shared_ptr<ReadContext> context;
+    EntityBlock                      block;
+    /*! where in the block the shape's own data starts - the part
+        before that (\see Shape::readFrom) got read up front */
+    size_t                           headerSize { 0 };
+    std::mutex                       mutex;
+    std::atomic<bool>                loaded { false };
+
+    /*! the pager that may evict the shape's data again, if any
+        (\see LoadOptions::residentBudget) */
+    std::shared_ptr<ShapePager>      pager;
+    /*! the shape we belong to (only needed for evicting its data) */
+    Shape                           *shape { nullptr };
+    /*! number of bytes the shape's data takes while loaded */
+    size_t                           residentBytes { 0 };
+    int                              pinCount { 0 };
+    /*! where we are in the pager's list, while loaded */
+    std::list<LazyShapeLoader*>::iterator lruPosition;
+  };
+
+  /*! number of bytes of given shape's data that a ShapePager can
+      evict again */
+  static size_t evictableBytes(Shape *shape)
+  {
+    if (TriangleMesh *mesh = dynamic_cast<TriangleMesh*>(shape))
+      return mesh->vertex.capacity()*sizeof(vec3f)
+        + mesh->normal.capacity()*sizeof(vec3f)
+        + mesh->texcoord.capacity()*sizeof(vec2f)
+        + mesh->index.capacity()*sizeof(vec3i)
+        + mesh->compactIndex.data.capacity();
+    if (QuadMesh *mesh = dynamic_cast<QuadMesh*>(shape))
+      return mesh->vertex.capacity()*sizeof(vec3f)
+        + mesh->normal.capacity()*sizeof(vec3f)
+        + mesh->texcoord.capacity()*sizeof(vec2f)
+        + mesh->index.capacity()*sizeof(vec4i)
+        + mesh->compactIndex.data.capacity();
+    if (Curve *curve = dynamic_cast<Curve*>(shape))
+      return curve->P.capacity()*sizeof(vec3f);
+    return 0;
+  }
+
+  /*! free the data counted by evictableBytes() */
+  static void evictData(Shape *shape)
+  {
+    if (TriangleMesh *mesh = dynamic_cast<TriangleMesh*>(shape)) {
+      MappableArray<vec3f>().swap(mesh->vertex);
+      MappableArray<vec3f>().swap(mesh->normal);
+      MappableArray<vec2f>().swap(mesh->texcoord);
+      MappableArray<vec3i>().swap(mesh->index);
+      mesh->compactIndex = CompactIndices();
+    } else if (QuadMesh *mesh = dynamic_cast<QuadMesh*>(shape)) {
+      MappableArray<vec3f>().swap(mesh->vertex);
+      MappableArray<vec3f>().swap(mesh->normal);
+      MappableArray<vec2f>().swap(mesh->texcoord);
+      MappableArray<vec4i>().swap(mesh->index);
+      mesh->compactIndex = CompactIndices();
+    } else if (Curve *curve = dynamic_cast<Curve*>(shape))
+      MappableArray<vec3f>().swap(curve->P);
+  }
+
+  /*! keeps the data of all shapes that got loaded with the same
+      LoadOptions::residentBudget within that budget, by evicting the
+      data of the least recently used shapes that aren't pinned */
+  struct ShapePager {
+    ShapePager(size_t budget) : budget(budget) {}
+
+    /*! given shape just got loaded */
+    void add(LazyShapeLoader *loader)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      lru.push_front(loader);
+      loader->lruPosition = lru.begin();
+      residentBytes += loader->residentBytes;
+    }
+
+    /*! given shape is going away */
+    void remove(LazyShapeLoader *loader)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!loader->loaded) return;
+      lru.erase(loader->lruPosition);
+      residentBytes -= loader->residentBytes;
+    }
+
+    /*! mark given shape as most recently used, add 'pinDelta' to its
+        pin count, and evict other shapes if we're over budget;
+        returns false if the shape got evicted before we got here */
+    bool touch(LazyShapeLoader *loader, int pinDelta)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!loader->loaded) return false;
+      lru.splice(lru.begin(),lru,loader->lruPosition);
+      loader->pinCount += pinDelta;
+
+      auto it = lru.end();
+      while (residentBytes > budget && it != lru.begin()) {
+        LazyShapeLoader *victim = *--it;
+        if (victim == loader || victim->pinCount > 0)
+          continue;
+        // (whoever holds that lock is about to use the shape)
+        std::unique_lock<std::mutex> victimLock(victim->mutex,std::try_to_lock);
+        if (!victimLock.owns_lock())
+          continue;
+        evictData(victim->shape);
+        victim->loaded = false;
+        residentBytes -= victim->residentBytes;
+        it = lru.erase(it);
+      }
+      return true;
+    }
+
+    const size_t                budget;
+    size_t                      residentBytes { 0 };
+    /*! all loaded shapes, most recently used first */
+    std::list<LazyShapeLoader*> lru;
+    std::mutex                  mutex;
   };
     
   /*! a simple buffer for binary data */
@@ -111,13 +633,370 @@ namespace pbrt {
 
   struct BinaryReader {
 
-    BinaryReader(std::istream &str)
-      : binStream(str)
+    /*! read all entities from given stream */
+    BinaryReader(std::istream &binStream)
     {
-      int32_t formatTag;
       if (!binStream.good())
         throw std::runtime_error("invalid input stream - could not open file?");
       binStream.read((char*)&formatTag,sizeof(formatTag));
+      checkFormatTag();
+      std::vector<uint8_t> entityData;
+      while (1) {
+        uint64_t size;
+        binStream.read((char*)&size,sizeof(size));
+        if (!binStream.good())
+          break;
+        int32_t tag;
+        binStream.read((char*)&tag,sizeof(tag));
+        if (alignedArrays()) {
+          uint32_t numPadBytes;
+          binStream.read((char*)&numPadBytes,sizeof(numPadBytes));
+          binStream.ignore(numPadBytes);
+        }
+        entityData.resize(size);
+        binStream.read((char *)entityData.data(),size);
+        readEntity(tag,entityData.data(),size);
+      }
+    }
+
+    /*! read all entities from given source (if that's a file
+        mapping, large arrays of the entities will point into that
+        mapping, rather than get copied).
+
+        Since we know where every entity's data is, we first create
+        all entities (empty), and then have them read themselves - in
+        any order, and, with 'options.parallel', on all threads: all
+        references to other entities resolve to those already-created
+        entities. With 'options.lazyShapes' shapes don't read their
+        data at all, but will do so on first access - and with
+        'options.residentBudget' may get evicted again later */
+    BinaryReader(BinarySource::SP source, const LoadOptions &options,
+                 const std::string &shardPath)
+      : mapping(source->mapping)
+    {
+      if (source->size() < sizeof(formatTag))
+        throw std::runtime_error("invalid pbf file - too small");
+      source->read(0,&formatTag,sizeof(formatTag));
+      checkFormatTag();
+
+      std::shared_ptr<ReadContext> context = std::make_shared<ReadContext>();
+      EntityBlock shapeTableBlock { 0, 0, TYPE_SHAPE_TABLE, 0 };
+      const std::vector<EntityBlock> index
+        = readIndex(*source,&context->shardFileNames,&shapeTableBlock);
+      const bool lazyShapes = options.lazyShapes || options.residentBudget;
+      readEntities->resize(index.size());
+      for (size_t ID=0;ID<index.size();ID++)
+        (*readEntities)[ID] = createEntity(index[ID].tag);
+
+      context->source         = source;
+      context->formatTag      = formatTag;
+      context->compactIndices = options.compactIndices;
+      context->entities       = readEntities;
+      context->shardPath      = shardPath;
+      context->mapShards      = options.mapFile;
+      context->directShards   = options.directIO;
+      context->shardSources.resize(context->shardFileNames.size());
+      auto isLazyShape = [&](size_t ID) {
+        return lazyShapes && isShapeTag(index[ID].tag) && (*readEntities)[ID];
+      };
+      auto toBeDecoded = [&](size_t ID) {
+        return (*readEntities)[ID] && !isLazyShape(ID);
+      };
+      std::vector<size_t> headerSizes(lazyShapes ? index.size() : 0);
+      LoadProgress *progress = options.progress.get();
+      if (progress)
+        for (size_t ID=0;ID<index.size();ID++)
+          progress->entitiesTotal += toBeDecoded(ID);
+      auto decodeEntity = [&](size_t ID) {
+        if (isLazyShape(ID)) {
+          BinaryReader reader(*context);
+          headerSizes[ID]
+            = reader.decodeShapeHeader((Shape *)(*readEntities)[ID].get(),
+                                       context->sourceFor(index[ID]),index[ID]);
+          return;
+        }
+        if (!toBeDecoded(ID))
+          return;
+        if (progress)
+          progress->checkCancelled();
+        BinaryReader reader(*context);
+        reader.decode((*readEntities)[ID].get(),context->sourceFor(index[ID]),index[ID]);
+        if (progress) {
+          progress->entitiesDecoded++;
+          progress->bytesConsumed += index[ID].size;
+        }
+      };
+      if (options.parallel)
+        syntactic::parallel_for(index.size(),decodeEntity);
+      else
+        for (size_t ID=0;ID<index.size();ID++)
+          decodeEntity(ID);
+      if (progress)
+        progress->filesDone++;
+      if (lazyShapes) {
+        // hand the shapes their loaders
+        std::shared_ptr<ShapePager> pager;
+        if (options.residentBudget)
+          pager = std::make_shared<ShapePager>(options.residentBudget);
+        context->entities = std::make_shared<std::vector<Entity::SP>>();
+        for (size_t ID=0;ID<index.size();ID++) {
+          if (!isLazyShape(ID)) continue;
+          Shape::SP shape = std::dynamic_pointer_cast<Shape>((*readEntities)[ID]);
+          shape->lazyLoader = std::make_shared<LazyShapeLoader>();
+          shape->lazyLoader->context    = context;
+          shape->lazyLoader->block      = index[ID];
+          shape->lazyLoader->headerSize = headerSizes[ID];
+          shape->lazyLoader->pager   = pager;
+          shape->lazyLoader->shape   = shape.get();
+        }
+      }
+      if (shapeTableBlock.size)
+        readShapeTable(*source,shapeTableBlock,lazyShapes);
+    }
+
+    /*! have all objects and instances listed in the given shape table
+        know their bounds (and objects their primitive counts), as
+        well as - if 'lazyShapes' - all shapes listed there; shapes
+        that did get loaded compute theirs from their data */
+    void readShapeTable(BinarySource &source, const EntityBlock &block, bool lazyShapes)
+    {
+      std::vector<uint8_t> buffer;
+      currentEntityData   = source.get(block.offset,block.size,buffer);
+      currentEntitySize   = block.size;
+      currentEntityOffset = 0;
+      std::vector<StoredShapeInfo> table;
+      read(table);
+      currentEntityData = nullptr;
+      currentEntitySize = 0;
+      for (auto &info : table) {
+        if (info.entityID < 0 || info.entityID >= (int32_t)readEntities->size())
+          throw std::runtime_error("invalid pbf file - corrupt shape table");
+        Entity::SP entity = (*readEntities)[info.entityID];
+        if (Object::SP object = std::dynamic_pointer_cast<Object>(entity)) {
+          object->bounds               = info.bounds;
+          object->haveComputedBounds   = true;
+          object->numPrims             = info.numPrims;
+          object->haveComputedNumPrims = true;
+        } else if (Instance::SP inst = std::dynamic_pointer_cast<Instance>(entity)) {
+          inst->bounds             = info.bounds;
+          inst->haveComputedBounds = true;
+        } else if (Shape::SP shape = std::dynamic_pointer_cast<Shape>(entity)) {
+          if (!lazyShapes) continue;
+          shape->storedBounds   = info.bounds;
+          shape->storedNumPrims = info.numPrims;
+          shape->haveStoredInfo = true;
+        }
+      }
+    }
+
+    /*! a reader that doesn't read anything by itself, but decodes
+        individual entities on request (\see decode()), with
+        references resolved through the given entities */
+    BinaryReader(const ReadContext &context)
+      : formatTag(context.formatTag),
+        readEntities(context.entities),
+        compactIndices(context.compactIndices),
+        mapping(context.source->mapping)
+    {}
+
+    /*! have given entity read itself from the given block; for a
+        shape whose header got read already (\see
+        decodeShapeHeader()), 'headerSize' is where the rest starts */
+    void decode(Entity *entity, BinarySource &source, const EntityBlock &block,
+                size_t headerSize = 0)
+    {
+      mapping = source.mapping;
+      std::vector<uint8_t> buffer;
+      currentEntityData   = source.get(block.offset,block.size,buffer);
+      currentEntitySize   = block.size;
+      currentEntityOffset = headerSize;
+      skipShapeHeader     = (headerSize != 0);
+      entity->readFrom(*this);
+      currentEntityData = nullptr;
+      currentEntitySize = 0;
+      skipShapeHeader   = false;
+    }
+
+    /*! have given (lazily loaded) shape read only the part of its
+        block that all shapes share - which is all of it that refers
+        to other entities - and return how many bytes that was */
+    size_t decodeShapeHeader(Shape *shape, BinarySource &source, const EntityBlock &block)
+    {
+      // the header is usually tiny, so try not to read the whole
+      // block for it
+      size_t numBytes = std::min(block.size,(uint64_t)256);
+      std::vector<uint8_t> buffer;
+      while (1) {
+        currentEntityData   = source.get(block.offset,numBytes,buffer);
+        currentEntitySize   = numBytes;
+        currentEntityOffset = 0;
+        try {
+          shape->Shape::readFrom(*this);
+          break;
+        } catch (std::runtime_error &) {
+          if (numBytes == block.size) throw;
+          numBytes = block.size;
+        }
+      }
+      currentEntityData = nullptr;
+      currentEntitySize = 0;
+      return currentEntityOffset;
+    }
+
+    /*! find all entity blocks in the file - from the index at the end
+        of the file if there is one, or else by walking all the block
+        headers. if the file has shards, their names go into
+        'shardFileNames'; if it has a shape table, where to find that
+        goes into 'shapeTableBlock'; the entities' content hashes go
+        into 'contentHashes' */
+    std::vector<EntityBlock> readIndex(BinarySource &source,
+                                       std::vector<std::string> *shardFileNames = nullptr,
+                                       EntityBlock *shapeTableBlock = nullptr,
+                                       std::vector<uint64_t> *contentHashes = nullptr)
+    {
+      if (contentHashes)
+        contentHashes->clear();
+      std::vector<EntityBlock> index;
+      const size_t fileSize = source.size();
+      IndexTrailer trailer;
+      if (fileSize >= sizeof(formatTag) + sizeof(trailer)) {
+        source.read(fileSize-sizeof(trailer),&trailer,sizeof(trailer));
+        if (memcmp(trailer.magic,indexMagic,sizeof(indexMagic)) == 0) {
+          uint64_t numEntities;
+          source.read(trailer.indexOffset,&numEntities,sizeof(numEntities));
+          if (trailer.indexOffset + sizeof(numEntities) + numEntities*sizeof(EntityBlock) > fileSize)
+            throw std::runtime_error("invalid pbf file - corrupt entity index");
+          index.resize(numEntities);
+          source.read(trailer.indexOffset+sizeof(numEntities),index.data(),numEntities*sizeof(EntityBlock));
+          std::vector<std::string> shards;
+          size_t offset = trailer.indexOffset+sizeof(numEntities)
+            +(numEntities+1)*sizeof(EntityBlock);
+          if (formatTag >= (int32_t)firstShardedFormat)
+            // after the entities comes the summary block, then the shards
+            offset = readShardFileNames(source,offset,shards);
+          if (shardFileNames)
+            *shardFileNames = shards;
+          if (formatTag >= (int32_t)firstShapeTableFormat) {
+            if (offset + sizeof(EntityBlock) > fileSize)
+              throw std::runtime_error("invalid pbf file - corrupt entity index");
+            if (shapeTableBlock)
+              source.read(offset,shapeTableBlock,sizeof(EntityBlock));
+            offset += sizeof(EntityBlock);
+          }
+          if (contentHashes && formatTag >= (int32_t)firstContentHashFormat) {
+            if (offset + numEntities*sizeof(uint64_t) > fileSize)
+              throw std::runtime_error("invalid pbf file - corrupt entity index");
+            contentHashes->resize(numEntities);
+            source.read(offset,contentHashes->data(),numEntities*sizeof(uint64_t));
+          }
+          return index;
+        }
+      }
+
+      size_t offset = sizeof(formatTag);
+      while (offset + sizeof(uint64_t) + sizeof(int32_t) <= fileSize) {
+        EntityBlock block;
+        source.read(offset,&block.size,sizeof(block.size));
+        offset += sizeof(block.size);
+        source.read(offset,&block.tag,sizeof(block.tag));
+        offset += sizeof(block.tag);
+        if (alignedArrays()) {
+          uint32_t numPadBytes;
+          source.read(offset,&numPadBytes,sizeof(numPadBytes));
+          offset += sizeof(numPadBytes) + numPadBytes;
+        }
+        if (offset + block.size > fileSize)
+          throw std::runtime_error("invalid pbf file - truncated entity data");
+        block.offset   = offset;
+        block.shard  = 0;
+        if (isEntityTag(block.tag))
+          index.push_back(block);
+        offset += block.size;
+      }
+      return index;
+    }
+
+    /*! read the list of shard files (\see BinaryWriter::writeIndex)
+        that starts at given offset; returns where that list ends */
+    size_t readShardFileNames(BinarySource &source, size_t offset,
+                            std::vector<std::string> &shardFileNames)
+    {
+      int32_t numShards;
+      source.read(offset,&numShards,sizeof(numShards));
+      offset += sizeof(numShards);
+      for (int i=0;i<numShards;i++) {
+        int32_t length;
+        source.read(offset,&length,sizeof(length));
+        offset += sizeof(length);
+        if (length < 0 || offset + length > source.size())
+          throw std::runtime_error("invalid pbf file - corrupt list of shards");
+        std::string fileName(length,' ');
+        source.read(offset,&fileName[0],length);
+        offset += length;
+        shardFileNames.push_back(fileName);
+      }
+      return offset;
+    }
+
+    /*! read the scene summary (\see BinaryWriter::writeSummary)
+        from given source; returns null if the file doesn't have one */
+    SceneInfo::SP readSummary(BinarySource &source)
+    {
+      const size_t fileSize = source.size();
+      IndexTrailer trailer;
+      if (formatTag < (int32_t)firstSummaryFormat
+          || fileSize < sizeof(formatTag) + sizeof(trailer))
+        return nullptr;
+      source.read(fileSize-sizeof(trailer),&trailer,sizeof(trailer));
+      if (memcmp(trailer.magic,indexMagic,sizeof(indexMagic)) != 0)
+        return nullptr;
+      uint64_t numEntities;
+      source.read(trailer.indexOffset,&numEntities,sizeof(numEntities));
+      const size_t summaryBlockOffset
+        = trailer.indexOffset + sizeof(numEntities) + numEntities*sizeof(EntityBlock);
+      EntityBlock block;
+      if (summaryBlockOffset + sizeof(block) > fileSize)
+        throw std::runtime_error("invalid pbf file - corrupt entity index");
+      source.read(summaryBlockOffset,&block,sizeof(block));
+      if (block.size == 0)
+        return nullptr;
+
+      std::vector<uint8_t> buffer;
+      currentEntityData   = source.get(block.offset,block.size,buffer);
+      currentEntitySize   = block.size;
+      currentEntityOffset = 0;
+      SceneInfo::SP info = std::make_shared<SceneInfo>();
+      info->film = readInline<Film>(TYPE_FILM);
+      const int32_t numCameras = read<int32_t>();
+      for (int i=0;i<numCameras;i++)
+        info->cameras.push_back(readInline<Camera>(TYPE_CAMERA));
+      info->sampler     = readInline<Sampler>(TYPE_SAMPLER);
+      info->integrator  = readInline<Integrator>(TYPE_INTEGRATOR);
+      info->pixelFilter = readInline<PixelFilter>(TYPE_PIXEL_FILTER);
+      read(info->bounds);
+      info->numObjects      = (size_t)read<uint64_t>();
+      info->numInstances    = (size_t)read<uint64_t>();
+      info->numLightSources = (size_t)read<uint64_t>();
+      read(info->numShapes);
+      read(info->numPrims);
+      currentEntityData = nullptr;
+      currentEntitySize = 0;
+      return info;
+    }
+
+    /*! read an entity (of given type) written with
+        BinaryWriter::writeInline */
+    template<typename T>
+    std::shared_ptr<T> readInline(int32_t typeTag)
+    {
+      if (!read<int8_t>()) return nullptr;
+      std::shared_ptr<T> t = std::dynamic_pointer_cast<T>(createEntity(typeTag));
+      t->readFrom(*this);
+      return t;
+    }
+
+    void checkFormatTag()
+    {
       if (formatTag != ourFormatTag) {
         std::cout << "Warning: pbf file uses a different format tag ("
                   << ((int*)(size_t)formatTag) << ") than what this library is expecting ("
@@ -129,31 +1008,86 @@ namespace pbrt {
                     << "this means the file _should_ be incompatible with this library. "
                     << "Please regenerate the pbf file." << std::endl;
       }
-      while (1) {
-        uint64_t size;
-        binStream.read((char*)&size,sizeof(size));
-        if (!binStream.good())
-          break;
-        int32_t tag;
-        binStream.read((char*)&tag,sizeof(tag));
-        currentEntityData.resize(size);
-        binStream.read((char *)currentEntityData.data(),size);
-        currentEntityOffset = 0;
+    }
 
-        Entity::SP newEntity = createEntity(tag);
-        readEntities.push_back(newEntity);
-        if (newEntity) newEntity->readFrom(*this);
-        currentEntityData.clear();
-      }
-      // exit(0);
+    /*! whether the file's quad meshes have texture coordinates */
+    bool quadTexcoords() const
+    { return formatTag >= (int32_t)firstQuadTexcoordFormat; }
+
+    /*! whether the file uses the block padding and array alignment
+        introduced in format 11; older files are still readable */
+    bool alignedArrays() const
+    { return formatTag >= (int32_t)firstAlignedFormat; }
+
+    /*! create the entity for given block, and have it read itself */
+    void readEntity(int32_t tag, const uint8_t *data, size_t size)
+    {
+      if (tag == TYPE_SHARDED_FILE)
+        throw std::runtime_error("sharded pbf files can only be loaded from a file "
+                                 "(with Scene::loadFrom(fileName))");
+      if (sawIndex)
+        throw std::runtime_error("pbf files with appended updates can only be loaded "
+                                 "from a file (with Scene::loadFrom(fileName))");
+      if (tag == TYPE_ENTITY_INDEX)
+        sawIndex = true;
+      if (!isEntityTag(tag))
+        // not an entity
+        return;
+      currentEntityData   = data;
+      currentEntitySize   = size;
+      currentEntityOffset = 0;
+
+      Entity::SP newEntity = createEntity(tag);
+      readEntities->push_back(newEntity);
+      if (newEntity) newEntity->readFrom(*this);
+      currentEntityData = nullptr;
+      currentEntitySize = 0;
     }
 
     template<typename T>
     inline void copyBytes(T *t, size_t numBytes)
     {
-      if ((currentEntityOffset + numBytes) > currentEntityData.size())
+      if ((currentEntityOffset + numBytes) > currentEntitySize)
         throw std::runtime_error("invalid read attempt by entity - not enough data in data block!");
-      memcpy((void *)t,(void *)((char*)currentEntityData.data()+currentEntityOffset),numBytes);
+      memcpy((void *)t,(void *)(currentEntityData+currentEntityOffset),numBytes);
+      currentEntityOffset += numBytes;
+    }
+
+    /*! skip to where the writer put the data of an array of given
+        size (\see BinaryWriter::alignArray) */
+    inline void alignArray(size_t numBytes)
+    {
+      if (alignedArrays() && numBytes >= alignedArrayMinBytes)
+        currentEntityOffset = alignUp(currentEntityOffset);
+    }
+
+    /*! fill given array with the next 'length' elements */
+    template<typename T, typename A>
+    inline void readArray(std::vector<T, A> &vt, size_t length)
+    {
+      vt.resize(length);
+      copyBytes(vt.data(), length*sizeof(T));
+    }
+
+    /*! fill given array with the next 'length' elements - by pointing
+        it straight into the file mapping, if we have one */
+    template<typename T>
+    inline void readArray(MappableArray<T> &vt, size_t length)
+    {
+      const size_t numBytes = length*sizeof(T);
+      const uint8_t *src = currentEntityData+currentEntityOffset;
+      if (!mapping || numBytes < alignedArrayMinBytes ||
+          (size_t)src % alignof(T) != 0 ||
+          currentEntityOffset + numBytes > currentEntitySize) {
+        vt.clear();
+        readArray<T,ArrayAllocator<T>>(vt,length);
+        return;
+      }
+      // (the mapping is copy-on-write, so it's safe to hand out
+      // non-const pointers into it)
+      MappableArray<T> mapped(ArrayAllocator<T>((T*)const_cast<uint8_t*>(src),length,mapping));
+      mapped.resize(length);
+      vt.swap(mapped);
       currentEntityOffset += numBytes;
     }
 
@@ -190,8 +1124,184 @@ namespace pbrt {
     {
       uint64_t length;
       read(length);
+      readArrayData(vt,length);
+    }
+
+    /*! read an array's data, given its (already read) element count */
+    template<typename T, typename A>
+    inline void readArrayData(std::vector<T, A> &vt, uint64_t length)
+    {
+      if (length & encodedArrayFlag) {
+        length &= ~encodedArrayFlag;
+        vt.clear();
+        vt.resize(length);
+        readEncodedArray((uint8_t*)vt.data(),length,sizeof(T));
+        return;
+      }
+      alignArray(length*sizeof(T));
+      readArray(vt,length);
+    }
+
+    /*! read positions, normals, or texcoords (\see
+        BinaryWriter::writeQuantized), which may or may not have been
+        quantized */
+    template<typename T>
+    void readQuantizable(MappableArray<T> &vt)
+    {
+      uint64_t length;
+      read(length);
+      if (!(length & quantizedArrayFlag)) {
+        readArrayData(vt,length);
+        return;
+      }
+      length &= ~quantizedArrayFlag;
+      QuantizedArrayHeader header;
+      read(header);
+      vt.clear();
       vt.resize(length);
-      copyBytes(vt.data(), length*sizeof(T));
+      dequantize(header,vt.data(),length);
+    }
+
+    void dequantize(const QuantizedArrayHeader &header, vec3f *out, size_t length)
+    {
+      const vec3f lower = header.lower, step = header.step;
+      if (header.encoding == QuantizedArrayHeader::Encoding_Positions && header.bits <= 16) {
+        std::vector<uint16_t> q;
+        read(q);
+        if (q.size() != 3*length)
+          throw std::runtime_error("invalid pbf file - corrupt quantized positions");
+        float *f = (float*)out;
+        for (size_t i=0;i<3*length;i+=3) {
+          f[i+0] = lower.x + float(q[i+0]) * step.x;
+          f[i+1] = lower.y + float(q[i+1]) * step.y;
+          f[i+2] = lower.z + float(q[i+2]) * step.z;
+        }
+      } else if (header.encoding == QuantizedArrayHeader::Encoding_Positions) {
+        std::vector<uint64_t> q;
+        read(q);
+        if (q.size() != length || header.bits > 21)
+          throw std::runtime_error("invalid pbf file - corrupt quantized positions");
+        const int      bits = header.bits;
+        const uint64_t mask = (uint64_t(1) << bits)-1;
+        for (size_t i=0;i<length;i++) {
+          out[i].x = lower.x + float(q[i] & mask) * step.x;
+          out[i].y = lower.y + float((q[i] >> bits) & mask) * step.y;
+          out[i].z = lower.z + float((q[i] >> (2*bits)) & mask) * step.z;
+        }
+      } else if (header.encoding == QuantizedArrayHeader::Encoding_Normals) {
+        std::vector<uint32_t> q;
+        read(q);
+        if (q.size() != length)
+          throw std::runtime_error("invalid pbf file - corrupt quantized normals");
+        for (size_t i=0;i<length;i++)
+          compression::octDecode(q[i],out[i].x,out[i].y,out[i].z);
+      } else
+        throw std::runtime_error("invalid pbf file - unknown encoding for 3D vectors");
+    }
+
+    void dequantize(const QuantizedArrayHeader &header, vec2f *out, size_t length)
+    {
+      if (header.encoding != QuantizedArrayHeader::Encoding_Texcoords)
+        throw std::runtime_error("invalid pbf file - unknown encoding for 2D vectors");
+      std::vector<uint16_t> q;
+      read(q);
+      if (q.size() != 2*length)
+        throw std::runtime_error("invalid pbf file - corrupt quantized texcoords");
+      float *f = (float*)out;
+      for (size_t i=0;i<2*length;i++)
+        f[i] = compression::halfToFloat(q[i]);
+    }
+
+    /*! read a mesh's indices (\see BinaryWriter::writeIndices) -
+        either into 'index', or, with LoadOptions::compactIndices,
+        into 'compact' */
+    template<typename T>
+    void readIndices(MappableArray<T> &index, CompactIndices &compact)
+    {
+      const size_t indicesPerPrim = sizeof(T)/sizeof(int32_t);
+      uint64_t length;
+      read(length);
+      index.clear();
+      compact = CompactIndices();
+      if (!(length & quantizedArrayFlag)) {
+        readArrayData(index,length);
+        if (compactIndices) {
+          compact.setFrom((const int*)index.data(),index.size()*indicesPerPrim);
+          index = MappableArray<T>();
+        }
+        return;
+      }
+      
+      length &= ~quantizedArrayFlag;
+      QuantizedArrayHeader header;
+      read(header);
+      if (header.encoding != QuantizedArrayHeader::Encoding_Indices ||
+          (header.bits != 8 && header.bits != 16))
+        throw std::runtime_error("invalid pbf file - unknown encoding for indices");
+      std::vector<uint8_t> narrow;
+      std::vector<uint16_t> narrow16;
+      if (header.bits == 8) read(narrow); else read(narrow16);
+      const size_t numIndices = (header.bits == 8) ? narrow.size() : narrow16.size();
+      if (numIndices != length*indicesPerPrim)
+        throw std::runtime_error("invalid pbf file - corrupt mesh indices");
+      if (compactIndices) {
+        compact.width = header.bits/8;
+        if (header.bits == 8)
+          compact.data.swap(narrow);
+        else {
+          compact.data.resize(2*numIndices);
+          memcpy(compact.data.data(),narrow16.data(),2*numIndices);
+        }
+        return;
+      }
+      index.resize(length);
+      int32_t *out = (int32_t*)index.data();
+      if (header.bits == 8)
+        for (size_t i=0;i<numIndices;i++) out[i] = narrow[i];
+      else
+        for (size_t i=0;i<numIndices;i++) out[i] = narrow16[i];
+    }
+
+    /*! decode an array written by BinaryWriter::writeEncodedArray()
+        into 'out' - with all its blocks getting decoded in parallel */
+    void readEncodedArray(uint8_t *out, size_t numElements, size_t elementSize)
+    {
+      EncodedArrayHeader header;
+      read(header);
+      if (header.elementSize != elementSize)
+        throw std::runtime_error("invalid pbf file - encoded array of wrong type");
+      if (header.codec > SaveOptions::Compression_LZ)
+        throw std::runtime_error("invalid pbf file - unknown compression codec");
+      if (header.elementsPerBlock == 0 ||
+          header.numBlocks != (numElements+header.elementsPerBlock-1)/header.elementsPerBlock)
+        throw std::runtime_error("invalid pbf file - corrupt encoded array");
+      std::vector<uint64_t> blockSizes(header.numBlocks);
+      std::vector<size_t>   blockBegin(header.numBlocks+1,currentEntityOffset+header.numBlocks*sizeof(uint64_t));
+      copyBytes(blockSizes.data(),blockSizes.size()*sizeof(uint64_t));
+      for (size_t i=0;i<header.numBlocks;i++)
+        blockBegin[i+1] = blockBegin[i] + blockSizes[i];
+      if (blockBegin.back() > currentEntitySize)
+        throw std::runtime_error("invalid pbf file - truncated encoded array");
+
+      syntactic::parallel_for(header.numBlocks,[&](size_t blockID) {
+          const size_t begin = blockID*header.elementsPerBlock;
+          const size_t count = std::min((size_t)header.elementsPerBlock,numElements-begin);
+          const size_t numBytes = count*elementSize;
+          const uint8_t *in = currentEntityData+blockBegin[blockID];
+          uint8_t *dst = out+begin*elementSize;
+          const bool shuffled = header.filters & EncodedArrayHeader::Filter_Shuffle;
+          std::vector<uint8_t> filtered(shuffled ? numBytes : 0);
+          uint8_t *decoded = shuffled ? filtered.data() : dst;
+          if (blockSizes[blockID] == numBytes)
+            memcpy(decoded,in,numBytes);
+          else
+            compression::lzDecompress(in,blockSizes[blockID],decoded,numBytes);
+          if (shuffled)
+            compression::unshuffleBytes(decoded,dst,numBytes/4,4);
+          if (header.filters & EncodedArrayHeader::Filter_Delta)
+            compression::deltaDecode(dst,numBytes/4,elementSize/4);
+        });
+      currentEntityOffset = blockBegin.back();
     }
 
     template<
@@ -368,14 +1478,14 @@ namespace pbrt {
       if (ID == -1)
         return std::shared_ptr<T>();
       // assertion: only values with ID 0 ... N-1 are allowed
-      assert(ID < (int)readEntities.size() && ID >= 0);
+      assert(ID < (int)readEntities->size() && ID >= 0);
 
       // rule 2: if object _was_ a null pointer, return it (that was
       // an error during object creation)
-      if (!readEntities[ID])
+      if (!(*readEntities)[ID])
         return std::shared_ptr<T>();
 
-      std::shared_ptr<T> t = std::dynamic_pointer_cast<T>(readEntities[ID]);
+      std::shared_ptr<T> t = std::dynamic_pointer_cast<T>((*readEntities)[ID]);
       
       // rule 3: if object was of different type, throw an exception
       if (!t)
@@ -385,25 +1495,113 @@ namespace pbrt {
       return t;
     }
 
-    std::vector<uint8_t> currentEntityData;
-    size_t currentEntityOffset;
-    std::vector<Entity::SP> readEntities;
-    std::istream& binStream;
+    int32_t                 formatTag { 0 };
+    /*! the payload of the entity we're currently reading */
+    const uint8_t          *currentEntityData   { nullptr };
+    size_t                  currentEntitySize   { 0 };
+    size_t                  currentEntityOffset { 0 };
+    std::shared_ptr<std::vector<Entity::SP>> readEntities
+      = std::make_shared<std::vector<Entity::SP>>();
+    /*! \see LoadOptions::compactIndices */
+    bool compactIndices = false;
+    /*! the file we're reading from, if we're reading from a mapping */
+    std::shared_ptr<syntactic::FileMapping> mapping;
+    /*! whether we've read past an entity index yet (when reading from
+        a stream) - anything after that is an appended update */
+    bool sawIndex = false;
+    /*! whether the shape we're decoding has read its header already
+        (\see decodeShapeHeader()) */
+    bool skipShapeHeader = false;
   };
 
 
 
+  LazyShapeLoader::~LazyShapeLoader()
+  {
+    if (pager) pager->remove(this);
+  }
+
+  void LazyShapeLoader::load(Shape *shape)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (loaded) return;
+    BinaryReader reader(*context);
+    reader.decode(shape,context->sourceFor(block),block,headerSize);
+    if (!pager) {
+      // we won't need the file any more
+      context = nullptr;
+      loaded = true;
+      return;
+    }
+    residentBytes = evictableBytes(shape);
+    loaded = true;
+    pager->add(this);
+  }
+
+  void LazyShapeLoader::access(Shape *shape, int pinDelta)
+  {
+    do {
+      load(shape);
+    } while (pager && !pager->touch(this,pinDelta));
+  }
+
+  void Shape::ensureLoaded() const
+  {
+    if (lazyLoader && (lazyLoader->pager || !lazyLoader->loaded))
+      lazyLoader->access(const_cast<Shape*>(this),0);
+  }
+
+  void Shape::pin() const
+  {
+    if (lazyLoader)
+      lazyLoader->access(const_cast<Shape*>(this),+1);
+  }
+
+  void Shape::unpin() const
+  {
+    if (lazyLoader && lazyLoader->pager)
+      lazyLoader->pager->touch(lazyLoader.get(),-1);
+  }
+
+  bool Shape::isLoaded() const
+  {
+    return !lazyLoader || lazyLoader->loaded;
+  }
+
   /*! helper class that writes out a PBRT scene graph in a binary form
     that is much faster to parse */
   struct BinaryWriter {
+    typedef std::unordered_map<Entity::SP,int32_t> EntityIDs;
 
-    BinaryWriter(std::ostream& str)
-      : binStream(str)
+    BinaryWriter(std::ostream& str, const SaveOptions &options = SaveOptions())
+      : binStream(str),
+        fileOffset(0),
+        options(options)
     {
       int32_t formatTag = ourFormatTag;
-      binStream.write((char*)&formatTag,sizeof(formatTag));
+      writeToFile(&formatTag,sizeof(formatTag));
     }
 
+    /*! a writer that appends to an existing file of given size
+        (\see Scene::appendTo) - that file already starts with a
+        format tag */
+    BinaryWriter(std::ostream& str, size_t appendOffset, const SaveOptions &options)
+      : binStream(str),
+        fileOffset(appendOffset),
+        options(options)
+    {}
+
+    /*! a writer that only produces the payloads of individual
+        entities on behalf of another writer (\see
+        serializeParallel), and never writes to the stream itself;
+        all entities' IDs are already known, and come from 'ids' */
+    BinaryWriter(std::ostream& str, const EntityIDs &ids, const SaveOptions &options)
+      : binStream(str),
+        fileOffset(0),
+        options(options),
+        sharedIDs(&ids)
+    {}
+
     /*! our stack of output buffers - each object we're writing might
       depend on other objects that it references in its paramset, so
       we use a stack of such buffers - every object writes to its
@@ -415,11 +1613,95 @@ namespace pbrt {
 
     /*! the stream we'll be writing the buffers to */
     std::ostream& binStream;
+    /*! number of bytes written to the file so far (including what's
+        still in outputBuffer) */
+    size_t        fileOffset;
+    /*! what we've written, but not passed on to binStream, yet */
+    std::vector<uint8_t> outputBuffer;
+    static const size_t  outputBufferSize = size_t(16)<<20;
+    /*! how to write things (compression, etc) */
+    const SaveOptions    options;
+
+    /*! what writeRaw() does with the data it gets */
+    typedef enum {
+      /*! append it to the current entity's buffer */
+      STAGE,
+      /*! nothing - we're only assigning IDs (\see serializeParallel) */
+      ONLY_IDS,
+      /*! only count it (\see payloadSize) */
+      COUNT,
+      /*! write it straight to the file (\see serializeStreaming) */
+      STREAM
+    } Mode;
+    Mode   mode = STAGE;
+    /*! number of bytes counted (or streamed) for the current entity */
+    size_t payloadSize = 0;
+    /*! the current entity's arrays, encoded while counting, so we
+        don't have to encode them again when streaming */
+    std::vector<std::vector<uint8_t>> encodedArrays;
+    size_t nextEncodedArray = 0;
+    /*! where STREAM mode writes go - us, or the current shard */
+    BinaryWriter *streamTarget = this;
+    /*! hash of what we've streamed of the current entity so far */
+    ContentHasher streamHasher;
+
+    /*! a file that we put large entities into, rather than into our
+        own file (\see SaveOptions::shardSize) */
+    struct Shard {
+      std::shared_ptr<std::ostream> stream;
+      std::shared_ptr<BinaryWriter> writer;
+    };
+    /*! name of the file we're writing, which the shards' file names
+        get derived from (sharding needs one) */
+    std::string              fileName;
+    /*! if non-empty, the shards get written under their names plus
+        this suffix, for whoever set it to rename them later (the
+        index still lists their real names) */
+    std::string              shardTmpSuffix;
+    /*! names (without directory) of all shards we've started so far */
+    std::vector<std::string> shardFileNames;
+    std::shared_ptr<Shard>   currentShard;
+    /*! bytes written to all shards we're done with */
+    size_t                   shardBytes = 0;
 
     void writeRaw(const void *ptr, size_t size)
     {
-      assert(ptr);
-      serializedEntity.top()->insert(serializedEntity.top()->end(),(uint8_t*)ptr,(uint8_t*)ptr + size);
+      switch (mode) {
+      case ONLY_IDS:
+        return;
+      case COUNT:
+        payloadSize += size;
+        return;
+      case STREAM:
+        streamTarget->writeToFile(ptr,size);
+        streamHasher.add(ptr,size);
+        payloadSize += size;
+        return;
+      default:
+        assert(ptr);
+        serializedEntity.top()->insert(serializedEntity.top()->end(),(uint8_t*)ptr,(uint8_t*)ptr + size);
+      }
+    }
+
+    /*! write given data to the file, through our output buffer; data
+        that wouldn't fit into that buffer anyway bypasses it */
+    void writeToFile(const void *ptr, size_t size)
+    {
+      if (outputBuffer.size() + size > outputBufferSize)
+        flush();
+      if (size >= outputBufferSize)
+        binStream.write((const char *)ptr,size);
+      else
+        outputBuffer.insert(outputBuffer.end(),(const uint8_t*)ptr,(const uint8_t*)ptr+size);
+      fileOffset += size;
+    }
+
+    /*! pass everything we've buffered on to the stream */
+    void flush()
+    {
+      if (outputBuffer.empty()) return;
+      binStream.write((const char *)outputBuffer.data(),outputBuffer.size());
+      outputBuffer.clear();
     }
     
     template<typename T>
@@ -454,11 +1736,237 @@ namespace pbrt {
     void write(const std::vector<T, A> &t)
     {
       size_t size = t.size();
+      if (options.compression != SaveOptions::Compression_None &&
+          size*sizeof(T) >= compressedArrayMinBytes) {
+        write((uint64_t)size | encodedArrayFlag);
+        writeEncodedArray((const uint8_t*)t.data(),size,sizeof(T),IsIntegerArray<T>::value);
+        return;
+      }
       write((uint64_t)size);
+      alignArray(size*sizeof(T));
       if (!t.empty())
         writeRaw(t.data(),t.size()*sizeof(T));
     }
 
+    /*! write given positions, normals, or texcoords - quantized if
+        so requested (\see SaveOptions::quantize) */
+    void writeQuantized(const MappableArray<vec3f> &t,
+                        QuantizedArrayHeader::Encoding encoding)
+    {
+      if (!options.quantize || t.empty() || mode == ONLY_IDS) {
+        write(t);
+        return;
+      }
+      const size_t length = t.size();
+      QuantizedArrayHeader header;
+      memset(&header,0,sizeof(header));
+      header.encoding = encoding;
+      if (encoding == QuantizedArrayHeader::Encoding_Normals) {
+        header.bits = 16;
+        std::vector<uint32_t> q(length);
+        for (size_t i=0;i<length;i++)
+          q[i] = compression::octEncode(t[i].x,t[i].y,t[i].z);
+        write((uint64_t)length | quantizedArrayFlag);
+        write(header);
+        write(q);
+        return;
+      }
+
+      const int bits = std::max(16,std::min(21,options.positionBits));
+      box3f bounds = box3f::empty_box();
+      for (auto &v : t) bounds.extend(v);
+      const float  maxQ  = float((1u << bits)-1);
+      const vec3f  extent = bounds.upper - bounds.lower;
+      header.bits  = (uint8_t)bits;
+      header.lower = bounds.lower;
+      header.step  = extent * (1.f/maxQ);
+      const vec3f scale(header.step.x > 0.f ? 1.f/header.step.x : 0.f,
+                        header.step.y > 0.f ? 1.f/header.step.y : 0.f,
+                        header.step.z > 0.f ? 1.f/header.step.z : 0.f);
+      auto quantize = [&](float f, float lower, float scale) -> uint64_t {
+        return (uint64_t)std::min(maxQ,std::max(0.f,std::floor((f-lower)*scale+.5f)));
+      };
+      write((uint64_t)length | quantizedArrayFlag);
+      write(header);
+      if (bits <= 16) {
+        std::vector<uint16_t> q(3*length);
+        for (size_t i=0;i<length;i++) {
+          q[3*i+0] = (uint16_t)quantize(t[i].x,bounds.lower.x,scale.x);
+          q[3*i+1] = (uint16_t)quantize(t[i].y,bounds.lower.y,scale.y);
+          q[3*i+2] = (uint16_t)quantize(t[i].z,bounds.lower.z,scale.z);
+        }
+        write(q);
+      } else {
+        std::vector<uint64_t> q(length);
+        for (size_t i=0;i<length;i++)
+          q[i]
+            = quantize(t[i].x,bounds.lower.x,scale.x)
+            | (quantize(t[i].y,bounds.lower.y,scale.y) << bits)
+            | (quantize(t[i].z,bounds.lower.z,scale.z) << (2*bits));
+        write(q);
+      }
+    }
+
+    void writeQuantized(const MappableArray<vec2f> &t,
+                        QuantizedArrayHeader::Encoding encoding)
+    {
+      if (!options.quantize || t.empty() || mode == ONLY_IDS) {
+        write(t);
+        return;
+      }
+      QuantizedArrayHeader header;
+      memset(&header,0,sizeof(header));
+      header.encoding = encoding;
+      header.bits     = 16;
+      std::vector<uint16_t> q(2*t.size());
+      for (size_t i=0;i<t.size();i++) {
+        q[2*i+0] = compression::floatToHalf(t[i].x);
+        q[2*i+1] = compression::floatToHalf(t[i].y);
+      }
+      write((uint64_t)t.size() | quantizedArrayFlag);
+      write(header);
+      write(q);
+    }
+
+    /*! write a mesh's indices (from 'index', or from 'compact' if
+        that's in use) - with only 8 or 16 bits per index if all of
+        them fit, and we're allowed to (\see
+        SaveOptions::narrowIndices) */
+    template<typename T>
+    void writeIndices(const MappableArray<T> &index, const CompactIndices &compact)
+    {
+      const size_t indicesPerPrim = sizeof(T)/sizeof(int32_t);
+      const size_t numIndices = compact.empty() ? index.size()*indicesPerPrim : compact.size();
+      const int   *wide       = (const int*)index.data();
+      if (mode == ONLY_IDS) return;
+      
+      int width = 4;
+      if (!compact.empty())
+        width = compact.width;
+      else if (options.narrowIndices && numIndices > 0) {
+        int minIndex = wide[0], maxIndex = wide[0];
+        for (size_t i=1;i<numIndices;i++) {
+          minIndex = std::min(minIndex,wide[i]);
+          maxIndex = std::max(maxIndex,wide[i]);
+        }
+        if (minIndex >= 0)
+          width = (maxIndex <= 0xff) ? 1 : (maxIndex <= 0xffff) ? 2 : 4;
+      }
+      if (!options.narrowIndices)
+        width = 4;
+
+      const size_t numPrims = numIndices/indicesPerPrim;
+      if (width == 4) {
+        if (compact.empty())
+          write(index);
+        else {
+          MappableArray<T> expanded(numPrims);
+          for (size_t i=0;i<numIndices;i++)
+            ((int*)expanded.data())[i] = compact[i];
+          write(expanded);
+        }
+        return;
+      }
+      
+      QuantizedArrayHeader header;
+      memset(&header,0,sizeof(header));
+      header.encoding = QuantizedArrayHeader::Encoding_Indices;
+      header.bits     = uint8_t(8*width);
+      write((uint64_t)numPrims | quantizedArrayFlag);
+      write(header);
+      if (width == 1) {
+        std::vector<uint8_t> narrow(numIndices);
+        for (size_t i=0;i<numIndices;i++)
+          narrow[i] = uint8_t(compact.empty() ? wide[i] : compact[i]);
+        write(narrow);
+      } else {
+        std::vector<uint16_t> narrow(numIndices);
+        for (size_t i=0;i<numIndices;i++)
+          narrow[i] = uint16_t(compact.empty() ? wide[i] : compact[i]);
+        write(narrow);
+      }
+    }
+
+    /*! write given array in compressed form (\see
+        EncodedArrayHeader): the array gets split into blocks of about
+        compressionBlockSize bytes each, which are filtered and
+        compressed independently (and in parallel) */
+    void writeEncodedArray(const uint8_t *data, size_t numElements, size_t elementSize,
+                           bool isInteger)
+    {
+      if (mode == ONLY_IDS) return;
+      if (mode == STREAM) {
+        // already encoded that one when counting (\see serializeStreaming)
+        writeRaw(encodedArrays[nextEncodedArray].data(),encodedArrays[nextEncodedArray].size());
+        encodedArrays[nextEncodedArray++].clear();
+        return;
+      }
+      
+      EncodedArrayHeader header;
+      header.codec            = (uint8_t)options.compression;
+      header.filters          = 0;
+      header.reserved         = 0;
+      header.elementSize      = (uint32_t)elementSize;
+      header.elementsPerBlock = std::max(size_t(1),compressionBlockSize/elementSize);
+      header.numBlocks        = (numElements+header.elementsPerBlock-1)/header.elementsPerBlock;
+      if (elementSize % 4 == 0) {
+        header.filters |= EncodedArrayHeader::Filter_Shuffle;
+        if (isInteger)
+          header.filters |= EncodedArrayHeader::Filter_Delta;
+      }
+      
+      std::vector<std::vector<uint8_t>> blocks(header.numBlocks);
+      syntactic::parallel_for(header.numBlocks,[&](size_t blockID) {
+          const size_t begin = blockID*header.elementsPerBlock;
+          const size_t count = std::min((size_t)header.elementsPerBlock,numElements-begin);
+          const size_t numBytes = count*elementSize;
+          std::vector<uint8_t> filtered(data+begin*elementSize,data+begin*elementSize+numBytes);
+          if (header.filters & EncodedArrayHeader::Filter_Delta)
+            compression::deltaEncode(filtered.data(),numBytes/4,elementSize/4);
+          if (header.filters & EncodedArrayHeader::Filter_Shuffle) {
+            std::vector<uint8_t> shuffled(numBytes);
+            compression::shuffleBytes(filtered.data(),shuffled.data(),numBytes/4,4);
+            filtered.swap(shuffled);
+          }
+          compression::lzCompress(filtered.data(),numBytes,blocks[blockID],options.compressionLevel);
+          if (blocks[blockID].size() >= numBytes)
+            // doesn't compress - store as is
+            blocks[blockID].swap(filtered);
+        });
+
+      std::vector<uint8_t> encoded((const uint8_t*)&header,(const uint8_t*)(&header+1));
+      for (auto &block : blocks) {
+        const uint64_t blockSize = block.size();
+        encoded.insert(encoded.end(),(const uint8_t*)&blockSize,(const uint8_t*)(&blockSize+1));
+      }
+      for (auto &block : blocks)
+        encoded.insert(encoded.end(),block.begin(),block.end());
+      writeRaw(encoded.data(),encoded.size());
+      if (mode == COUNT)
+        encodedArrays.push_back(std::move(encoded));
+    }
+
+    /*! if an array of given size is large enough to be worth it, pad
+        the current entity such that the array data will start at a
+        multiple of 'arrayAlignment' (entity payloads themselves
+        start at such multiples in the file, \see executeWrite) */
+    void alignArray(size_t numBytes)
+    {
+      if (numBytes < alignedArrayMinBytes || mode == ONLY_IDS) return;
+      if (mode == STAGE) {
+        SerializedEntity &entity = *serializedEntity.top();
+        entity.resize(alignUp(entity.size()),0);
+        return;
+      }
+      static const uint8_t padding[arrayAlignment] = { 0 };
+      const size_t numPadBytes = alignUp(payloadSize)-payloadSize;
+      if (mode == STREAM) {
+        streamTarget->writeToFile(padding,numPadBytes);
+        streamHasher.add(padding,numPadBytes);
+      }
+      payloadSize += numPadBytes;
+    }
+
     template<
         typename T,
         typename A = std::allocator<T>,
@@ -484,6 +1992,17 @@ namespace pbrt {
 
 
       
+    template<typename T1, typename T2>
+    void write(const std::map<T1,T2> &values)
+    {
+      int32_t size = (int32_t)values.size();
+      write(size);
+      for (auto it : values) {
+        write(it.first);
+        write(it.second);
+      }
+    }
+
     template<typename T1, typename T2>
     void write(const std::map<T1,std::shared_ptr<T2>> &values)
     {
@@ -501,19 +2020,219 @@ namespace pbrt {
     void startNewEntity()
     { serializedEntity.push(std::make_shared<SerializedEntity>()); }
     
+    /*! size of the (size,tag,numPadBytes) header of each block */
+    static const size_t blockHeaderSize = sizeof(uint64_t)+sizeof(int32_t)+sizeof(uint32_t);
+
+    /*! file offset at which the payload of the next block will start */
+    size_t nextPayloadOffset() const
+    { return alignUp(fileOffset+blockHeaderSize); }
+
     /*! write the topmost write buffer to disk, and free its memory */
-    void executeWrite(int32_t tag)
+    /*! write the current entity's block - unless the file already
+        has a block with the same payload (\see reusableBlocks).
+        'hash' is the payload's hash, if already computed */
+    void executeWrite(int32_t tag, uint64_t hash = 0)
     {
+      const uint8_t *data = serializedEntity.top()->data();
       uint64_t size = (uint64_t)serializedEntity.top()->size();
-      // std::cout << "writing block of size " << size << std::endl;
-      binStream.write((const char *)&size,sizeof(size));
-      binStream.write((const char *)&tag,sizeof(tag));
-      binStream.write((const char *)serializedEntity.top()->data(),size);
+      if (isEntityTag(tag) && hash == 0)
+        hash = hashBytes(data,size);
+      auto reusable = reusableBlocks.find(hash);
+      if (isEntityTag(tag) && reusable != reusableBlocks.end()
+          && reusable->second.tag == tag && reusable->second.size == size) {
+        writtenBlocks.push_back(reusable->second);
+        writtenHashes.push_back(hash);
+      } else
+        startBlock(tag,size,hash).writeToFile(data,size);
       serializedEntity.pop();
-      
     }
 
-    std::map<Entity::SP,int32_t> emittedEntity;
+    /*! write the header for a block with a payload of given size -
+        into a shard, if that's where it goes - and return the writer
+        whose file the payload then has to go to */
+    BinaryWriter &startBlock(int32_t tag, uint64_t size, uint64_t hash = 0)
+    {
+      if (isEntityTag(tag))
+        writtenHashes.push_back(hash);
+      BinaryWriter *shard = shardFor(tag,size);
+      if (!shard) {
+        writeBlockHeader(tag,size);
+        return *this;
+      }
+      shard->writeBlockHeader(tag,size);
+      EntityBlock block = shard->writtenBlocks.back();
+      block.shard = (int32_t)shardFileNames.size();
+      writtenBlocks.push_back(block);
+      return *shard;
+    }
+
+    /*! the writer of the shard that a block with given tag and size
+        goes into, or null if it goes into our own file */
+    BinaryWriter *shardFor(int32_t tag, uint64_t size)
+    {
+      if (options.shardSize == 0 || !isEntityTag(tag) || size < shardedEntityMinBytes)
+        return nullptr;
+      if (currentShard
+          && currentShard->writer->fileOffset + size > options.shardSize
+          && !currentShard->writer->writtenBlocks.empty())
+        closeShard();
+      if (!currentShard) {
+        if (fileName.empty())
+          throw std::runtime_error("sharded pbf files can only be written to a file "
+                                   "(with Scene::saveTo(fileName))");
+        const std::string shardFileName = fileName+"."+std::to_string(shardFileNames.size()+1);
+        currentShard = std::make_shared<Shard>();
+        currentShard->stream = openOutputFile(shardFileName+shardTmpSuffix,options.directIO);
+        if (!currentShard->stream->good())
+          throw std::runtime_error("could not create shard file '"+shardFileName+shardTmpSuffix+"'");
+        currentShard->writer = std::make_shared<BinaryWriter>(*currentShard->stream,options);
+        shardFileNames.push_back(shardFileName.substr(shardFileName.find_last_of("/\\")+1));
+      }
+      return currentShard->writer.get();
+    }
+
+    /*! finish writing the current shard, if any */
+    void closeShard()
+    {
+      if (!currentShard) return;
+      currentShard->writer->flush();
+      currentShard->stream->flush();
+      if (!currentShard->stream->good())
+        throw std::runtime_error("error writing shard file '"+shardFileNames.back()+"'");
+      shardBytes += currentShard->writer->fileOffset;
+      currentShard = nullptr;
+    }
+
+    /*! write the header for a block with a payload of given size, up
+        to where that payload has to start */
+    void writeBlockHeader(int32_t tag, uint64_t size)
+    {
+      const size_t headerEnd = fileOffset+blockHeaderSize;
+      const uint32_t numPadBytes = uint32_t(alignUp(headerEnd)-headerEnd);
+      EntityBlock block;
+      block.offset   = headerEnd + numPadBytes;
+      block.size     = size;
+      block.tag      = tag;
+      block.shard    = 0;
+      if (tag == TYPE_SCENE_SUMMARY)
+        summaryBlock = block;
+      else if (tag == TYPE_SHAPE_TABLE)
+        shapeTableBlock = block;
+      else if (isEntityTag(tag))
+        writtenBlocks.push_back(block);
+      static const char padding[arrayAlignment] = { 0 };
+      writeToFile(&size,sizeof(size));
+      writeToFile(&tag,sizeof(tag));
+      writeToFile(&numPadBytes,sizeof(numPadBytes));
+      writeToFile(padding,numPadBytes);
+    }
+
+    /*! write an entity that's stored as part of another block,
+        rather than in a block of its own (and can't reference any
+        other entities) */
+    void writeInline(Entity::SP entity)
+    {
+      write((int8_t)(entity != nullptr));
+      if (entity) entity->writeTo(*this);
+    }
+
+    /*! write the bounds and primitive counts of all shapes, objects,
+        and instances written so far (\see StoredShapeInfo) */
+    void writeShapeTable()
+    {
+      std::vector<StoredShapeInfo> table;
+      for (size_t ID=0;ID<entityByID.size();ID++) {
+        StoredShapeInfo info;
+        info.entityID = (int32_t)ID;
+        info.reserved = 0;
+        const Entity::SP &entity = entityByID[ID];
+        if (Shape::SP shape = std::dynamic_pointer_cast<Shape>(entity)) {
+          info.bounds   = shape->getBounds();
+          info.numPrims = shape->getNumPrims();
+        } else if (Object::SP object = std::dynamic_pointer_cast<Object>(entity)) {
+          info.bounds   = object->getBounds();
+          info.numPrims = object->getNumPrims();
+        } else if (Instance::SP inst = std::dynamic_pointer_cast<Instance>(entity)) {
+          if (!inst->object) continue;
+          info.bounds   = inst->getBounds();
+          info.numPrims = inst->object->getNumPrims();
+        } else
+          continue;
+        table.push_back(info);
+      }
+      startNewEntity();
+      write(table);
+      executeWrite(TYPE_SHAPE_TABLE);
+    }
+
+    /*! write given summary of the scene (\see loadSceneInfo) */
+    void writeSummary(const SceneInfo &info)
+    {
+      startNewEntity();
+      writeInline(info.film);
+      write((int32_t)info.cameras.size());
+      for (auto camera : info.cameras)
+        writeInline(camera);
+      writeInline(info.sampler);
+      writeInline(info.integrator);
+      writeInline(info.pixelFilter);
+      write(info.bounds);
+      write((uint64_t)info.numObjects);
+      write((uint64_t)info.numInstances);
+      write((uint64_t)info.numLightSources);
+      write(info.numShapes);
+      write(info.numPrims);
+      executeWrite(TYPE_SCENE_SUMMARY);
+    }
+
+    /*! write the index of all entities written so far (\see
+        IndexTrailer), followed by where to find the scene summary,
+        the list of shard files, where to find the shape table, and
+        the entities' content hashes; this has to be the very last
+        thing in the file */
+    void writeIndex()
+    {
+      startNewEntity();
+      write((uint64_t)writtenBlocks.size());
+      writeRaw(writtenBlocks.data(),writtenBlocks.size()*sizeof(EntityBlock));
+      write(summaryBlock);
+      write((int32_t)shardFileNames.size());
+      for (auto &shardFileName : shardFileNames)
+        write(shardFileName);
+      write(shapeTableBlock);
+      writeRaw(writtenHashes.data(),writtenHashes.size()*sizeof(uint64_t));
+      IndexTrailer trailer;
+      trailer.indexOffset = nextPayloadOffset();
+      memcpy(trailer.magic,indexMagic,sizeof(indexMagic));
+      write(trailer);
+      executeWrite(TYPE_ENTITY_INDEX);
+    }
+
+    EntityIDs                emittedEntity;
+    /*! where we put every block we've written so far */
+    std::vector<EntityBlock> writtenBlocks;
+    /*! where we put the scene summary, if we wrote one */
+    EntityBlock              summaryBlock { 0, 0, TYPE_SCENE_SUMMARY, 0 };
+    /*! where we put the shape table, if we wrote one */
+    EntityBlock              shapeTableBlock { 0, 0, TYPE_SHAPE_TABLE, 0 };
+    /*! content hash of every block in writtenBlocks */
+    std::vector<uint64_t>    writtenHashes;
+    /*! blocks already in the file we're appending to, by their
+        payloads' content hashes (\see Scene::appendTo) */
+    std::unordered_map<uint64_t,EntityBlock> reusableBlocks;
+    /*! all entities we've assigned IDs to, in ID order */
+    std::vector<Entity::SP>  entityByID;
+    /*! the materials and textures we've written so far, by their
+        payloads' content hashes (\see findIdentical) */
+    struct WrittenMaterial {
+      int32_t               ID;
+      int32_t               tag;
+      SerializedEntity::SP  payload;
+    };
+    std::unordered_multimap<uint64_t,WrittenMaterial> writtenMaterials;
+    /*! for writers that work on behalf of another one: that writer's
+        IDs, which cover all entities we'll get to see */
+    const EntityIDs         *sharedIDs = nullptr;
 
     int32_t serialize(Entity::SP entity)
     {
@@ -521,16 +2240,181 @@ namespace pbrt {
         // std::cout << "warning: null entity" << std::endl;
         return -1;
       }
+
+      if (sharedIDs) {
+        auto it = sharedIDs->find(entity);
+        if (it == sharedIDs->end())
+          throw std::runtime_error("error in BinaryWriter - entity without an ID");
+        return it->second;
+      }
       
-      if (emittedEntity.find(entity) != emittedEntity.end())
-        return emittedEntity[entity];
+      auto it = emittedEntity.find(entity);
+      if (it != emittedEntity.end())
+        return it->second;
 
       startNewEntity();
-      int32_t tag = (int32_t)entity->writeTo(*this);
-      executeWrite(tag);
-      int32_t num = (int32_t)emittedEntity.size();
+      int32_t tag = (int32_t)writeEntity(entity);
+      if (mode == ONLY_IDS)
+        serializedEntity.pop();
+      else if (options.mergeIdenticalMaterials && isMaterialOrTextureTag(tag)) {
+        const int32_t identicalID = findIdentical(tag);
+        if (identicalID >= 0) {
+          serializedEntity.pop();
+          return emittedEntity[entity] = identicalID;
+        }
+        executeWrite(tag);
+      } else
+        executeWrite(tag);
+      int32_t num = (int32_t)entityByID.size();
+      entityByID.push_back(entity);
       return emittedEntity[entity] = num;
     }
+
+    /*! have given entity write itself - unless it's a lazily loaded
+        shape we can just copy (\see SaveOptions::copyLazyShapes).
+        Shapes stay pinned while they write themselves, so other
+        threads loading shapes can't evict their data under us */
+    int writeEntity(const Entity::SP &entity)
+    {
+      Shape *shape = dynamic_cast<Shape*>(entity.get());
+      if (!shape)
+        return entity->writeTo(*this);
+      if (options.copyLazyShapes && shape->lazyLoader) {
+        LazyShapeLoader &loader = *shape->lazyLoader;
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        if (!loader.loaded && loader.context && loader.context->formatTag == (int32_t)ourFormatTag)
+          return copyLazyShape(*shape,loader);
+      }
+      Shape::Pin pin(shape);
+      return entity->writeTo(*this);
+    }
+
+    /*! write a (not loaded) lazily loaded shape by copying its
+        payload from the file it's in: only the part that all shapes
+        share (\see Shape::writeTo) - which refers to other entities,
+        by their IDs in that file - gets written again, from what the
+        shape read of it up front; that part is the same size either
+        way, so everything after it (including the alignment of its
+        arrays) stays the same */
+    int copyLazyShape(const Shape &shape, LazyShapeLoader &loader)
+    {
+      // (any kind of shape will do, we only write the shared part)
+      TriangleMesh header;
+      header.material           = shape.material;
+      header.textures           = shape.textures;
+      header.areaLight          = shape.areaLight;
+      header.reverseOrientation = shape.reverseOrientation;
+      header.alpha              = shape.alpha;
+      header.Shape::writeTo(*this);
+
+      const EntityBlock &block = loader.block;
+      const size_t headerSize = loader.headerSize;
+      if (mode == STAGE || mode == STREAM) {
+        std::vector<uint8_t> buffer;
+        const uint8_t *data
+          = loader.context->sourceFor(block).get(block.offset+headerSize,
+                                                 block.size-headerSize,buffer);
+        writeRaw(data,block.size-headerSize);
+      } else if (mode == COUNT)
+        payloadSize += block.size-headerSize;
+      return block.tag;
+    }
+
+    /*! if the payload we've just staged (for an entity with given
+        tag) is the same as that of a material or texture we've
+        already written, return that one's ID; otherwise remember it,
+        and return -1 (\see SaveOptions::mergeIdenticalMaterials) */
+    int32_t findIdentical(int32_t tag)
+    {
+      SerializedEntity::SP payload = serializedEntity.top();
+      const uint64_t hash = hashBytes(payload->data(),payload->size());
+      auto range = writtenMaterials.equal_range(hash);
+      for (auto it=range.first;it!=range.second;++it)
+        if (it->second.tag == tag && *it->second.payload == *payload)
+          return it->second.ID;
+      writtenMaterials.insert({hash,{(int32_t)entityByID.size(),tag,payload}});
+      return -1;
+    }
+
+    /*! same as serialize(), with the same result, byte for byte, but
+        with the entities' payloads getting written on all threads: we
+        first walk the graph (without writing anything) to assign
+        each entity the ID that serialize() would give it, then have
+        the entities write their payloads into their own buffers in
+        parallel - a batch at a time, so we don't hold all of the
+        scene's data in memory twice - and write those out in ID
+        order */
+    int32_t serializeParallel(Entity::SP root)
+    {
+      const size_t firstNewID = entityByID.size();
+      const int32_t rootID = assignIDs(root);
+
+      const size_t batchSize = 8*syntactic::getNumParallelThreads();
+      for (size_t begin=firstNewID;begin<entityByID.size();begin+=batchSize) {
+        const size_t numInBatch = std::min(batchSize,entityByID.size()-begin);
+        std::vector<SerializedEntity::SP> payloads(numInBatch);
+        std::vector<int32_t>              tags(numInBatch);
+        std::vector<uint64_t>             hashes(numInBatch);
+        syntactic::parallel_for(numInBatch,[&](size_t i) {
+            BinaryWriter worker(binStream,emittedEntity,options);
+            worker.startNewEntity();
+            tags[i]     = (int32_t)worker.writeEntity(entityByID[begin+i]);
+            payloads[i] = worker.serializedEntity.top();
+            hashes[i]   = hashBytes(payloads[i]->data(),payloads[i]->size());
+          });
+        for (size_t i=0;i<numInBatch;i++) {
+          serializedEntity.push(payloads[i]);
+          payloads[i] = nullptr;
+          executeWrite(tags[i],hashes[i]);
+        }
+      }
+      return rootID;
+    }
+
+    /*! same as serialize(), with the same result, byte for byte, but
+        without ever staging an entity's data in memory: we first
+        assign IDs to all entities (\see serializeParallel), then,
+        for each entity, have it 'write' itself once to only count its
+        payload's size, and then a second time straight into the file
+        (through our output buffer) */
+    int32_t serializeStreaming(Entity::SP root)
+    {
+      const size_t firstNewID = entityByID.size();
+      const int32_t rootID = assignIDs(root);
+
+      for (size_t ID=firstNewID;ID<entityByID.size();ID++) {
+        Entity::SP entity = entityByID[ID];
+        mode = COUNT;
+        payloadSize = 0;
+        const int32_t tag = (int32_t)writeEntity(entity);
+        const size_t size = payloadSize;
+
+        streamTarget = &startBlock(tag,size);
+        mode = STREAM;
+        payloadSize = 0;
+        nextEncodedArray = 0;
+        streamHasher = ContentHasher();
+        writeEntity(entity);
+        writtenHashes.back() = streamHasher.finish();
+        mode = STAGE;
+        streamTarget = this;
+        encodedArrays.clear();
+        if (payloadSize != size)
+          throw std::runtime_error("error in BinaryWriter - entity changed while being written");
+      }
+      return rootID;
+    }
+
+    /*! assign IDs to given entity and everything it references, in
+        the same order that serialize() would, but without writing
+        anything */
+    int32_t assignIDs(Entity::SP root)
+    {
+      mode = ONLY_IDS;
+      const int32_t rootID = serialize(root);
+      mode = STAGE;
+      return rootID;
+    }
   };
 
   /*! serialize out to given binary writer */
@@ -639,6 +2523,7 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   /*! serialize out to given binary writer */
   int Shape::writeTo(BinaryWriter &binary) 
   {
+    // (the writer pinned us, \see BinaryWriter::writeEntity)
     binary.write(binary.serialize(material));
     binary.write(textures);
     binary.write(areaLight);
@@ -650,6 +2535,9 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   /*! serialize _in_ from given binary file reader */
   void Shape::readFrom(BinaryReader &binary) 
   {
+    if (binary.skipShapeHeader)
+      // (lazily loaded shape that read this part up front)
+      return;
     binary.read(material);
     binary.read(textures);
     binary.read(areaLight);
@@ -666,10 +2554,10 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   int TriangleMesh::writeTo(BinaryWriter &binary) 
   {
     Shape::writeTo(binary);
-    binary.write(vertex);
-    binary.write(normal);
-    binary.write(texcoord);
-    binary.write(index);
+    binary.writeQuantized(vertex,QuantizedArrayHeader::Encoding_Positions);
+    binary.writeQuantized(normal,QuantizedArrayHeader::Encoding_Normals);
+    binary.writeQuantized(texcoord,QuantizedArrayHeader::Encoding_Texcoords);
+    binary.writeIndices(index,compactIndex);
     return TYPE_TRIANGLE_MESH;
   }
   
@@ -677,10 +2565,10 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   void TriangleMesh::readFrom(BinaryReader &binary) 
   {
     Shape::readFrom(binary);
-    binary.read(vertex);
-    binary.read(normal);
-    binary.read(texcoord);
-    binary.read(index);
+    binary.readQuantizable(vertex);
+    binary.readQuantizable(normal);
+    binary.readQuantizable(texcoord);
+    binary.readIndices(index,compactIndex);
   }
 
 
@@ -692,9 +2580,10 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   int QuadMesh::writeTo(BinaryWriter &binary) 
   {
     Shape::writeTo(binary);
-    binary.write(vertex);
-    binary.write(normal);
-    binary.write(index);
+    binary.writeQuantized(vertex,QuantizedArrayHeader::Encoding_Positions);
+    binary.writeQuantized(normal,QuantizedArrayHeader::Encoding_Normals);
+    binary.writeQuantized(texcoord,QuantizedArrayHeader::Encoding_Texcoords);
+    binary.writeIndices(index,compactIndex);
     return TYPE_QUAD_MESH;
   }
   
@@ -702,9 +2591,11 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   void QuadMesh::readFrom(BinaryReader &binary) 
   {
     Shape::readFrom(binary);
-    binary.read(vertex);
-    binary.read(normal);
-    binary.read(index);
+    binary.readQuantizable(vertex);
+    binary.readQuantizable(normal);
+    if (binary.quadTexcoords())
+      binary.readQuantizable(texcoord);
+    binary.readIndices(index,compactIndex);
   }
 
 
@@ -721,7 +2612,7 @@ void PixelFilter::readFrom(BinaryReader &binary) {
     binary.write(basis);
     binary.write(type);
     binary.write(degree);
-    binary.write(P);
+    binary.writeQuantized(P,QuantizedArrayHeader::Encoding_Positions);
     binary.write(transform);
     return TYPE_CURVE;
   }
@@ -735,7 +2626,7 @@ void PixelFilter::readFrom(BinaryReader &binary) {
     binary.read(basis);
     binary.read(type);
     binary.read(degree);
-    binary.read(P);
+    binary.readQuantizable(P);
     binary.read(transform);
   }
 
@@ -1655,26 +3546,181 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   /*! save scene to given stream, and return number of bytes written */
   size_t Scene::saveTo(std::ostream &outStream)
   {
-    BinaryWriter binary(outStream);
-    Entity::SP sp = shared_from_this();
-    binary.serialize(sp);
-    return binary.binStream.tellp();
+    return saveTo(outStream,SaveOptions());
   }
 
   /*! save scene to given file name, and return number of bytes written */
   size_t Scene::saveTo(const std::string &outFileName)
   {
-    std::ofstream outFile(outFileName, std::ios_base::binary);
-    return saveTo(outFile);
+    return saveTo(outFileName,SaveOptions());
+  }
+
+  /*! write given scene to given stream; 'fileName' is the name of
+      the file that stream writes to (if any), which the names of the
+      shard files get derived from */
+  static size_t writeScene(Scene::SP scene, std::ostream &outStream,
+                           const SaveOptions &options, const std::string &fileName,
+                           const std::string &shardTmpSuffix = "",
+                           std::vector<std::string> *shardFileNames = nullptr)
+  {
+    BinaryWriter binary(outStream,options);
+    binary.fileName       = fileName;
+    binary.shardTmpSuffix = shardTmpSuffix;
+    if (options.shardSize) {
+      // (so readers that can't handle shards know right away)
+      binary.startNewEntity();
+      binary.executeWrite(TYPE_SHARDED_FILE);
+    }
+    if (options.mergeIdenticalMaterials)
+      binary.serialize(scene);
+    else if (options.streaming)
+      binary.serializeStreaming(scene);
+    else if (options.parallel)
+      binary.serializeParallel(scene);
+    else
+      binary.serialize(scene);
+    binary.closeShard();
+    binary.writeShapeTable();
+    binary.writeSummary(*SceneInfo::computeFrom(scene));
+    binary.writeIndex();
+    binary.flush();
+    if (shardFileNames)
+      *shardFileNames = binary.shardFileNames;
+    return (size_t)binary.binStream.tellp() + binary.shardBytes;
+  }
+
+  /*! save scene to given stream, with given options */
+  size_t Scene::saveTo(std::ostream &outStream, const SaveOptions &options)
+  {
+    return writeScene(as<Scene>(),outStream,options,"");
+  }
+
+  /*! save scene to given file name, with given options */
+  size_t Scene::saveTo(const std::string &outFileName, const SaveOptions &options)
+  {
+    std::shared_ptr<std::ostream> outFile = openOutputFile(outFileName,options.directIO);
+    const size_t numBytes = writeScene(as<Scene>(),*outFile,options,outFileName);
+    outFile->flush();
+    if (!outFile->good())
+      throw std::runtime_error("error writing '"+outFileName+"'");
+    return numBytes;
+  }
+
+  inline void replaceFile(const std::string &fileName, const std::string &tmpFileName)
+  {
+    if (std::rename(tmpFileName.c_str(),fileName.c_str()) != 0)
+      throw std::runtime_error("could not replace '"+fileName+"' with '"+tmpFileName+"'");
+  }
+
+  /*! write given scene to given file from scratch, without
+      disturbing anything that might still read from the old file
+      (like lazily loaded shapes): the new file and its shards get
+      written to temporary files, which then replace the old ones -
+      shards first, so the file never lists shards that aren't
+      there yet. Readers keep reading the old versions of whatever
+      file they already opened */
+  size_t rewriteFile(Scene::SP scene, const std::string &fileName,
+                     const SaveOptions &options)
+  {
+    const std::string tmpSuffix   = ".tmp";
+    const std::string tmpFileName = fileName+tmpSuffix;
+    std::vector<std::string> shardFileNames;
+    size_t numBytes = 0;
+    {
+      std::shared_ptr<std::ostream> outFile = openOutputFile(tmpFileName,options.directIO);
+      numBytes = writeScene(scene,*outFile,options,fileName,tmpSuffix,&shardFileNames);
+      outFile->flush();
+      if (!outFile->good())
+        throw std::runtime_error("error writing '"+tmpFileName+"'");
+    }
+    const size_t pos = fileName.find_last_of("/\\");
+    const std::string directory = (pos == std::string::npos) ? "" : fileName.substr(0,pos+1);
+    for (auto &shard : shardFileNames)
+      replaceFile(directory+shard,directory+shard+tmpSuffix);
+    replaceFile(fileName,tmpFileName);
+    return numBytes;
+  }
+
+  /*! append to given .pbf file only those entities that it doesn't
+      have yet, plus a new index */
+  size_t Scene::appendTo(const std::string &fileName, const SaveOptions &options)
+  {
+    if (!std::ifstream(fileName,std::ios_base::binary).good())
+      return saveTo(fileName,options);
+
+    ReadContext context;
+    context.source         = std::make_shared<FileBinarySource>(fileName);
+    context.formatTag      = 0;
+    context.compactIndices = false;
+    context.entities       = std::make_shared<std::vector<Entity::SP>>();
+    const size_t oldSize = context.source->size();
+    if (oldSize >= sizeof(context.formatTag))
+      context.source->read(0,&context.formatTag,sizeof(context.formatTag));
+    if (context.formatTag != (int32_t)ourFormatTag) {
+      // (older files don't have what we need to append to them)
+      context.source = nullptr;
+      return rewriteFile(as<Scene>(),fileName,options);
+    }
+
+    // find out what the file already has
+    std::vector<uint64_t> hashes;
+    const std::vector<EntityBlock> index
+      = BinaryReader(context).readIndex(*context.source,&context.shardFileNames,
+                                        nullptr,&hashes);
+    if (hashes.size() != index.size())
+      throw std::runtime_error("invalid pbf file - corrupt entity index");
+
+    // new entities always go into the file itself, and need to be
+    // staged, so we can tell whether they're new
+    SaveOptions appendOptions = options;
+    appendOptions.shardSize = 0;
+    appendOptions.streaming = false;
+    std::shared_ptr<std::ostream> outFile
+      = openOutputFile(fileName,options.directIO,/*append*/true);
+    BinaryWriter binary(*outFile,oldSize,appendOptions);
+    binary.fileName       = fileName;
+    binary.shardFileNames = context.shardFileNames;
+    for (size_t ID=0;ID<index.size();ID++)
+      binary.reusableBlocks[hashes[ID]] = index[ID];
+
+    if (appendOptions.parallel && !appendOptions.mergeIdenticalMaterials)
+      binary.serializeParallel(as<Scene>());
+    else
+      binary.serialize(as<Scene>());
+    const size_t tailBegin = binary.fileOffset;
+    binary.writeShapeTable();
+    binary.writeSummary(*SceneInfo::computeFrom(as<Scene>()));
+    binary.writeIndex();
+    binary.flush();
+    outFile->flush();
+    if (!outFile->good())
+      throw std::runtime_error("error appending to '"+fileName+"'");
+
+    // compact the file once too much of it (and its shards) is data
+    // that nothing refers to any more
+    const size_t fileSize = binary.fileOffset;
+    size_t liveBytes = sizeof(int32_t) + (fileSize-tailBegin);
+    size_t shardedBytes = 0;
+    for (auto &block : binary.writtenBlocks)
+      (block.shard ? shardedBytes : liveBytes)
+        += BinaryWriter::blockHeaderSize + arrayAlignment + block.size;
+    if (liveBytes < fileSize
+        && double(fileSize-liveBytes)
+        > options.maxGarbageFraction*double(fileSize+shardedBytes)) {
+      outFile = nullptr;
+      context.source = nullptr;
+      return rewriteFile(as<Scene>(),fileName,options);
+    }
+    return fileSize-oldSize;
   }
 
   /*! load scene from given stream */
   Scene::SP Scene::loadFrom(std::istream &inStream)
   {
     BinaryReader binary(inStream);
-    if (binary.readEntities.empty())
+    if (binary.readEntities->empty())
       throw std::runtime_error("error in Scene::load - no entities");
-    Scene::SP scene = std::dynamic_pointer_cast<Scene>(binary.readEntities.back());
+    Scene::SP scene = std::dynamic_pointer_cast<Scene>(binary.readEntities->back());
     assert(scene);
     return scene;
   }
@@ -1682,8 +3728,173 @@ void PixelFilter::readFrom(BinaryReader &binary) {
   /*! load scene from given file name */
   Scene::SP Scene::loadFrom(const std::string &inFileName)
   {
-    std::ifstream inFile(inFileName, std::ios_base::binary);
-    return loadFrom(inFile);
+    return loadFrom(inFileName,LoadOptions());
+  }
+
+  /*! load scene from given file name, with given options */
+  Scene::SP Scene::loadFrom(const std::string &inFileName, const LoadOptions &options)
+  {
+    BinarySource::SP source = openBinarySource(inFileName,options.mapFile,options.directIO);
+    std::string shardPath = options.shardPath;
+    if (shardPath.empty()) {
+      const size_t pos = inFileName.find_last_of("/\\");
+      shardPath = (pos == std::string::npos) ? "" : inFileName.substr(0,pos+1);
+    } else if (shardPath.back() != '/' && shardPath.back() != '\\')
+      shardPath += "/";
+    BinaryReader binary(source,options,shardPath);
+    if (binary.readEntities->empty())
+      throw std::runtime_error("error in Scene::loadFrom - no entities");
+    Scene::SP scene = std::dynamic_pointer_cast<Scene>(binary.readEntities->back());
+    assert(scene);
+    return scene;
+  }
+
+  /*! read the scene summary stored in given .pbf file, or return
+      null if it doesn't have one (\see loadSceneInfo) */
+  SceneInfo::SP readSceneSummary(const std::string &fileName)
+  {
+    ReadContext context;
+    context.source         = std::make_shared<FileBinarySource>(fileName);
+    context.compactIndices = false;
+    if (context.source->size() < sizeof(context.formatTag))
+      throw std::runtime_error("invalid pbf file - too small");
+    context.source->read(0,&context.formatTag,sizeof(context.formatTag));
+    context.entities = std::make_shared<std::vector<Entity::SP>>();
+    BinaryReader binary(context);
+    return binary.readSummary(*context.source);
+  }
+
+  /*! load scene from given file name, with the shapes' arrays pointing
+      into a mapping of that file */
+  Scene::SP Scene::mapFrom(const std::string &inFileName)
+  {
+    LoadOptions options;
+    options.mapFile = true;
+    return loadFrom(inFileName,options);
+  }
+
+  inline bool overlaps(const box3f &a, const box3f &b)
+  {
+    return !a.empty() && !b.empty()
+      && a.lower.x <= b.upper.x && b.lower.x <= a.upper.x
+      && a.lower.y <= b.upper.y && b.lower.y <= a.upper.y
+      && a.lower.z <= b.upper.z && b.lower.z <= a.upper.z;
+  }
+
+  inline bool contains(const box3f &outer, const box3f &inner)
+  {
+    return !inner.empty()
+      && outer.lower.x <= inner.lower.x && inner.upper.x <= outer.upper.x
+      && outer.lower.y <= inner.lower.y && inner.upper.y <= outer.upper.y
+      && outer.lower.z <= inner.lower.z && inner.upper.z <= outer.upper.z;
+  }
+
+  /*! finds, for each object reachable from the world, which of its
+      shapes and instances overlap a given region under any of the
+      (world) transforms that object gets instanced with */
+  struct RegionFilter {
+    RegionFilter(const box3f &region) : region(region) {}
+
+    void visit(Object::SP object, const affine3f &xfm)
+    {
+      if (fullyKept.count(object.get()))
+        return;
+      // in a DAG the same object usually gets reached on many paths,
+      // mostly with the same few transforms; visiting it again with a
+      // transform we've seen before can't keep anything new
+      const std::string xfmBytes((const char *)&xfm,sizeof(xfm));
+      if (!visited.insert(std::make_pair(object.get(),xfmBytes)).second)
+        return;
+      if (contains(region,xfmBounds(xfm,object->getBounds()))) {
+        keepAll(object);
+        return;
+      }
+
+      std::set<Entity *> &kept = keptBy[object];
+      for (auto shape : object->shapes)
+        if (shape && overlaps(xfmBounds(xfm,shape->getBounds()),region))
+          kept.insert(shape.get());
+      for (auto inst : object->instances) {
+        if (!inst || !inst->object) continue;
+        const affine3f instXfm = xfm * inst->xfm;
+        if (!overlaps(xfmBounds(instXfm,inst->object->getBounds()),region)) continue;
+        kept.insert(inst.get());
+        visit(inst->object,instXfm);
+      }
+    }
+
+    /*! keep everything below given object, no matter where it gets
+        instanced (it's fully inside the region for one transform
+        already) */
+    void keepAll(Object::SP object)
+    {
+      if (!fullyKept.insert(object.get()).second)
+        return;
+      std::set<Entity *> &kept = keptBy[object];
+      for (auto shape : object->shapes)
+        if (shape && !shape->getBounds().empty())
+          kept.insert(shape.get());
+      for (auto inst : object->instances) {
+        if (!inst || !inst->object || inst->object->getBounds().empty()) continue;
+        kept.insert(inst.get());
+        keepAll(inst->object);
+      }
+    }
+
+    /*! drop everything that didn't overlap from the objects we've
+        visited; their (and their instances') bounds change with that */
+    void prune()
+    {
+      for (auto &it : keptBy) {
+        const std::set<Entity *> &kept = it.second;
+        auto dropped = [&](const Entity::SP &entity) { return !kept.count(entity.get()); };
+        Object::SP object = it.first;
+        object->shapes.erase(std::remove_if(object->shapes.begin(),object->shapes.end(),dropped),
+                             object->shapes.end());
+        object->instances.erase(std::remove_if(object->instances.begin(),object->instances.end(),dropped),
+                                object->instances.end());
+        object->haveComputedBounds   = false;
+        object->haveComputedNumPrims = false;
+        for (auto inst : object->instances)
+          inst->haveComputedBounds = false;
+      }
+    }
+
+    const box3f                             region;
+    std::map<Object::SP,std::set<Entity *>> keptBy;
+    /*! objects (and world transforms) we've visited already */
+    std::set<std::pair<Object *,std::string>> visited;
+    /*! objects we keep entirely */
+    std::set<Object *>                      fullyKept;
+  };
+
+  /*! load only the part of given file that overlaps given region */
+  Scene::SP Scene::loadRegion(const std::string &inFileName,
+                              const box3f &region,
+                              const LoadOptions &options)
+  {
+    LoadOptions lazyOptions = options;
+    lazyOptions.lazyShapes = true;
+    Scene::SP scene = loadFrom(inFileName,lazyOptions);
+    if (!scene->world)
+      return scene;
+
+    RegionFilter filter(region);
+    filter.visit(scene->world,affine3f::identity());
+    filter.prune();
+
+    if (!options.lazyShapes && !options.residentBudget) {
+      std::vector<Shape::SP> shapes;
+      for (auto &it : filter.keptBy)
+        shapes.insert(shapes.end(),it.first->shapes.begin(),it.first->shapes.end());
+      auto load = [&](size_t shapeID) { shapes[shapeID]->ensureLoaded(); };
+      if (options.parallel)
+        syntactic::parallel_for(shapes.size(),load);
+      else
+        for (size_t shapeID=0;shapeID<shapes.size();shapeID++)
+          load(shapeID);
+    }
+    return scene;
   }
   
 } // ::pbrt
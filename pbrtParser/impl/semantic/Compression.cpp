@@ -0,0 +1,304 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "Compression.h"
+// std
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string.h>
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  namespace compression {
+
+    void shuffleBytes(const uint8_t *in, uint8_t *out, size_t numWords, size_t wordSize)
+    {
+      for (size_t b=0;b<wordSize;b++) {
+        uint8_t *plane = out + b*numWords;
+        for (size_t i=0;i<numWords;i++)
+          plane[i] = in[i*wordSize+b];
+      }
+    }
+
+    void unshuffleBytes(const uint8_t *in, uint8_t *out, size_t numWords, size_t wordSize)
+    {
+      for (size_t b=0;b<wordSize;b++) {
+        const uint8_t *plane = in + b*numWords;
+        for (size_t i=0;i<numWords;i++)
+          out[i*wordSize+b] = plane[i];
+      }
+    }
+
+    inline uint32_t loadWord(const uint8_t *ptr)
+    { uint32_t w; memcpy(&w,ptr,sizeof(w)); return w; }
+
+    inline void storeWord(uint8_t *ptr, uint32_t w)
+    { memcpy(ptr,&w,sizeof(w)); }
+
+    void deltaEncode(uint8_t *data, size_t numWords, size_t stride)
+    {
+      // back to front, so we always subtract the original values
+      for (size_t i=numWords;i-->stride;)
+        storeWord(data+4*i,loadWord(data+4*i)-loadWord(data+4*(i-stride)));
+    }
+
+    void deltaDecode(uint8_t *data, size_t numWords, size_t stride)
+    {
+      for (size_t i=stride;i<numWords;i++)
+        storeWord(data+4*i,loadWord(data+4*i)+loadWord(data+4*(i-stride)));
+    }
+
+    /* the compressed stream is a sequence of
+         token (4 bits number of literals, 4 bits match length - minMatch)
+         [more literal length bytes, if the number of literals is >= 15]
+         literals
+         16-bit match offset
+         [more match length bytes, if match length - minMatch >= 15]
+       with the last sequence consisting of only the token and literals */
+    static const size_t minMatch   = 4;
+    static const size_t maxOffset  = 65535;
+    static const int    hashLog    = 16;
+    static const size_t windowMask = 65535;
+
+    inline uint32_t hashOf(const uint8_t *ptr)
+    { return (loadWord(ptr) * 2654435761u) >> (32-hashLog); }
+
+    inline void writeLength(std::vector<uint8_t> &out, size_t length)
+    {
+      for (;length >= 255;length -= 255)
+        out.push_back(255);
+      out.push_back((uint8_t)length);
+    }
+
+    inline void emitSequence(std::vector<uint8_t> &out,
+                             const uint8_t *literals, size_t numLiterals,
+                             size_t offset, size_t matchLength)
+    {
+      const size_t extraMatch = matchLength ? matchLength-minMatch : 0;
+      out.push_back(uint8_t((std::min(numLiterals,size_t(15)) << 4)
+                            | std::min(extraMatch,size_t(15))));
+      if (numLiterals >= 15)
+        writeLength(out,numLiterals-15);
+      out.insert(out.end(),literals,literals+numLiterals);
+      if (!matchLength) return;
+      out.push_back(uint8_t(offset));
+      out.push_back(uint8_t(offset >> 8));
+      if (extraMatch >= 15)
+        writeLength(out,extraMatch-15);
+    }
+
+    void lzCompress(const uint8_t *in, size_t numBytes, std::vector<uint8_t> &out, int level)
+    {
+      level = std::max(1,std::min(9,level));
+      const int maxAttempts = 1 << (level-1);
+      std::vector<int64_t> head(size_t(1) << hashLog,-1);
+      std::vector<int64_t> chain(windowMask+1,-1);
+
+      size_t anchor = 0;
+      size_t pos    = 0;
+      while (pos + minMatch <= numBytes) {
+        const uint32_t hash = hashOf(in+pos);
+        size_t bestLength = 0, bestOffset = 0;
+        int64_t candidate = head[hash];
+        for (int attempt=0;
+             attempt<maxAttempts && candidate >= 0 && (size_t)candidate < pos
+               && pos-(size_t)candidate <= maxOffset;
+             attempt++) {
+          const uint8_t *match = in+candidate;
+          if (loadWord(match) == loadWord(in+pos)) {
+            size_t length = minMatch;
+            while (pos+length < numBytes && match[length] == in[pos+length])
+              ++length;
+            if (length > bestLength) {
+              bestLength = length;
+              bestOffset = pos-(size_t)candidate;
+            }
+          }
+          candidate = chain[candidate & windowMask];
+        }
+        chain[pos & windowMask] = head[hash];
+        head[hash] = pos;
+
+        if (bestLength < minMatch) {
+          ++pos;
+          continue;
+        }
+        emitSequence(out,in+anchor,pos-anchor,bestOffset,bestLength);
+        // remember (some of) the positions we're skipping, so later
+        // data can refer to them
+        const size_t step = (level > 1) ? 1 : 4;
+        for (size_t p=pos+1;p<pos+bestLength && p+minMatch <= numBytes;p+=step) {
+          const uint32_t h = hashOf(in+p);
+          chain[p & windowMask] = head[h];
+          head[h] = p;
+        }
+        pos += bestLength;
+        anchor = pos;
+      }
+      emitSequence(out,in+anchor,numBytes-anchor,0,0);
+    }
+
+    inline size_t readLength(const uint8_t *&in, const uint8_t *inEnd)
+    {
+      size_t length = 0;
+      while (true) {
+        if (in >= inEnd)
+          throw std::runtime_error("corrupt compressed data - truncated length");
+        const uint8_t b = *in++;
+        length += b;
+        if (b != 255) return length;
+      }
+    }
+
+    void lzDecompress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize)
+    {
+      const uint8_t *inEnd  = in + inSize;
+      uint8_t       *op     = out;
+      uint8_t       *outEnd = out + outSize;
+      while (true) {
+        if (in >= inEnd)
+          throw std::runtime_error("corrupt compressed data - truncated sequence");
+        const uint8_t token = *in++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15)
+          numLiterals += readLength(in,inEnd);
+        if (numLiterals > size_t(inEnd-in) || numLiterals > size_t(outEnd-op))
+          throw std::runtime_error("corrupt compressed data - literals out of bounds");
+        memcpy(op,in,numLiterals);
+        in += numLiterals;
+        op += numLiterals;
+        if (op == outEnd) break;
+
+        if (inEnd-in < 2)
+          throw std::runtime_error("corrupt compressed data - truncated offset");
+        const size_t offset = size_t(in[0]) | (size_t(in[1]) << 8);
+        in += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15)
+          matchLength += readLength(in,inEnd);
+        matchLength += minMatch;
+        if (offset == 0 || offset > size_t(op-out) || matchLength > size_t(outEnd-op))
+          throw std::runtime_error("corrupt compressed data - match out of bounds");
+        const uint8_t *match = op-offset;
+        if (offset >= matchLength) {
+          memcpy(op,match,matchLength);
+          op += matchLength;
+        } else {
+          // overlapping match (i.e., a repeated pattern)
+          for (size_t i=0;i<matchLength;i++)
+            *op++ = *match++;
+        }
+      }
+      if (in != inEnd)
+        throw std::runtime_error("corrupt compressed data - trailing bytes");
+    }
+
+    uint16_t floatToHalf(float f)
+    {
+      uint32_t bits;
+      memcpy(&bits,&f,sizeof(bits));
+      const uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+      const uint32_t absBits = bits & 0x7fffffff;
+      if (absBits >= 0x7f800000)
+        // inf or nan
+        return sign | 0x7c00 | (absBits > 0x7f800000 ? 0x200 : 0);
+      if (absBits >= 0x477ff000)
+        // too large - becomes inf
+        return sign | 0x7c00;
+      if (absBits < 0x38800000) {
+        // denormal (or zero) in half precision
+        if (absBits < 0x33000000) return sign;
+        // value is mantissa * 2^(exponent-150), and half denormals
+        // count in units of 2^-24
+        const uint32_t mantissa = (absBits & 0x007fffff) | 0x00800000;
+        const int rshift = 126 - int(absBits >> 23);
+        uint32_t result = mantissa >> rshift;
+        const uint32_t rest = mantissa & ((1u << rshift)-1);
+        const uint32_t halfway = 1u << (rshift-1);
+        if (rest > halfway || (rest == halfway && (result & 1)))
+          ++result;
+        return sign | uint16_t(result);
+      }
+      // normal: rebias exponent, round mantissa to nearest even
+      uint32_t result = ((absBits - 0x38000000) >> 13);
+      const uint32_t rest = absBits & 0x1fff;
+      if (rest > 0x1000 || (rest == 0x1000 && (result & 1)))
+        ++result;
+      return sign | uint16_t(result);
+    }
+
+    float halfToFloat(uint16_t h)
+    {
+      const uint32_t sign     = uint32_t(h & 0x8000) << 16;
+      const uint32_t exponent = (h >> 10) & 0x1f;
+      uint32_t       mantissa = h & 0x3ff;
+      uint32_t bits;
+      if (exponent == 0x1f)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+      else if (exponent != 0)
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+      else if (mantissa == 0)
+        bits = sign;
+      else {
+        // denormal - normalize
+        int e = 113;
+        while (!(mantissa & 0x400)) { mantissa <<= 1; --e; }
+        bits = sign | (uint32_t(e) << 23) | ((mantissa & 0x3ff) << 13);
+      }
+      float f;
+      memcpy(&f,&bits,sizeof(f));
+      return f;
+    }
+
+    inline float signNotZero(float f) { return f < 0.f ? -1.f : 1.f; }
+
+    inline uint32_t toUnorm16(float f)
+    {
+      f = std::max(-1.f,std::min(1.f,f));
+      return uint32_t(std::floor((f*.5f+.5f)*65535.f+.5f));
+    }
+
+    uint32_t octEncode(float x, float y, float z)
+    {
+      const float l1 = std::fabs(x)+std::fabs(y)+std::fabs(z);
+      if (l1 == 0.f) return toUnorm16(0.f) | (toUnorm16(0.f) << 16);
+      float u = x / l1, v = y / l1;
+      if (z < 0.f) {
+        const float newU = (1.f-std::fabs(v))*signNotZero(u);
+        const float newV = (1.f-std::fabs(u))*signNotZero(v);
+        u = newU; v = newV;
+      }
+      return toUnorm16(u) | (toUnorm16(v) << 16);
+    }
+
+    void octDecode(uint32_t code, float &x, float &y, float &z)
+    {
+      x = float(code & 0xffff) * (2.f/65535.f) - 1.f;
+      y = float(code >> 16)    * (2.f/65535.f) - 1.f;
+      z = 1.f - std::fabs(x) - std::fabs(y);
+      if (z < 0.f) {
+        const float newX = (1.f-std::fabs(y))*signNotZero(x);
+        const float newY = (1.f-std::fabs(x))*signNotZero(y);
+        x = newX; y = newY;
+      }
+      const float len = std::sqrt(x*x+y*y+z*z);
+      x /= len; y /= len; z /= len;
+    }
+
+  } // ::compression
+} // ::pbrt
@@ -0,0 +1,70 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  /*! the (small, fast, and dependency-free) codec and filters we use
+      for compressing large arrays in binary files */
+  namespace compression {
+
+    /*! reorder the bytes of 'numWords' words of 'wordSize' bytes each
+        such that the first bytes of all words come first, then all
+        second bytes, etc. - for floats, this puts the (very similar)
+        sign/exponent bytes next to each other, which makes them
+        compress much better */
+    void shuffleBytes(const uint8_t *in, uint8_t *out, size_t numWords, size_t wordSize);
+    /*! inverse of shuffleBytes() */
+    void unshuffleBytes(const uint8_t *in, uint8_t *out, size_t numWords, size_t wordSize);
+
+    /*! replace each (32-bit integer) word by its difference to the
+        word 'stride' words before it - for index arrays, where
+        neighboring triangles use similar vertices, this turns most
+        indices into small numbers */
+    void deltaEncode(uint8_t *data, size_t numWords, size_t stride);
+    /*! inverse of deltaEncode() */
+    void deltaDecode(uint8_t *data, size_t numWords, size_t stride);
+
+    /*! LZ77-style compression (in the spirit of LZ4: byte-aligned
+        literal runs and back-references into a 64KB window, so
+        decompression is little more than memcpy) of the given data;
+        the result gets appended to 'out'. 'level' (1 to 9) trades
+        compression speed for compression ratio */
+    void lzCompress(const uint8_t *in, size_t numBytes, std::vector<uint8_t> &out, int level);
+    /*! decompress data written by lzCompress() into 'out', which has
+        to be exactly 'outSize' bytes; throws a std::runtime_error if
+        the data is corrupt */
+    void lzDecompress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize);
+
+    /*! convert float to IEEE half float (rounding to nearest even) */
+    uint16_t floatToHalf(float f);
+    /*! convert IEEE half float to float */
+    float halfToFloat(uint16_t h);
+
+    /*! octahedral encoding of a (normalized) direction into two
+        16-bit values */
+    uint32_t octEncode(float x, float y, float z);
+    /*! inverse of octEncode(); returns a normalized direction */
+    void octDecode(uint32_t code, float &x, float &y, float &z);
+
+  } // ::compression
+} // ::pbrt
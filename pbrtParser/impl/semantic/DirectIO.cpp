@@ -0,0 +1,285 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "DirectIO.h"
+#include "../syntactic/Parallel.h"
+// std
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <stdexcept>
+#include <string.h>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  namespace directio {
+
+    inline size_t alignDown(size_t v) { return v - (v % blockSize); }
+    inline size_t alignUp(size_t v)   { return alignDown(v + blockSize - 1); }
+
+#ifndef _WIN32
+    /*! open given file with O_DIRECT if we can, and without if we
+        can't (eg, on tmpfs, which doesn't support it) */
+    static int openFile(const std::string &fileName, int flags, bool &direct)
+    {
+      int fd = -1;
+# ifdef O_DIRECT
+      fd = ::open(fileName.c_str(),flags|O_DIRECT,0644);
+      direct = (fd >= 0);
+# endif
+      if (fd < 0) {
+        fd = ::open(fileName.c_str(),flags,0644);
+        direct = false;
+      }
+      return fd;
+    }
+
+    /*! some file systems accept O_DIRECT when opening a file, but
+        not when reading or writing it - in which case we switch it
+        off, and retry */
+    static bool dropDirect(int fd)
+    {
+# ifdef O_DIRECT
+      const int flags = fcntl(fd,F_GETFL);
+      if (flags >= 0 && (flags & O_DIRECT))
+        return fcntl(fd,F_SETFL,flags & ~O_DIRECT) == 0;
+# endif
+      return false;
+    }
+
+    static void writeFully(int fd, const uint8_t *src, size_t offset, size_t numBytes)
+    {
+      while (numBytes > 0) {
+        const ssize_t numWritten = ::pwrite(fd,src,numBytes,offset);
+        if (numWritten < 0) {
+          if (errno == EINTR || (errno == EINVAL && dropDirect(fd)))
+            continue;
+          throw std::runtime_error(std::string("error writing file: ")+strerror(errno));
+        }
+        src      += numWritten;
+        offset   += numWritten;
+        numBytes -= numWritten;
+      }
+    }
+
+    // ==================================================================
+    // InputFile
+    // ==================================================================
+
+    InputFile::InputFile(const std::string &fileName)
+    {
+      fd = openFile(fileName,O_RDONLY,direct);
+      if (fd < 0)
+        throw std::runtime_error("could not open pbf file '"+fileName+"'");
+      struct stat st;
+      if (fstat(fd,&st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("could not stat pbf file '"+fileName+"'");
+      }
+      fileSize = (size_t)st.st_size;
+    }
+
+    InputFile::~InputFile()
+    {
+      if (fd >= 0) ::close(fd);
+    }
+
+    void InputFile::readRange(uint8_t *dst, size_t offset, size_t numBytes, size_t minBytes)
+    {
+      size_t numRead = 0;
+      while (numRead < minBytes) {
+        const ssize_t result = ::pread(fd,dst+numRead,numBytes-numRead,offset+numRead);
+        if (result < 0) {
+          if (errno == EINTR || (errno == EINVAL && dropDirect(fd)))
+            continue;
+          throw std::runtime_error(std::string("error reading pbf file: ")+strerror(errno));
+        }
+        if (result == 0)
+          throw std::runtime_error("invalid pbf file - read past end of file");
+        numRead += result;
+      }
+    }
+
+    const uint8_t *InputFile::get(size_t offset, size_t numBytes, std::vector<uint8_t> &buffer)
+    {
+      if (offset + numBytes > fileSize)
+        throw std::runtime_error("invalid pbf file - read past end of file");
+      // (we do aligned reads even if we didn't get O_DIRECT; they
+      // don't hurt, and it's one code path less)
+      const size_t begin = alignDown(offset);
+      const size_t end   = alignUp(offset+numBytes);
+      buffer.resize(end-begin+blockSize);
+      uint8_t *base = buffer.data() + (blockSize - size_t(buffer.data()) % blockSize) % blockSize;
+      // only what's in the file has to get read; the last block's
+      // read will come back short at the end of the file
+      const size_t fileEnd = std::min(end,fileSize);
+      syntactic::parallel_for_blocked(end-begin,requestSize,[&](size_t b, size_t e) {
+          const size_t inFile = (begin+b < fileEnd) ? std::min(e,fileEnd-begin)-b : 0;
+          readRange(base+b,begin+b,e-b,inFile);
+        });
+      return base + (offset-begin);
+    }
+
+    // ==================================================================
+    // OutputFileBuffer
+    // ==================================================================
+
+    OutputFileBuffer::OutputFileBuffer(const std::string &fileName, bool append)
+    {
+      fd = openFile(fileName,append ? (O_WRONLY|O_CREAT) : (O_WRONLY|O_CREAT|O_TRUNC),direct);
+      if (fd < 0) return;
+      for (int i=0;i<numBuffers;i++)
+        if (posix_memalign((void**)&buffers[i],blockSize,requestSize) != 0)
+          throw std::bad_alloc();
+      if (append) {
+        // we can only write whole blocks, so start with the last,
+        // partial block of what's already in the file
+        struct stat st;
+        if (fstat(fd,&st) != 0) {
+          ::close(fd); fd = -1;
+          return;
+        }
+        const size_t fileSize = (size_t)st.st_size;
+        bufferOffset = alignDown(fileSize);
+        bufferFill   = fileSize - bufferOffset;
+        if (bufferFill) {
+          InputFile in(fileName);
+          std::vector<uint8_t> tail;
+          memcpy(buffers[current],in.get(bufferOffset,bufferFill,tail),bufferFill);
+        }
+      }
+    }
+
+    OutputFileBuffer::~OutputFileBuffer()
+    {
+      if (fd >= 0) {
+        try { sync(); } catch (...) {}
+        ::close(fd);
+      }
+      for (int i=0;i<numBuffers;i++)
+        free(buffers[i]);
+    }
+
+    void OutputFileBuffer::startWrite(size_t numBytes)
+    {
+      const int    fd     = this->fd;
+      const size_t offset = bufferOffset;
+      uint8_t     *buffer = buffers[current];
+      // O_DIRECT writes have to be whole blocks; what we write past
+      // the end gets truncated in sync()
+      const size_t padded = alignUp(numBytes);
+      memset(buffer+numBytes,0,padded-numBytes);
+      pendingWrite[current] = std::async(std::launch::async,[=]() {
+          writeFully(fd,buffer,offset,padded);
+        });
+    }
+
+    void OutputFileBuffer::finishWrite(size_t bufferID)
+    {
+      if (!pendingWrite[bufferID].valid()) return;
+      pendingWrite[bufferID].get();
+    }
+
+    std::streamsize OutputFileBuffer::xsputn(const char *data, std::streamsize numBytes)
+    {
+      if (fd < 0) return 0;
+      std::streamsize numDone = 0;
+      while (numDone < numBytes) {
+        const size_t n = std::min(size_t(numBytes-numDone),requestSize-bufferFill);
+        memcpy(buffers[current]+bufferFill,data+numDone,n);
+        bufferFill += n;
+        numDone    += n;
+        if (bufferFill < requestSize)
+          continue;
+        // buffer is full: send it off, and move on to the next one
+        // (once that one's previous write is done)
+        startWrite(requestSize);
+        current = (current+1) % numBuffers;
+        finishWrite(current);
+        bufferOffset += requestSize;
+        bufferFill    = 0;
+      }
+      return numDone;
+    }
+
+    OutputFileBuffer::int_type OutputFileBuffer::overflow(int_type c)
+    {
+      if (traits_type::eq_int_type(c,traits_type::eof()))
+        return traits_type::not_eof(c);
+      const char ch = traits_type::to_char_type(c);
+      return xsputn(&ch,1) == 1 ? c : traits_type::eof();
+    }
+
+    int OutputFileBuffer::sync()
+    {
+      if (fd < 0) return -1;
+      // write the partial buffer - but keep it, since it's what the
+      // next writes get appended to
+      if (bufferFill)
+        startWrite(bufferFill);
+      for (int i=0;i<numBuffers;i++)
+        finishWrite(i);
+      if (ftruncate(fd,bufferOffset+bufferFill) != 0)
+        throw std::runtime_error(std::string("error writing file: ")+strerror(errno));
+      return 0;
+    }
+
+    OutputFileBuffer::pos_type OutputFileBuffer::seekoff(off_type off,
+                                                         std::ios_base::seekdir dir,
+                                                         std::ios_base::openmode)
+    {
+      if (fd < 0 || off != 0 || dir != std::ios_base::cur)
+        return pos_type(off_type(-1));
+      return pos_type(off_type(bufferOffset+bufferFill));
+    }
+#else
+    InputFile::InputFile(const std::string &)
+    { throw std::runtime_error("direct i/o is not supported on this platform"); }
+    InputFile::~InputFile() {}
+    void InputFile::readRange(uint8_t *, size_t, size_t, size_t) {}
+    const uint8_t *InputFile::get(size_t, size_t, std::vector<uint8_t> &) { return nullptr; }
+
+    OutputFileBuffer::OutputFileBuffer(const std::string &, bool) {}
+    OutputFileBuffer::~OutputFileBuffer() {}
+    void OutputFileBuffer::startWrite(size_t) {}
+    void OutputFileBuffer::finishWrite(size_t) {}
+    std::streamsize OutputFileBuffer::xsputn(const char *, std::streamsize) { return 0; }
+    OutputFileBuffer::int_type OutputFileBuffer::overflow(int_type) { return traits_type::eof(); }
+    int OutputFileBuffer::sync() { return -1; }
+    OutputFileBuffer::pos_type OutputFileBuffer::seekoff(off_type, std::ios_base::seekdir,
+                                                         std::ios_base::openmode)
+    { return pos_type(off_type(-1)); }
+#endif
+
+    // ==================================================================
+    // OutputFile
+    // ==================================================================
+
+    OutputFile::OutputFile(const std::string &fileName, bool append)
+      : std::ostream(nullptr), buffer(fileName,append)
+    {
+      rdbuf(&buffer);
+      if (!buffer.isOpen())
+        setstate(std::ios_base::failbit);
+    }
+
+  } // ::directio
+} // ::pbrt
@@ -0,0 +1,116 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+// std
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  /*! reading and writing files with few, large, aligned requests
+      that - where the file system supports O_DIRECT - bypass the
+      page cache (\see LoadOptions::directIO, SaveOptions::directIO).
+      Not available on Windows, where those options get ignored */
+  namespace directio {
+
+    /*! alignment of O_DIRECT requests' offsets, sizes, and buffers */
+    const size_t blockSize = 4096;
+    /*! larger requests get split into pieces of that size, which are
+        in flight at the same time */
+    const size_t requestSize = size_t(8)<<20;
+
+    /*! a file that gets read with pread(), without any locking, so
+        any number of threads can read from it at the same time */
+    struct InputFile {
+      InputFile(const std::string &fileName);
+      ~InputFile();
+
+      size_t size() const { return fileSize; }
+      /*! read given range of the file into 'buffer' (which gets
+          resized as needed), and return pointer to where in there
+          that range starts */
+      const uint8_t *get(size_t offset, size_t numBytes, std::vector<uint8_t> &buffer);
+
+    private:
+      /*! read 'numBytes' starting at 'offset' into 'dst'; only the
+          first 'minBytes' of those have to be in the file */
+      void readRange(uint8_t *dst, size_t offset, size_t numBytes, size_t minBytes);
+
+      int    fd       { -1 };
+      /*! whether we got to open the file with O_DIRECT */
+      bool   direct   { false };
+      size_t fileSize { 0 };
+    };
+
+    /*! stream buffer that collects what gets written into large
+        buffers, and writes each one (with pwrite()) once full - in
+        the background, with several writes in flight at the same
+        time. Flushing the stream writes what is buffered so far (so
+        the file has everything written so far), and waits for all
+        writes to finish; the stream's bad bit tells whether any
+        of them failed */
+    class OutputFileBuffer : public std::streambuf {
+    public:
+      /*! create (or, if 'append', append to) given file */
+      OutputFileBuffer(const std::string &fileName, bool append);
+      ~OutputFileBuffer();
+
+      bool isOpen() const { return fd >= 0; }
+
+    protected:
+      std::streamsize xsputn(const char *data, std::streamsize numBytes) override;
+      int_type overflow(int_type c) override;
+      int sync() override;
+      /*! only supports telling where we are (\see std::ostream::tellp) */
+      pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                       std::ios_base::openmode which) override;
+
+    private:
+      /*! write the current buffer's first 'numBytes' bytes, in the
+          background */
+      void startWrite(size_t numBytes);
+      /*! wait for the write of given buffer (if any) to finish, and
+          throw if it failed */
+      void finishWrite(size_t bufferID);
+
+      static const int numBuffers = 4;
+      int                 fd        { -1 };
+      bool                direct    { false };
+      uint8_t            *buffers[numBuffers] = {};
+      std::future<void>   pendingWrite[numBuffers];
+      /*! the buffer we're currently filling ... */
+      int                 current   { 0 };
+      /*! ... and where in the file that one goes */
+      size_t              bufferOffset { 0 };
+      size_t              bufferFill   { 0 };
+    };
+
+    /*! a std::ostream that writes through an OutputFileBuffer */
+    struct OutputFile : public std::ostream {
+      OutputFile(const std::string &fileName, bool append = false);
+
+      OutputFileBuffer buffer;
+    };
+
+  } // ::directio
+} // ::pbrt
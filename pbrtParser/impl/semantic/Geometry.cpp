@@ -15,6 +15,7 @@
 // ======================================================================== //
 
 #include "SemanticParser.h"
+#include "../syntactic/FileMapping.h"
 // ply parser:
 #include "../3rdParty/rply.h"
 #include <cstring>
@@ -43,25 +44,55 @@ static int rply_vertex_callback_vec2(p_ply_argument argument) {
     return 1;
 }
 
+/*! collects the faces rply hands us, one index at a time */
+struct RPlyFaceCollector {
+  /*! all faces read so far; triangles (and fan-triangulated
+      polygons) as degenerate quads */
+  pbrt::MappableArray<pbrt::vec4i> faces;
+  /*! whether we've seen any face with exactly four vertices */
+  bool                     anyQuad { false };
+  bool                     triangulatePolygons { false };
+  /*! number of vertices the file has (which all indices have to be
+      less than) */
+  long                     numVertices { 0 };
+  /*! the vertex indices of the face we're currently reading */
+  std::vector<int>         current;
+  long                     currentLength { 0 };
+};
+
 static int rply_face_callback(p_ply_argument argument) {
-  int* buffer;
-  ply_get_argument_user_data(argument, (void**)&buffer, nullptr);
+  RPlyFaceCollector* collector;
+  ply_get_argument_user_data(argument, (void**)&collector, nullptr);
 
   long length, value_index;
   ply_get_argument_property(argument, nullptr, &length, &value_index);
 
   // the first value of a list property, the one that gives the number of entries
   if (value_index == -1) {
-    if (length != 3) {
-      // NOTE: we can also handles quads if necessary (length == 4)
-      throw std::runtime_error("Found face with vertex count different from 3, only triangles are supported");
-    }
+    if (length < 3 || (length > 4 && !collector->triangulatePolygons)) 
+      throw std::runtime_error("Found face with "+std::to_string(length)+" vertices, "
+                               "only triangles and quads are supported"
+                               +std::string(length > 4 ? " (unless polygon triangulation is enabled)" : ""));
+    collector->currentLength = length;
+    collector->current.clear();
     return 1; // continue;
   }
 
-  long index;
-  ply_get_argument_element(argument, nullptr, &index);
-  buffer[index * 3 + value_index] = (int)ply_get_argument_value(argument);
+  const double index = ply_get_argument_value(argument);
+  if (!(index >= 0. && index < double(collector->numVertices)))
+    throw std::runtime_error("Found face with a vertex index out of range "
+                             "(there are "+std::to_string(collector->numVertices)+" vertices)");
+  collector->current.push_back((int)index);
+  if ((long)collector->current.size() == collector->currentLength) {
+    const std::vector<int> &v = collector->current;
+    if (v.size() == 4)
+      collector->faces.push_back(pbrt::vec4i(v[0],v[1],v[2],v[3]));
+    else
+      for (size_t i=1;i+1<v.size();i++)
+        collector->faces.push_back(pbrt::vec4i(v[0],v[i],v[i+1],v[i+1]));
+    if (v.size() == 4)
+      collector->anyQuad = true;
+  }
   return 1;
 }
 
@@ -78,10 +109,32 @@ static int rply_face_callback(p_ply_argument argument) {
 namespace pbrt {
   namespace ply {
     void parse(const std::string &fileName,
-      std::vector<vec3f> &pos,
-      std::vector<vec3f> &nor,
-      std::vector<vec2f> &tex,
-      std::vector<vec3i> &idx)
+      MappableArray<vec3f> &pos,
+      MappableArray<vec3f> &nor,
+      MappableArray<vec2f> &tex,
+      MappableArray<vec3i> &idx,
+      MappableArray<vec4i> &quads,
+      bool triangulatePolygons,
+      const std::string &cacheDir)
+    {
+      if (!cacheDir.empty() &&
+          readFromCache(cacheDir,fileName,pos,nor,tex,idx,quads,triangulatePolygons))
+        return;
+      
+      if (!parseAscii(fileName,pos,nor,tex,idx,quads,triangulatePolygons))
+        parseWithRPly(fileName,pos,nor,tex,idx,quads,triangulatePolygons);
+      
+      if (!cacheDir.empty())
+        writeToCache(cacheDir,fileName,pos,nor,tex,idx,quads,triangulatePolygons);
+    }
+    
+    void parseWithRPly(const std::string &fileName,
+      MappableArray<vec3f> &pos,
+      MappableArray<vec3f> &nor,
+      MappableArray<vec2f> &tex,
+      MappableArray<vec3i> &idx,
+      MappableArray<vec4i> &quads,
+      bool triangulatePolygons)
     {
       p_ply ply = ply_open(fileName.c_str(), nullptr, 0, nullptr);
       if (!ply)
@@ -174,8 +227,6 @@ namespace pbrt {
         nor.resize(vertex_count);
       if (has_uvs)
         tex.resize(vertex_count);
-      if (has_indices)
-        idx.resize(face_count);
 
       // Set callbacks to process the PLY properties.
       ply_set_read_cb(ply, "vertex", "x", rply_vertex_callback_vec3, &pos[0].x, 0);
@@ -193,16 +244,32 @@ namespace pbrt {
         ply_set_read_cb(ply, "vertex", tex_coord_v_name, rply_vertex_callback_vec2, &tex[0].y, 0);
       }
 
+      RPlyFaceCollector faces;
+      faces.triangulatePolygons = triangulatePolygons;
+      faces.numVertices         = vertex_count;
       if (has_indices) {
-        ply_set_read_cb(ply, "face", vertex_indices_name, rply_face_callback, &idx[0].x, 0);
+        faces.faces.reserve(face_count);
+        ply_set_read_cb(ply, "face", vertex_indices_name, rply_face_callback, &faces, 0);
       }
 
       // Read ply file.
-      if (!ply_read(ply)) {
+      try {
+        if (!ply_read(ply))
+          throw std::runtime_error(fileName + ": unable to read the contents of PLY file");
+      } catch (...) {
         ply_close(ply);
-        throw std::runtime_error(fileName + ": unable to read the contents of PLY file");
+        throw;
       }
       ply_close(ply);
+
+      if (faces.anyQuad)
+        quads = std::move(faces.faces);
+      else {
+        // only triangles (and fan-triangulated polygons)
+        idx.resize(faces.faces.size());
+        for (size_t i=0;i<idx.size();i++)
+          idx[i] = vec3i(faces.faces[i].x,faces.faces[i].y,faces.faces[i].z);
+      }
     }
   } // ::pbrt::ply
 
@@ -222,17 +289,194 @@ namespace pbrt {
     const std::string fileName
       = pbrtScene->makeGlobalFileName(shape->getParamString("filename"));
     TriangleMesh::SP ours = std::make_shared<TriangleMesh>(findOrCreateMaterial(shape->material));
-    ply::parse(fileName,ours->vertex,ours->normal,ours->texcoord,ours->index);
+    loadPlyMesh(ours,fileName,shape->transform.atStart);
+    extractTextures(ours,shape);
+    return ours;
+  }
 
-    affine3f xfm = shape->transform.atStart;
-    for (vec3f &v : ours->vertex)
-      v = xfmPoint(xfm,v);
-    for (vec3f &v : ours->normal)
-      v = xfmNormal(xfm,v);
+  void SemanticParser::loadPlyMesh(TriangleMesh::SP mesh,
+                                   const std::string &fileName,
+                                   const affine3f &xfm)
+  {
+    plyFiles.insert(fileName);
+    std::shared_ptr<MappableArray<vec4i>> quads = std::make_shared<MappableArray<vec4i>>();
+    if (options.plyQuadsAsQuadMesh)
+      plyQuads[mesh] = quads;
+    const ImportOptions loadOptions = options;
+    auto loadMesh = [mesh,fileName,xfm,quads,loadOptions]() {
+      const ImportOptions &options = loadOptions;
+      if (options.progress)
+        options.progress->checkCancelled();
+      ply::parse(fileName,mesh->vertex,mesh->normal,mesh->texcoord,mesh->index,*quads,
+                 options.triangulatePlyPolygons,options.plyCacheDirectory);
+      xfmPoints(xfm,mesh->vertex.data(),mesh->vertex.data(),mesh->vertex.size());
+      xfmNormals(xfm,mesh->normal.data(),mesh->normal.data(),mesh->normal.size());
+      if (!options.plyQuadsAsQuadMesh && !quads->empty()) {
+        // split every (non-degenerate) quad into two triangles
+        for (const vec4i &quad : *quads) {
+          mesh->index.push_back(vec3i(quad.x,quad.y,quad.z));
+          if (quad.w != quad.z)
+            mesh->index.push_back(vec3i(quad.x,quad.z,quad.w));
+        }
+        quads->clear();
+      }
+      if (options.progress)
+        options.progress->filesDone++;
+    };
+    if (options.asyncPlyLoading) {
+      // only create the (still empty) mesh right now, and have the
+      // worker pool fill it in while we're parsing the rest
+      if (!plyLoader)
+        plyLoader = std::make_shared<pbrt::syntactic::TaskPool>();
+      plyLoader->schedule(loadMesh);
+    } else
+      loadMesh();
+  }
+
+  void SemanticParser::finishPlyLoading()
+  {
+    // make sure all meshes that are still being loaded in the
+    // background are complete before we hand out the result
+    if (plyLoader)
+      plyLoader->wait();
+    
+    for (auto &copy : plyMeshCopies) {
+      TriangleMesh::SP dst = copy.first;
+      TriangleMesh::SP src = copy.second;
+      dst->vertex   = src->vertex;
+      dst->normal   = src->normal;
+      dst->texcoord = src->texcoord;
+      dst->index    = src->index;
+      auto srcQuads = plyQuads.find(src);
+      if (srcQuads != plyQuads.end())
+        plyQuads[dst] = srcQuads->second;
+    }
+    plyMeshCopies.clear();
+
+    // the triangle meshes we replace with quad meshes get thrown
+    // away, so their arrays can move; quads that several meshes share
+    // only move into the last of them
+    std::map<MappableArray<vec4i>*,int> numQuadsUsers;
+    for (auto &it : plyQuads)
+      numQuadsUsers[it.second.get()]++;
+    std::map<Shape::SP,Shape::SP> replacements;
+    for (auto &it : plyQuads) {
+      if (it.second->empty()) continue;
+      TriangleMesh::SP tris  = it.first;
+      QuadMesh::SP     quads = std::make_shared<QuadMesh>(tris->material);
+      quads->textures           = tris->textures;
+      quads->areaLight          = tris->areaLight;
+      quads->reverseOrientation = tris->reverseOrientation;
+      quads->alpha              = tris->alpha;
+      quads->vertex             = std::move(tris->vertex);
+      quads->normal             = std::move(tris->normal);
+      quads->texcoord           = std::move(tris->texcoord);
+      if (--numQuadsUsers[it.second.get()] == 0)
+        quads->index            = std::move(*it.second);
+      else
+        quads->index            = *it.second;
+      replacements[tris] = quads;
+    }
+    plyQuads.clear();
+    if (!replacements.empty())
+      replaceShapes(replacements);
+  }
+
+  void SemanticParser::replaceShapes(const std::map<Shape::SP,Shape::SP> &replacements)
+  {
+    std::vector<Object::SP> objects;
+    for (auto &it : emittedObjects)      objects.push_back(it.second);
+    for (auto &it : plyPrototypeObjects) objects.push_back(it.second);
+    for (auto object : objects)
+      for (auto &shape : object->shapes) {
+        auto it = replacements.find(shape);
+        if (it != replacements.end())
+          shape = it->second;
+      }
+    for (auto &it : emittedShapes) {
+      auto replacement = replacements.find(it.second);
+      if (replacement != replacements.end())
+        it.second = replacement->second;
+    }
+  }
+
+  std::string SemanticParser::getPlyFileKey(pbrt::syntactic::Shape::SP shape)
+  {
+    const std::string fileName
+      = pbrtScene->makeGlobalFileName(shape->getParamString("filename"));
+    auto it = plyFileKeys.find(fileName);
+    if (it != plyFileKeys.end())
+      return it->second;
+    return plyFileKeys[fileName] = pbrt::syntactic::getFileStamp(fileName).toString();
+  }
+  
+  void SemanticParser::countPlyReferences(pbrt::syntactic::Object::SP object,
+                                          std::set<pbrt::syntactic::Object::SP> &alreadyCounted)
+  {
+    if (!object || alreadyCounted.find(object) != alreadyCounted.end())
+      return;
+    alreadyCounted.insert(object);
+
+    for (auto shape : object->shapes) {
+      if (shape->type != "plymesh")
+        continue;
+      PlyFileUsage &usage = plyFileUsage[getPlyFileKey(shape)];
+      const affine3f xfm = shape->transform.atStart;
+      if (usage.numReferences == 0)
+        usage.firstTransform = xfm;
+      else if (memcmp(&xfm,&usage.firstTransform,sizeof(xfm)) != 0)
+        usage.allSameTransform = false;
+      usage.numReferences++;
+    }
+    for (auto instance : object->objectInstances)
+      countPlyReferences(instance->object,alreadyCounted);
+  }
 
+  TriangleMesh::SP SemanticParser::findOrCreatePlyPrototype(pbrt::syntactic::Shape::SP shape,
+                                                            const affine3f &xfm)
+  {
+    TriangleMesh::SP ours = std::make_shared<TriangleMesh>(findOrCreateMaterial(shape->material));
     extractTextures(ours,shape);
+    applyShapeAttributes(ours,shape);
+
+    const std::string fileKey = getPlyFileKey(shape);
+    const PlyPrototypeKey key(fileKey,ours->material,ours->textures,
+                              ours->areaLight,ours->reverseOrientation);
+    auto it = plyPrototypes.find(key);
+    if (it != plyPrototypes.end())
+      return it->second;
+    plyPrototypes[key] = ours;
+
+    // all prototypes of the same file use the same transform, so if
+    // we've already read this file for another prototype (say, with a
+    // different material), we can simply copy its arrays later on
+    auto decoded = decodedPlyFiles.find(fileKey);
+    if (decoded != decodedPlyFiles.end())
+      plyMeshCopies.push_back({ours,decoded->second});
+    else {
+      decodedPlyFiles[fileKey] = ours;
+      loadPlyMesh(ours,
+                  pbrtScene->makeGlobalFileName(shape->getParamString("filename")),
+                  xfm);
+    }
     return ours;
   }
+  
+  Instance::SP SemanticParser::emitPlyInstance(pbrt::syntactic::Shape::SP shape)
+  {
+    TriangleMesh::SP prototype = findOrCreatePlyPrototype(shape,affine3f::identity());
+    Object::SP &object = plyPrototypeObjects[prototype];
+    if (!object) {
+      object = std::make_shared<Object>();
+      object->name = shape->getParamString("filename");
+      object->shapes.push_back(prototype);
+    }
+    
+    Instance::SP ourInstance = std::make_shared<Instance>();
+    ourInstance->xfm    = shape->transform.atStart;
+    ourInstance->object = object;
+    return ourInstance;
+  }
 
   Shape::SP SemanticParser::emitTriangleMesh(pbrt::syntactic::Shape::SP shape)
   {
@@ -248,10 +492,8 @@ namespace pbrt {
     ours->index = extractVector<vec3i>(shape,"indices");
 
     affine3f xfm = shape->transform.atStart;
-    for (vec3f &v : ours->vertex)
-      v = xfmPoint(xfm,v);
-    for (vec3f &v : ours->normal)
-      v = xfmNormal(xfm,v);
+    xfmPoints(xfm,ours->vertex.data(),ours->vertex.data(),ours->vertex.size());
+    xfmNormals(xfm,ours->normal.data(),ours->normal.data(),ours->normal.size());
     extractTextures(ours,shape);
     
     auto alphaParam = shape->findParam<float>("alpha");
@@ -426,7 +668,17 @@ namespace pbrt {
 
     Shape::SP newShape = emitShape(pbrtShape);
     emittedShapes[pbrtShape] = newShape;
+    if (newShape)
+      applyShapeAttributes(newShape,pbrtShape);
 
+    return newShape;
+  }
+
+  /*! assign those values that are stored with the syntactic shape's
+    attributes (area light, orientation) to our shape */
+  void SemanticParser::applyShapeAttributes(Shape::SP newShape,
+                                            pbrt::syntactic::Shape::SP pbrtShape)
+  {
     if (pbrtShape->attributes) {
       newShape->reverseOrientation
         = pbrtShape->attributes->reverseOrientation;
@@ -441,8 +693,6 @@ namespace pbrt {
         newShape->areaLight = parseAreaLight(areaLights[0]);
       }
     }
-
-    return newShape;
   }
 
   
@@ -468,6 +718,24 @@ namespace pbrt {
     }
 
     for (auto shape : pbrtObject->shapes) {
+      if (options.progress) {
+        options.progress->checkCancelled();
+        options.progress->entitiesDecoded++;
+      }
+      if (options.instancePlyMeshes && shape->type == "plymesh") {
+        const PlyFileUsage &usage = plyFileUsage[getPlyFileKey(shape)];
+        if (usage.numReferences > 1 && usage.allSameTransform) {
+          // all references can share the same (transformed) mesh
+          ourObject->shapes.push_back(findOrCreatePlyPrototype(shape,usage.firstTransform));
+          continue;
+        }
+        if (usage.numReferences > 1) {
+          // store the mesh only once, and instance it
+          ourObject->instances.push_back(emitPlyInstance(shape));
+          continue;
+        }
+      }
+      
       Shape::SP ourShape = findOrCreateShape(shape);
       if (ourShape)
         ourObject->shapes.push_back(ourShape);
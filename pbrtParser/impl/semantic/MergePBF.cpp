@@ -0,0 +1,53 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "pbrtParser/Scene.h"
+#include "SemanticParser.h"
+
+namespace pbrt {
+
+  size_t mergePBF(const std::vector<MergeInput> &inputs,
+                  const std::string &outFileName,
+                  const SaveOptions &options)
+  {
+    if (inputs.empty())
+      throw std::runtime_error("mergePBF - no files to merge");
+
+    // shapes only get created, so we can copy their data as is
+    LoadOptions loadOptions;
+    loadOptions.lazyShapes = true;
+    Scene::SP merged;
+    for (auto &input : inputs) {
+      Scene::SP scene = Scene::loadFrom(input.fileName,loadOptions);
+      if (!merged) {
+        // camera, film, etc come from the first file
+        merged = scene;
+        Object::SP world = scene->world;
+        merged->world = std::make_shared<Object>();
+        if (world)
+          merged->world->instances.push_back(std::make_shared<Instance>(world,input.xfm));
+      } else if (scene->world)
+        merged->world->instances.push_back(std::make_shared<Instance>(scene->world,input.xfm));
+    }
+
+    SaveOptions saveOptions = options;
+    saveOptions.copyLazyShapes = true;
+    // the shapes still read from the inputs while we write, and the
+    // output may well be one of them
+    return rewriteFile(merged,outFileName,saveOptions);
+  }
+
+} // ::pbrt
@@ -0,0 +1,249 @@
+// ======================================================================== //
+// Copyright 2019-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+/*! \file PlyCache.cpp On-disk cache of already decoded PLY files:
+    for every PLY file we decode we store a raw blob with the vertex,
+    normal, texcoord, and (triangle or quad) index arrays in a cache
+    directory; the blob's name is derived from the PLY file's path,
+    size, and modification time (and from how we decoded it), so a
+    changed file automatically misses the cache. A warm re-import
+    then only has to map that blob - the arrays we hand out point
+    straight into that mapping (\see ArrayAllocator) - rather than
+    parse the PLY file */
+
+#include "SemanticParser.h"
+#include "../syntactic/FileMapping.h"
+// std
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#ifdef _WIN32
+# include <direct.h>
+#else
+# include <sys/stat.h>
+# include <sys/types.h>
+#endif
+
+namespace pbrt {
+  namespace ply {
+
+    /*! magic number at the start of each cache blob */
+    static const char   cacheMagic[8] = { 'P','B','R','T','P','L','Y','C' };
+    /*! version of the cache blob layout (or of the way we decode ply
+        files); blobs with any other version get ignored */
+    static const uint32_t cacheVersion = 2;
+    /*! all arrays in the blob start at multiples of this */
+    static const size_t cacheAlignment = 64;
+
+    /*! header at the start of each cache blob */
+    struct CacheHeader {
+      char     magic[8];
+      uint32_t version;
+      uint32_t stampLength;
+      uint64_t numVertices;
+      uint64_t numNormals;
+      uint64_t numTexcoords;
+      uint64_t numIndices;
+      uint64_t numQuads;
+    };
+
+    /*! 64-bit FNV-1a hash of given string */
+    static uint64_t hashString(const std::string &s)
+    {
+      uint64_t hash = 0xcbf29ce484222325ull;
+      for (char c : s) {
+        hash ^= (uint8_t)c;
+        hash *= 0x100000001b3ull;
+      }
+      return hash;
+    }
+
+    inline size_t alignUp(size_t offset)
+    {
+      return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+    }
+
+    /*! what identifies a blob: the PLY file's stamp, plus whatever
+        changes what we decode from that file */
+    static std::string cacheKey(const std::string &fileName, bool triangulatePolygons)
+    {
+      return syntactic::getFileStamp(fileName).toString()
+        + (triangulatePolygons ? " triangulated" : "");
+    }
+
+    /*! name of the blob for given key */
+    static std::string cacheFileName(const std::string &cacheDir,
+                                     const std::string &key)
+    {
+      char hex[17];
+      snprintf(hex,sizeof(hex),"%016llx",(unsigned long long)hashString(key));
+      return cacheDir + "/" + hex + ".plycache";
+    }
+
+    /*! have given array point to 'count' elements in the blob's mapping */
+    template<typename T>
+    static void mapArray(MappableArray<T> &array, const uint8_t *src, size_t count,
+                         const std::shared_ptr<syntactic::FileMapping> &blob)
+    {
+      if (count == 0) {
+        array.clear();
+        return;
+      }
+      // (the mapping is copy-on-write, so it's safe to hand out
+      // non-const pointers into it)
+      MappableArray<T> mapped(ArrayAllocator<T>((T*)const_cast<uint8_t*>(src),count,blob));
+      mapped.resize(count);
+      array.swap(mapped);
+    }
+
+    bool readFromCache(const std::string &cacheDir,
+                       const std::string &fileName,
+                       MappableArray<vec3f> &pos,
+                       MappableArray<vec3f> &nor,
+                       MappableArray<vec2f> &tex,
+                       MappableArray<vec3i> &idx,
+                       MappableArray<vec4i> &quads,
+                       bool triangulatePolygons)
+    {
+      try {
+        const std::string stamp = cacheKey(fileName,triangulatePolygons);
+        const std::string blobName = cacheFileName(cacheDir,stamp);
+        if (!std::ifstream(blobName,std::ios::binary).good())
+          // no blob for this file (yet)
+          return false;
+        std::shared_ptr<syntactic::FileMapping> blob
+          = std::make_shared<syntactic::FileMapping>(blobName,/*copyOnWrite*/true);
+        const uint8_t *data = blob->data();
+        const size_t   size = blob->nbytes();
+
+        CacheHeader header;
+        if (size < sizeof(header)) return false;
+        memcpy(&header,data,sizeof(header));
+        if (memcmp(header.magic,cacheMagic,sizeof(cacheMagic)) != 0 ||
+            header.version != cacheVersion ||
+            header.stampLength != stamp.size())
+          return false;
+        size_t offset = sizeof(header);
+        if (offset + header.stampLength > size ||
+            memcmp(data+offset,stamp.data(),stamp.size()) != 0)
+          // hash collision, or some other file's blob
+          return false;
+        offset += header.stampLength;
+
+        const size_t sizes[5] = {
+          header.numVertices  * sizeof(vec3f),
+          header.numNormals   * sizeof(vec3f),
+          header.numTexcoords * sizeof(vec2f),
+          header.numIndices   * sizeof(vec3i),
+          header.numQuads     * sizeof(vec4i)
+        };
+        size_t end = offset;
+        for (int i=0;i<5;i++) end = alignUp(end) + sizes[i];
+        if (end > size) return false;
+
+        // (all arrays start at multiples of cacheAlignment, so they're
+        // properly aligned for their types)
+        size_t arrayBegin[5];
+        for (int i=0;i<5;i++) {
+          offset = alignUp(offset);
+          arrayBegin[i] = offset;
+          offset += sizes[i];
+        }
+        mapArray(pos,  data+arrayBegin[0],header.numVertices, blob);
+        mapArray(nor,  data+arrayBegin[1],header.numNormals,  blob);
+        mapArray(tex,  data+arrayBegin[2],header.numTexcoords,blob);
+        mapArray(idx,  data+arrayBegin[3],header.numIndices,  blob);
+        mapArray(quads,data+arrayBegin[4],header.numQuads,    blob);
+        return true;
+      } catch (std::runtime_error &) {
+        return false;
+      }
+    }
+
+    void writeToCache(const std::string &cacheDir,
+                      const std::string &fileName,
+                      const MappableArray<vec3f> &pos,
+                      const MappableArray<vec3f> &nor,
+                      const MappableArray<vec2f> &tex,
+                      const MappableArray<vec3i> &idx,
+                      const MappableArray<vec4i> &quads,
+                      bool triangulatePolygons)
+    {
+      std::string stamp;
+      try {
+        stamp = cacheKey(fileName,triangulatePolygons);
+      } catch (std::runtime_error &) {
+        return;
+      }
+#ifdef _WIN32
+      _mkdir(cacheDir.c_str());
+#else
+      mkdir(cacheDir.c_str(),0755);
+#endif
+      const std::string blobName = cacheFileName(cacheDir,stamp);
+      // write to a temporary file first, and rename that once it is
+      // complete, so concurrent readers never see a partial blob
+      std::stringstream tmpName;
+      tmpName << blobName << ".tmp." << std::this_thread::get_id();
+      {
+        std::ofstream out(tmpName.str(),std::ios::binary);
+        if (!out.good())
+          // read-only cache directory, or similar - just don't cache
+          return;
+
+        CacheHeader header;
+        memcpy(header.magic,cacheMagic,sizeof(cacheMagic));
+        header.version      = cacheVersion;
+        header.stampLength  = (uint32_t)stamp.size();
+        header.numVertices  = pos.size();
+        header.numNormals   = nor.size();
+        header.numTexcoords = tex.size();
+        header.numIndices   = idx.size();
+        header.numQuads     = quads.size();
+        out.write((const char *)&header,sizeof(header));
+        out.write(stamp.data(),stamp.size());
+
+        size_t offset = sizeof(header) + stamp.size();
+        const void  *arrays[5] = { pos.data(), nor.data(), tex.data(), idx.data(), quads.data() };
+        const size_t sizes[5]  = {
+          pos.size()*sizeof(vec3f), nor.size()*sizeof(vec3f),
+          tex.size()*sizeof(vec2f), idx.size()*sizeof(vec3i),
+          quads.size()*sizeof(vec4i)
+        };
+        static const char zeroes[cacheAlignment] = { 0 };
+        for (int i=0;i<5;i++) {
+          out.write(zeroes,alignUp(offset)-offset);
+          offset = alignUp(offset);
+          out.write((const char *)arrays[i],sizes[i]);
+          offset += sizes[i];
+        }
+        if (!out.good()) {
+          out.close();
+          std::remove(tmpName.str().c_str());
+          return;
+        }
+      }
+#ifdef _WIN32
+      // windows' rename doesn't replace existing files
+      std::remove(blobName.c_str());
+#endif
+      if (std::rename(tmpName.str().c_str(),blobName.c_str()) != 0)
+        std::remove(tmpName.str().c_str());
+    }
+
+  } // ::pbrt::ply
+} // ::pbrt
@@ -15,7 +15,9 @@
 // ======================================================================== //
 
 #include "pbrtParser/Scene.h"
+#include "../syntactic/Parallel.h"
 // std
+#include <map>
 #include <set>
 #include <string.h>
 #include <algorithm>
@@ -33,42 +35,92 @@ namespace pbrt {
     return getPrimBounds(primID,affine3f::identity());
   }
 
+  /*! bounds of given vertex array; large arrays get split into
+      blocks that get reduced in parallel */
+  static box3f boundsOf(const MappableArray<vec3f> &vertex)
+  {
+    const size_t blockSize = size_t(1)<<20;
+    box3f bounds = box3f::empty_box();
+    if (vertex.size() <= blockSize) {
+      extendBounds(bounds,vertex.data(),vertex.size());
+      return bounds;
+    }
+    std::vector<box3f> blockBounds((vertex.size()+blockSize-1)/blockSize,box3f::empty_box());
+    syntactic::parallel_for_blocked(vertex.size(),blockSize,[&](size_t begin, size_t end) {
+        extendBounds(blockBounds[begin/blockSize],vertex.data()+begin,end-begin);
+      });
+    for (auto &b : blockBounds)
+      bounds.extend(b);
+    return bounds;
+  }
+
   std::string TriangleMesh::toString() const 
   {
     return "TriangleMesh";
   }
 
+  void CompactIndices::setFrom(const int *indices, size_t numIndices)
+  {
+    int minIndex = 0, maxIndex = 0;
+    for (size_t i=0;i<numIndices;i++) {
+      minIndex = std::min(minIndex,indices[i]);
+      maxIndex = std::max(maxIndex,indices[i]);
+    }
+    width
+      = (minIndex < 0 || maxIndex > 0xffff) ? 4
+      : (maxIndex > 0xff) ? 2
+      : 1;
+    data.resize(numIndices*width);
+    for (size_t i=0;i<numIndices;i++)
+      switch (width) {
+      case 1: data[i] = (uint8_t)indices[i]; break;
+      case 2: { uint16_t idx = (uint16_t)indices[i]; memcpy(&data[2*i],&idx,sizeof(idx)); } break;
+      default: memcpy(&data[4*i],&indices[i],sizeof(int32_t));
+      }
+  }
+
+  void TriangleMesh::expandIndices()
+  {
+    Pin pin(this);
+    if (compactIndex.empty()) return;
+    index.resize(compactIndex.size()/3);
+    for (size_t i=0;i<index.size();i++)
+      index[i] = getIndex(i);
+    compactIndex = CompactIndices();
+  }
+
   box3f TriangleMesh::getPrimBounds(const size_t primID, const affine3f &xfm) 
   {
+    Pin pin(this);
+    const auto idx = getIndex(primID);
     box3f primBounds = box3f::empty_box();
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].x]));
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].y]));
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].z]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.x]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.y]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.z]));
     return primBounds;
   }
     
   box3f TriangleMesh::getPrimBounds(const size_t primID) 
   {
+    Pin pin(this);
+    const auto idx = getIndex(primID);
     box3f primBounds = box3f::empty_box();
-    primBounds.extend(vertex[index[primID].x]);
-    primBounds.extend(vertex[index[primID].y]);
-    primBounds.extend(vertex[index[primID].z]);
+    primBounds.extend(vertex[idx.x]);
+    primBounds.extend(vertex[idx.y]);
+    primBounds.extend(vertex[idx.z]);
     return primBounds;
   }
     
   box3f TriangleMesh::getBounds() 
   {
-    if (!haveComputedBounds) {
-      std::lock_guard<std::mutex> lock(mutex);
-      if (haveComputedBounds) return bounds;
-      bounds = box3f::empty_box();
-      for (auto v : vertex) {
-        bounds.extend(v);
-      }
-      
-      haveComputedBounds = true;
-      return bounds;
-    }
+    if (haveStoredInfo) return storedBounds;
+    Pin pin(this);
+    if (haveComputedBounds) return bounds;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (haveComputedBounds) return bounds;
+    bounds = boundsOf(vertex);
+    haveComputedBounds = true;
     return bounds;
   }
 
@@ -77,18 +129,11 @@ namespace pbrt {
 
   box3f Sphere::getPrimBounds(const size_t /*unused: primID*/, const affine3f &xfm) 
   {
+    ensureLoaded();
     box3f ob(vec3f(-radius),vec3f(+radius));
     affine3f _xfm = xfm * transform;
       
-    box3f bounds = box3f::empty_box();
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.lower.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.lower.y,ob.upper.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.upper.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.upper.y,ob.upper.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.lower.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.lower.y,ob.upper.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.upper.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.upper.y,ob.upper.z)));
+    box3f bounds = xfmBounds(_xfm,ob);
     return bounds;
   }
     
@@ -99,6 +144,7 @@ namespace pbrt {
     
   box3f Sphere::getBounds() 
   {
+    if (haveStoredInfo) return storedBounds;
     return getPrimBounds(0);
   }
     
@@ -109,18 +155,11 @@ namespace pbrt {
 
   box3f Disk::getPrimBounds(const size_t /*unused: primID*/, const affine3f &xfm) 
   {
+    ensureLoaded();
     box3f ob(vec3f(-radius,-radius,0),vec3f(+radius,+radius,height));
     affine3f _xfm = xfm * transform;
       
-    box3f bounds = box3f::empty_box();
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.lower.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.lower.y,ob.upper.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.upper.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.lower.x,ob.upper.y,ob.upper.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.lower.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.lower.y,ob.upper.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.upper.y,ob.lower.z)));
-    bounds.extend(xfmPoint(_xfm,vec3f(ob.upper.x,ob.upper.y,ob.upper.z)));
+    box3f bounds = xfmBounds(_xfm,ob);
     return bounds;
   }
     
@@ -131,6 +170,7 @@ namespace pbrt {
     
   box3f Disk::getBounds() 
   {
+    if (haveStoredInfo) return storedBounds;
     return getPrimBounds(0);
   }
     
@@ -142,36 +182,50 @@ namespace pbrt {
   // QuadMesh
   // ==================================================================
 
+  void QuadMesh::expandIndices()
+  {
+    Pin pin(this);
+    if (compactIndex.empty()) return;
+    index.resize(compactIndex.size()/4);
+    for (size_t i=0;i<index.size();i++)
+      index[i] = getIndex(i);
+    compactIndex = CompactIndices();
+  }
+
   box3f QuadMesh::getPrimBounds(const size_t primID, const affine3f &xfm) 
   {
+    Pin pin(this);
+    const auto idx = getIndex(primID);
     box3f primBounds = box3f::empty_box();
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].x]));
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].y]));
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].z]));
-    primBounds.extend(xfmPoint(xfm,vertex[index[primID].w]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.x]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.y]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.z]));
+    primBounds.extend(xfmPoint(xfm,vertex[idx.w]));
     return primBounds;
   }
 
   box3f QuadMesh::getPrimBounds(const size_t primID) 
   {
+    Pin pin(this);
+    const auto idx = getIndex(primID);
     box3f primBounds = box3f::empty_box();
-    primBounds.extend(vertex[index[primID].x]);
-    primBounds.extend(vertex[index[primID].y]);
-    primBounds.extend(vertex[index[primID].z]);
-    primBounds.extend(vertex[index[primID].w]);
+    primBounds.extend(vertex[idx.x]);
+    primBounds.extend(vertex[idx.y]);
+    primBounds.extend(vertex[idx.z]);
+    primBounds.extend(vertex[idx.w]);
     return primBounds;
   }
     
   box3f QuadMesh::getBounds() 
   {
-    if (!haveComputedBounds) {
-      std::lock_guard<std::mutex> lock(mutex);
-      if (haveComputedBounds) return bounds;
-      bounds = box3f::empty_box();
-      for (auto v : vertex) bounds.extend(v);
-      haveComputedBounds = true;
-      return bounds;
-    }
+    if (haveStoredInfo) return storedBounds;
+    Pin pin(this);
+    if (haveComputedBounds) return bounds;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (haveComputedBounds) return bounds;
+    bounds = boundsOf(vertex);
+    haveComputedBounds = true;
     return bounds;
   }
 
@@ -184,6 +238,7 @@ namespace pbrt {
 
   box3f Curve::getPrimBounds(const size_t /*unused: primID*/, const affine3f &xfm) 
   {
+    Pin pin(this);
     box3f primBounds = box3f::empty_box();
     for (auto p : P)
       primBounds.extend(xfmPoint(xfm,p));
@@ -195,6 +250,7 @@ namespace pbrt {
 
   box3f Curve::getPrimBounds(const size_t /*unused: primID */) 
   {
+    Pin pin(this);
     box3f primBounds = box3f::empty_box();
     for (auto p : P)
       primBounds.extend(p);
@@ -206,6 +262,7 @@ namespace pbrt {
     
   box3f Curve::getBounds() 
   {
+    if (haveStoredInfo) return storedBounds;
     return getPrimBounds(0);
   }
 
@@ -214,32 +271,118 @@ namespace pbrt {
   // Object
   // ==================================================================
 
-  box3f Object::getBounds() 
+  /*! compute (and cache) given object's bounds from those of its
+      instances and shapes */
+  static box3f boundsFromChildren(Object &object)
   {
-    if (haveComputedBounds) return bounds;
-
-    std::lock_guard<std::mutex> lock(mutex);
-    if (haveComputedBounds) return bounds;
+    std::lock_guard<std::mutex> lock(object.mutex);
+    if (object.haveComputedBounds) return object.bounds;
     
-    bounds = box3f::empty_box();
-    for (auto &inst : instances) {
+    box3f bounds = box3f::empty_box();
+    for (auto &inst : object.instances) {
       if (inst) {
         const box3f ib = inst->getBounds();
         if (!ib.empty())
           bounds.extend(ib);
       }
     }
-    for (auto &geom : shapes) {
+    for (auto &geom : object.shapes) {
       if (geom) {
         const box3f gb = geom->getBounds();
         if (!gb.empty())
           bounds.extend(gb);
       }
     }
-    haveComputedBounds = true;
+    object.bounds = bounds;
+    object.haveComputedBounds = true;
     return bounds;
   }
 
+  /*! computes the bounds of all objects below a given one (whose
+      bounds aren't known yet), in parallel: first those of all
+      their (unique) shapes, then those of the objects, level by
+      level from the bottom up, so an object's instanced objects
+      always have their bounds by the time it gets to that object */
+  struct BoundsPass {
+    void run(Object *root)
+    {
+      for (auto &inst : root->instances)
+        if (inst && inst->object)
+          levelOf(inst->object.get());
+      for (auto &shape : root->shapes)
+        addShape(shape.get());
+      syntactic::parallel_for(shapes.size(),[&](size_t i) {
+          shapes[i]->getBounds();
+        });
+      for (auto &objects : levels)
+        syntactic::parallel_for(objects.size(),[&](size_t i) {
+            boundsFromChildren(*objects[i]);
+          });
+    }
+
+    void addShape(Shape *shape)
+    {
+      if (shape && alreadyAdded.insert(shape).second)
+        shapes.push_back(shape);
+    }
+
+    /*! the level of given object - 0 for objects that don't
+        instance any other objects (or already know their bounds),
+        one more than the highest of the objects it instances
+        otherwise - collecting it and everything below it on the
+        way */
+    int levelOf(Object *object)
+    {
+      if (object->haveComputedBounds) return -1;
+      auto it = levelByObject.find(object);
+      if (it != levelByObject.end()) return it->second;
+      int level = 0;
+      for (auto &inst : object->instances)
+        if (inst && inst->object)
+          level = std::max(level,levelOf(inst->object.get())+1);
+      for (auto &shape : object->shapes)
+        addShape(shape.get());
+      levelByObject[object] = level;
+      if (levels.size() <= size_t(level))
+        levels.resize(level+1);
+      levels[level].push_back(object);
+      return level;
+    }
+
+    std::vector<Shape *>               shapes;
+    std::set<Shape *>                  alreadyAdded;
+    std::vector<std::vector<Object *>> levels;
+    std::map<Object *,int>             levelByObject;
+  };
+
+  box3f Object::getBounds() 
+  {
+    if (haveComputedBounds) return bounds;
+
+    // (inside a parallel loop, we do it all on this thread)
+    if (!syntactic::insideParallelWorker())
+      BoundsPass().run(this);
+    return boundsFromChildren(*this);
+  }
+
+  size_t Object::getNumPrims()
+  {
+    if (haveComputedNumPrims) return numPrims;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (haveComputedNumPrims) return numPrims;
+
+    numPrims = 0;
+    for (auto &inst : instances)
+      if (inst && inst->object)
+        numPrims += inst->object->getNumPrims();
+    for (auto &geom : shapes)
+      if (geom)
+        numPrims += geom->getNumPrims();
+    haveComputedNumPrims = true;
+    return numPrims;
+  }
+
 
   /*! compute (conservative but possibly approximate) bbox of this
     instance in world space. This box is not necessarily tight, as
@@ -259,15 +402,7 @@ namespace pbrt {
       return ob;
     }
 
-    box3f _bounds = box3f::empty_box();
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.lower.x,ob.lower.y,ob.lower.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.lower.x,ob.lower.y,ob.upper.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.lower.x,ob.upper.y,ob.lower.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.lower.x,ob.upper.y,ob.upper.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.upper.x,ob.lower.y,ob.lower.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.upper.x,ob.lower.y,ob.upper.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.upper.x,ob.upper.y,ob.lower.z)));
-    _bounds.extend(xfmPoint(xfm,vec3f(ob.upper.x,ob.upper.y,ob.upper.z)));
+    box3f _bounds = xfmBounds(xfm,ob);
     this->bounds = _bounds;
     haveComputedBounds = true;
     return bounds;
@@ -305,6 +440,7 @@ namespace pbrt {
 
   struct FatVertex {
     vec3f p, n;
+    vec2f t;
   };
   inline bool operator<(const FatVertex &a, const FatVertex &b)
   { return memcmp(&a,&b,sizeof(a))<0; }
@@ -320,6 +456,7 @@ namespace pbrt {
       FatVertex oldVertex;
       oldVertex.p = in->vertex[i];
       oldVertex.n = in->normal.empty()?vec3f(0.f):in->normal[i];
+      oldVertex.t = in->texcoord.empty()?vec2f(0.f):in->texcoord[i];
 
       auto it = vertexID.find(oldVertex);
       if (it == vertexID.end()) {
@@ -327,8 +464,8 @@ namespace pbrt {
         out->vertex.push_back(in->vertex[i]);
         if (!in->normal.empty())
           out->normal.push_back(in->normal[i]);
-        // if (!in->texcoord.empty())
-        //   out->texcoord.push_back(in->texcoord[i]);
+        if (!in->texcoord.empty())
+          out->texcoord.push_back(in->texcoord[i]);
         vertexID[oldVertex] = newID;
         indexRemap[i] = newID;
       } else {
@@ -349,16 +486,18 @@ namespace pbrt {
     be stored as degenerate quads */
   QuadMesh::SP QuadMesh::makeFrom(TriangleMesh::SP tris)
   {
+    Pin pin(tris.get());
     QuadMesh::SP out = std::make_shared<QuadMesh>(tris->material);
     out->textures = tris->textures;
-    // out->texcoord = in->texcoord;
     out->vertex   = tris->vertex;
     out->normal   = tris->normal;
+    out->texcoord = tris->texcoord;
       
-    for (size_t i=0;i<tris->index.size();i++) {
-      vec3i idx0 = tris->index[i+0];
-      if ((i+1) < tris->index.size()) {
-        vec3i idx1 = tris->index[i+1];
+    const size_t numTris = tris->getNumPrims();
+    for (size_t i=0;i<numTris;i++) {
+      vec3i idx0 = tris->getIndex(i+0);
+      if ((i+1) < numTris) {
+        vec3i idx1 = tris->getIndex(i+1);
         if (idx1.x == idx0.x && idx1.y == idx0.z) {
           // could merge!!!
           out->index.push_back(vec4i(idx0.x,idx0.y,idx0.z,idx1.z));
@@ -376,7 +515,7 @@ namespace pbrt {
       out->index.push_back(vec4i(idx0.x,idx0.y,idx0.z,idx0.z));
     }
       
-    if (tris->vertex.size() == 3*tris->index.size()) {
+    if (tris->vertex.size() == 3*numTris) {
       return remeshVertices(out);
     }
     else
@@ -0,0 +1,292 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "pbrtParser/Scene.h"
+#include "../syntactic/Scene.h"
+#include "../syntactic/FileMapping.h"
+#include "SemanticParser.h"
+// std
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+namespace pbrt {
+
+  /*! read the summary stored in a .pbf file (in BinaryFileFormat.cpp) */
+  SceneInfo::SP readSceneSummary(const std::string &fileName);
+
+  // ==================================================================
+  // SceneInfo for an already loaded scene
+  // ==================================================================
+
+  inline std::string shapeTypeName(const Shape::SP &shape)
+  {
+    std::string name = shape->toString();
+    std::transform(name.begin(),name.end(),name.begin(),::tolower);
+    return name;
+  }
+
+  static void countObject(SceneInfo &info,
+                          Object::SP object,
+                          std::set<Object::SP> &alreadyCounted)
+  {
+    if (!object || alreadyCounted.find(object) != alreadyCounted.end())
+      return;
+    alreadyCounted.insert(object);
+
+    info.numLightSources += object->lightSources.size();
+    for (auto shape : object->shapes) {
+      if (!shape) continue;
+      const std::string type = shapeTypeName(shape);
+      info.numShapes[type]++;
+      info.numPrims[type] += shape->getNumPrims();
+    }
+    info.numInstances += object->instances.size();
+    for (auto inst : object->instances)
+      if (inst) countObject(info,inst->object,alreadyCounted);
+  }
+
+  SceneInfo::SP SceneInfo::computeFrom(Scene::SP scene)
+  {
+    SceneInfo::SP info = std::make_shared<SceneInfo>();
+    info->cameras     = scene->cameras;
+    info->film        = scene->film;
+    info->sampler     = scene->sampler;
+    info->integrator  = scene->integrator;
+    info->pixelFilter = scene->pixelFilter;
+    if (scene->world) {
+      info->bounds = scene->getBounds();
+      std::set<Object::SP> alreadyCounted;
+      countObject(*info,scene->world,alreadyCounted);
+      info->numObjects = alreadyCounted.size()-1;
+    }
+    return info;
+  }
+
+  // ==================================================================
+  // SceneInfo for .pbrt files, without parsing the world
+  // ==================================================================
+
+  /*! number of faces in the given PLY file, according to its header;
+      0 if we can't read it */
+  static size_t numPlyFaces(const std::string &fileName)
+  {
+    std::ifstream in(fileName,std::ios::binary);
+    std::string line;
+    while (std::getline(in,line)) {
+      std::stringstream ss(line);
+      std::string keyword, element;
+      size_t count = 0;
+      ss >> keyword;
+      if (keyword == "end_header")
+        break;
+      if (keyword == "element" && (ss >> element >> count) && element == "face")
+        return count;
+    }
+    return 0;
+  }
+
+  /*! scans the world part of a pbrt file (and all files it includes)
+      for what a SceneInfo needs to know, without actually parsing it:
+      the scanner only tells apart strings, brackets, keywords, and
+      values, and only looks at the values of shapes' "indices" and
+      "filename" parameters - everything else just gets skipped */
+  struct WorldScanner {
+    WorldScanner(SceneInfo &info, pbrt::syntactic::Scene::SP pbrt)
+      : info(info), pbrt(pbrt)
+    {}
+
+    void scan(const std::string &fileName)
+    {
+      if (!alreadyScanned.insert(fileName).second) return;
+      syntactic::FileMapping file(fileName);
+      const char *p   = (const char *)file.data();
+      const char *end = p + file.nbytes();
+      while (p < end) {
+        const char c = *p;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ']') {
+          ++p; continue;
+        }
+        if (c == '#') {
+          const char *eol = (const char *)memchr(p,'\n',end-p);
+          p = eol ? eol : end;
+          continue;
+        }
+        if (c == '[') {
+          ++p;
+          // count the values up to the closing bracket
+          size_t numValues = 0;
+          std::string firstString;
+          while (p < end && *p != ']') {
+            if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' || *p == '[') {
+              ++p; continue;
+            }
+            if (*p == '#') {
+              const char *eol = (const char *)memchr(p,'\n',end-p);
+              p = eol ? eol : end;
+              continue;
+            }
+            if (*p == '"') {
+              const char *close = (const char *)memchr(p+1,'"',end-p-1);
+              if (!close) return;
+              if (numValues == 0) firstString = std::string(p+1,close);
+              p = close+1;
+            } else
+              p = skipWord(p,end);
+            ++numValues;
+          }
+          ++p;
+          value(numValues,firstString);
+          continue;
+        }
+        if (c == '"') {
+          const char *close = (const char *)memchr(p+1,'"',end-p-1);
+          if (!close) return;
+          quotedString(std::string(p+1,close));
+          p = close+1;
+          continue;
+        }
+        const char *wordBegin = p;
+        p = skipWord(p,end);
+        const std::string word(wordBegin,p);
+        if (isalpha((unsigned char)word[0]) && word != "true" && word != "false")
+          keyword(word);
+        else
+          value(1,"");
+      }
+      endShape();
+    }
+
+    inline static const char *skipWord(const char *p, const char *end)
+    {
+      while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r'
+             && *p != '"' && *p != '[' && *p != ']' && *p != '#')
+        ++p;
+      return p;
+    }
+
+    void keyword(const std::string &text)
+    {
+      endShape();
+      parameter.clear();
+      directive = text;
+      if (text == "WorldBegin")
+        inWorld = true;
+      if (!inWorld)
+        return;
+      if (text == "ObjectBegin")
+        info.numObjects++;
+      else if (text == "ObjectInstance")
+        info.numInstances++;
+      else if (text == "LightSource")
+        info.numLightSources++;
+    }
+
+    void quotedString(const std::string &text)
+    {
+      if (directive == "Include") {
+        directive.clear();
+        // (same as the parser does it)
+        scan(text[0] == '/' ? text : pbrt->basePath+"/"+text);
+      } else if (directive == "Shape" && shapeType.empty()) {
+        if (inWorld) shapeType = text;
+      } else if (parameter.empty()) {
+        parameter = text;
+      } else
+        value(1,text);
+    }
+
+    /*! a parameter's value (which might be an array of values) */
+    void value(size_t numValues, const std::string &firstString)
+    {
+      if (shapeType.empty() || parameter.empty()) {
+        parameter.clear();
+        return;
+      }
+      std::stringstream declaration(parameter);
+      std::string type, name;
+      declaration >> type >> name;
+      if (name == "indices")
+        shapePrims = numValues/3;
+      else if (name == "filename" && shapeType == "plymesh")
+        shapePrims = numPlyFaces(pbrt->makeGlobalFileName(firstString));
+      parameter.clear();
+    }
+
+    void endShape()
+    {
+      if (shapeType.empty()) return;
+      info.numShapes[shapeType]++;
+      info.numPrims[shapeType] += (shapePrims == size_t(-1)) ? 1 : shapePrims;
+      shapeType.clear();
+      shapePrims = size_t(-1);
+    }
+
+    SceneInfo                  &info;
+    pbrt::syntactic::Scene::SP pbrt;
+    std::set<std::string>      alreadyScanned;
+    bool                       inWorld { false };
+    /*! the last keyword we've seen */
+    std::string                directive;
+    /*! declaration ("type name") of the parameter whose value comes next */
+    std::string                parameter;
+    /*! type of the shape whose parameters we're in, if any */
+    std::string                shapeType;
+    /*! that shape's number of primitives, if it has told us */
+    size_t                     shapePrims { size_t(-1) };
+  };
+
+  static SceneInfo::SP loadPBRTInfo(const std::string &fileName, const std::string &basePath)
+  {
+    // everything up to WorldBegin gets parsed properly ...
+    pbrt::syntactic::Scene::SP pbrt
+      = pbrt::syntactic::Scene::parseHeader(fileName,basePath);
+    Scene::SP scene = std::make_shared<Scene>();
+    createFilm(scene,pbrt);
+    createSampler(scene,pbrt);
+    createIntegrator(scene,pbrt);
+    createPixelFilter(scene,pbrt);
+    for (auto cam : pbrt->cameras)
+      scene->cameras.push_back(createCamera(cam));
+
+    SceneInfo::SP info = std::make_shared<SceneInfo>();
+    info->cameras     = scene->cameras;
+    info->film        = scene->film;
+    info->sampler     = scene->sampler;
+    info->integrator  = scene->integrator;
+    info->pixelFilter = scene->pixelFilter;
+
+    // ... the world only gets scanned
+    WorldScanner(*info,pbrt).scan(fileName);
+    return info;
+  }
+
+  SceneInfo::SP loadSceneInfo(const std::string &fileName, const std::string &basePath)
+  {
+    if (endsWith(fileName,".pbrt"))
+      return loadPBRTInfo(fileName,basePath);
+    if (endsWith(fileName,".pbf")) {
+      SceneInfo::SP info = readSceneSummary(fileName);
+      // files from before we stored summaries need to be loaded
+      return info ? info : SceneInfo::computeFrom(Scene::loadFrom(fileName));
+    }
+    throw std::runtime_error("could not detect input file format!? (unknown extension in '"+fileName+"')");
+  }
+
+} // ::pbrt
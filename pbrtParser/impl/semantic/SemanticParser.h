@@ -18,9 +18,12 @@
 
 #include "pbrtParser/Scene.h"
 #include "../syntactic/Scene.h"
+#include "../syntactic/Parallel.h"
 // std
 #include <map>
+#include <set>
 #include <sstream>
+#include <tuple>
 
 namespace pbrt {
 
@@ -33,6 +36,87 @@ namespace pbrt {
     return s.substr(s.size()-suffix.size(),suffix.size()) == suffix;
   }
 
+  /*! helper functions for reading PLY files */
+  namespace ply {
+    /*! read given PLY file's vertex positions, normals, texture
+        coordinates, and face indices; uses the fast ascii path where
+        possible, and rply for everything else.
+
+        if the file contains nothing but triangles, those end up in
+        'idx', and 'quads' stays empty. if it contains any quads (or,
+        with 'triangulatePolygons' on, any polygons with more than
+        four vertices) then 'idx' stays empty, and _all_ faces end up
+        in 'quads', with triangles - and the fan triangulation of
+        polygons - stored as degenerate quads (whose last two indices
+        are the same). polygons we can't handle are an error.
+
+        if 'cacheDir' is non-empty we first check if there is an
+        up-to-date copy of this file's data in that directory; if
+        not, the file gets parsed, and its data stored in the cache
+        for next time */
+    void parse(const std::string &fileName,
+               MappableArray<vec3f> &pos,
+               MappableArray<vec3f> &nor,
+               MappableArray<vec2f> &tex,
+               MappableArray<vec3i> &idx,
+               MappableArray<vec4i> &quads,
+               bool triangulatePolygons = false,
+               const std::string &cacheDir = "");
+
+    /*! same as parse(), but always goes through rply (and never uses
+        the cache); this is the reference implementation the fast
+        path gets checked against */
+    void parseWithRPly(const std::string &fileName,
+                       MappableArray<vec3f> &pos,
+                       MappableArray<vec3f> &nor,
+                       MappableArray<vec2f> &tex,
+                       MappableArray<vec3i> &idx,
+                       MappableArray<vec4i> &quads,
+                       bool triangulatePolygons = false);
+    
+    /*! fast path for ascii PLY files; returns false (with all arrays
+        left empty) if this is not an ascii file, or if it contains
+        anything the fast path cannot handle */
+    bool parseAscii(const std::string &fileName,
+                    MappableArray<vec3f> &pos,
+                    MappableArray<vec3f> &nor,
+                    MappableArray<vec2f> &tex,
+                    MappableArray<vec3i> &idx,
+                    MappableArray<vec4i> &quads,
+                    bool triangulatePolygons = false);
+
+    /*! try to read given ply file's data (as decoded with given
+        'triangulatePolygons') from the given cache directory; returns
+        false if there's no up-to-date blob for this file in the
+        cache. The arrays point into a mapping of the blob */
+    bool readFromCache(const std::string &cacheDir,
+                       const std::string &fileName,
+                       MappableArray<vec3f> &pos,
+                       MappableArray<vec3f> &nor,
+                       MappableArray<vec2f> &tex,
+                       MappableArray<vec3i> &idx,
+                       MappableArray<vec4i> &quads,
+                       bool triangulatePolygons);
+
+    /*! store given ply file's data (as decoded with given
+        'triangulatePolygons') in given cache directory */
+    void writeToCache(const std::string &cacheDir,
+                      const std::string &fileName,
+                      const MappableArray<vec3f> &pos,
+                      const MappableArray<vec3f> &nor,
+                      const MappableArray<vec2f> &tex,
+                      const MappableArray<vec3i> &idx,
+                      const MappableArray<vec4i> &quads,
+                      bool triangulatePolygons);
+  } // ::pbrt::ply
+
+  /*! write given scene to given file through temporary files that
+      then replace the old file (and its shards), so that whatever
+      still reads from the old one - like lazily loaded shapes - can
+      keep doing so (\see BinaryFileFormat.cpp) */
+  size_t rewriteFile(Scene::SP scene, const std::string &fileName,
+                     const SaveOptions &options);
+  
   /*! The class that "semantically" parses a syntactic::Scene into a
       semantic::Scene. In a syntactic scene we know only the
       high-level types of objects (e.g., that something is a array of
@@ -52,14 +136,27 @@ namespace pbrt {
     /*! the _syntatic_ scnee we're parsing (our _input_) */
     PBRTScene::SP pbrtScene;
 
+    /*! the options we're importing with */
+    ImportOptions options;
+
+    /*! all ply files that meshes got read from */
+    std::set<std::string> plyFiles;
+
     /*! constructor that also perfoms all the work - converts the
       input 'pbrtScene' to a naivescenelayout, and assings that to
       'result' */
-    SemanticParser(PBRTScene::SP pbrtScene)
-      : pbrtScene(pbrtScene)
+    SemanticParser(PBRTScene::SP pbrtScene,
+                   const ImportOptions &options = ImportOptions())
+      : pbrtScene(pbrtScene),
+        options(options)
     {
       result        = std::make_shared<Scene>();
+      if (options.instancePlyMeshes) {
+        std::set<pbrt::syntactic::Object::SP> alreadyCounted;
+        countPlyReferences(pbrtScene->world,alreadyCounted);
+      }
       result->world  = findOrEmitObject(pbrtScene->world);
+      finishPlyLoading();
 
       if (!unhandledShapeTypeCounter.empty()) {
         std::cerr << "WARNING: scene contained some un-handled shapes!" << std::endl;
@@ -174,6 +271,83 @@ namespace pbrt {
     /*! emit given shape */
     Shape::SP emitShape(pbrt::syntactic::Shape::SP shape);
 
+    /*! worker pool that reads (and transforms) ply files in the
+        background if options.asyncPlyLoading is on */
+    std::shared_ptr<pbrt::syntactic::TaskPool> plyLoader;
+
+    /*! read given ply file into given mesh, and transform it with
+        the given transform; this happens either right away, or on
+        the plyLoader, depending on options.asyncPlyLoading */
+    void loadPlyMesh(TriangleMesh::SP mesh, const std::string &fileName, const affine3f &xfm);
+
+    /*! wait for all ply files to be loaded, fill in all meshes that
+        share their data with another mesh, and turn meshes whose
+        files contained quads into quad meshes */
+    void finishPlyLoading();
+
+    /*! the quads read for a given (triangle) mesh, if its ply file
+        contained any, and options.plyQuadsAsQuadMesh is on */
+    std::map<TriangleMesh::SP,std::shared_ptr<MappableArray<vec4i>>> plyQuads;
+
+    /*! replace given shapes everywhere they got used in already
+        emitted objects */
+    void replaceShapes(const std::map<Shape::SP,Shape::SP> &replacements);
+
+    // ------------------------------------------------------------------
+    // ply file instancing (if options.instancePlyMeshes is on)
+    // ------------------------------------------------------------------
+    
+    /*! how often - and with which transforms - a given ply file gets
+        referenced throughout the scene */
+    struct PlyFileUsage {
+      size_t   numReferences    { 0 };
+      bool     allSameTransform { true };
+      affine3f firstTransform;
+    };
+    /*! usage of each ply file, by file stamp */
+    std::map<std::string,PlyFileUsage> plyFileUsage;
+    /*! for each ply file name we've seen, the stamp of that file */
+    std::map<std::string,std::string>  plyFileKeys;
+
+    /*! everything that determines whether two references to a ply
+        file can use the same mesh: the file itself, plus everything
+        we'd otherwise store with the shape */
+    typedef std::tuple<std::string,Material::SP,
+                       std::map<std::string,Texture::SP>,
+                       AreaLight::SP,bool> PlyPrototypeKey;
+    /*! the meshes we've created for each distinct ply prototype */
+    std::map<PlyPrototypeKey,TriangleMesh::SP> plyPrototypes;
+    /*! the object that wraps a given (object-space) prototype mesh */
+    std::map<TriangleMesh::SP,Object::SP>      plyPrototypeObjects;
+    /*! the first mesh we've read each given ply file into */
+    std::map<std::string,TriangleMesh::SP>     decodedPlyFiles;
+    /*! meshes that will be copied from another mesh that reads the
+        same file (pairs of destination and source) */
+    std::vector<std::pair<TriangleMesh::SP,TriangleMesh::SP>> plyMeshCopies;
+
+    /*! return the key (ie, file stamp) of the ply file a given
+        'plymesh' shape refers to */
+    std::string getPlyFileKey(pbrt::syntactic::Shape::SP shape);
+    
+    /*! count the references to all ply files in given object, and
+        all objects it instantiates */
+    void countPlyReferences(pbrt::syntactic::Object::SP object,
+                            std::set<pbrt::syntactic::Object::SP> &alreadyCounted);
+
+    /*! find (or create) the mesh that all references to the given
+        shape's ply file (with the same attributes) will share; this
+        mesh will be transformed with the given transform */
+    TriangleMesh::SP findOrCreatePlyPrototype(pbrt::syntactic::Shape::SP shape,
+                                              const affine3f &xfm);
+    
+    /*! emit an instance of the (object space) prototype mesh for the
+        given shape's ply file */
+    Instance::SP emitPlyInstance(pbrt::syntactic::Shape::SP shape);
+    
+    /*! assign those values that are stored with the syntactic shape's
+        attributes (area light, orientation) to our shape */
+    void applyShapeAttributes(Shape::SP ours, pbrt::syntactic::Shape::SP shape);
+    
     /*! @{ type specific extraction routines for very specific shape type */
     Shape::SP emitPlyMesh(pbrt::syntactic::Shape::SP shape);
     Shape::SP emitDisk(pbrt::syntactic::Shape::SP shape);
@@ -192,9 +366,9 @@ namespace pbrt {
     void extractTextures(Shape::SP geom, pbrt::syntactic::Shape::SP shape);
 
     template<typename T>
-    std::vector<T> extractVector(pbrt::syntactic::Shape::SP shape, const std::string &name)
+    MappableArray<T> extractVector(pbrt::syntactic::Shape::SP shape, const std::string &name)
     {
-      std::vector<T> result;
+      MappableArray<T> result;
       typename ParamArray<typename T::scalar_t>::SP param = shape->findParam<typename T::scalar_t>(name);
       if (param) {
 
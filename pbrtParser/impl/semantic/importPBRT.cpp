@@ -16,28 +16,205 @@
 
 #include "pbrtParser/Scene.h"
 #include "../syntactic/Scene.h"
+#include "../syntactic/FileMapping.h"
 #include "SemanticParser.h"
 // std
+#include <cstdio>
+#include <fstream>
+#include <functional>
 #include <map>
 #include <sstream>
+#include <thread>
+#ifdef _WIN32
+# include <direct.h>
+#else
+# include <sys/stat.h>
+# include <sys/types.h>
+#endif
 
 namespace pbrt {
 
+  // ==================================================================
+  // scene cache (\see ImportOptions::cacheScene)
+  // ==================================================================
+
+  /*! first line of every manifest; caches written by versions of
+      the importer that might have imported differently don't count */
+  static const char *manifestHeader = "pbrt-parser scene cache 1";
+
+  /*! a cached .pbf of an imported pbrt file, and the manifest of the
+      files that went into it */
+  struct SceneCache {
+    SceneCache(const std::string &fileName, const ImportOptions &options)
+    {
+      if (options.sceneCacheDirectory.empty())
+        pbfName = fileName+".pbf";
+      else {
+        // one cache for each pbrt file, no matter how it got named
+        std::string path;
+        try {
+          path = syntactic::getFileStamp(fileName).canonicalPath;
+        } catch (std::runtime_error &) {
+          path = fileName;
+        }
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (char c : path) {
+          hash ^= (uint8_t)c;
+          hash *= 0x100000001b3ull;
+        }
+        char hex[17];
+        snprintf(hex,sizeof(hex),"%016llx",(unsigned long long)hash);
+        const size_t pos = fileName.find_last_of("/\\");
+        directory = options.sceneCacheDirectory;
+        pbfName   = directory+"/"+fileName.substr(pos == std::string::npos ? 0 : pos+1)
+          +"."+hex+".pbf";
+      }
+      manifestName = pbfName+".deps";
+
+      std::stringstream ss;
+      ss << "options " << options.instancePlyMeshes << options.plyQuadsAsQuadMesh
+         << options.triangulatePlyPolygons << " " << options.basePath;
+      optionsLine = ss.str();
+    }
+
+    /*! the cached scene, if there is one that none of the files
+        listed in its manifest changed since */
+    Scene::SP load(LoadProgress::SP progress) const
+    {
+      std::ifstream manifest(manifestName);
+      std::string line;
+      if (!std::getline(manifest,line) || line != manifestHeader ||
+          !std::getline(manifest,line) || line != optionsLine)
+        return nullptr;
+      while (std::getline(manifest,line)) {
+        // each line is a file stamp, "<path>|<size>|<mtime>"
+        const size_t mtimePos = line.rfind('|');
+        const size_t sizePos  = (mtimePos == std::string::npos || mtimePos == 0)
+          ? std::string::npos : line.rfind('|',mtimePos-1);
+        if (sizePos == std::string::npos)
+          return nullptr;
+        try {
+          if (syntactic::getFileStamp(line.substr(0,sizePos)).toString() != line)
+            return nullptr;
+        } catch (std::runtime_error &) {
+          // file is gone
+          return nullptr;
+        }
+      }
+      LoadOptions loadOptions;
+      loadOptions.progress = progress;
+      try {
+        return Scene::loadFrom(pbfName,loadOptions);
+      } catch (LoadCancelled &) {
+        throw;
+      } catch (std::runtime_error &) {
+        // missing, truncated, or from a newer version
+        return nullptr;
+      }
+    }
+
+    /*! store given scene, imported from given files. Like the
+        ply cache, this is best effort: if we can't write the cache,
+        there just isn't one */
+    void store(Scene::SP scene, const std::vector<std::string> &dependencies) const
+    {
+      std::stringstream manifest;
+      manifest << manifestHeader << "\n" << optionsLine << "\n";
+      try {
+        for (auto &fileName : dependencies)
+          manifest << syntactic::getFileStamp(fileName).toString() << "\n";
+      } catch (std::runtime_error &) {
+        return;
+      }
+      if (!directory.empty()) {
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(),0755);
+#endif
+      }
+      // write to temporary files first, and rename those once they
+      // are complete, so concurrent imports never see partial ones;
+      // and drop the old manifest first, so nobody pairs that with
+      // the new scene
+      std::stringstream tmpSuffix;
+      tmpSuffix << ".tmp." << std::this_thread::get_id();
+      try {
+        scene->saveTo(pbfName+tmpSuffix.str());
+      } catch (std::runtime_error &) {
+        std::remove((pbfName+tmpSuffix.str()).c_str());
+        return;
+      }
+      std::remove(manifestName.c_str());
+      if (std::rename((pbfName+tmpSuffix.str()).c_str(),pbfName.c_str()) != 0) {
+        std::remove((pbfName+tmpSuffix.str()).c_str());
+        return;
+      }
+      {
+        std::ofstream out(manifestName+tmpSuffix.str());
+        out << manifest.str();
+        if (!out.good()) {
+          out.close();
+          std::remove((manifestName+tmpSuffix.str()).c_str());
+          return;
+        }
+      }
+      std::rename((manifestName+tmpSuffix.str()).c_str(),manifestName.c_str());
+    }
+
+    std::string directory;
+    std::string pbfName;
+    std::string manifestName;
+    /*! the import options that change what a scene imports to */
+    std::string optionsLine;
+  };
+
   Scene::SP importPBRT(const std::string &fileName, const std::string &basePath)
   {
-    pbrt::syntactic::Scene::SP pbrt;
-    if (endsWith(fileName,".pbrt"))
-      pbrt = pbrt::syntactic::Scene::parse(fileName, basePath);
-    else
+    ImportOptions options;
+    options.basePath = basePath;
+    return importPBRT(fileName,options);
+  }
+  
+  Scene::SP importPBRT(const std::string &fileName, const ImportOptions &options)
+  {
+    std::function<void(size_t,size_t)> onProgress;
+    if (options.progress) {
+      LoadProgress::SP progress = options.progress;
+      onProgress = [progress](size_t bytesParsed, size_t filesDone) {
+        progress->bytesConsumed = bytesParsed;
+        progress->filesDone     = filesDone;
+        progress->checkCancelled();
+      };
+    }
+    
+    if (!endsWith(fileName,".pbrt"))
       throw std::runtime_error("could not detect input file format!? (unknown extension in '"+fileName+"')");
-      
-    Scene::SP scene = SemanticParser(pbrt).result;
+
+    std::shared_ptr<SceneCache> cache;
+    if (options.cacheScene) {
+      cache = std::make_shared<SceneCache>(fileName,options);
+      if (Scene::SP cached = cache->load(options.progress))
+        return cached;
+    }
+
+    pbrt::syntactic::Scene::SP pbrt
+      = pbrt::syntactic::Scene::parse(fileName, options.basePath, options.prefetchBudget,
+                                      onProgress);
+    SemanticParser semantic(pbrt,options);
+    Scene::SP scene = semantic.result;
     createFilm(scene,pbrt);
     createSampler(scene,pbrt);
     createIntegrator(scene,pbrt);
     createPixelFilter(scene,pbrt);
     for (auto cam : pbrt->cameras)
       scene->cameras.push_back(createCamera(cam));
+
+    if (cache) {
+      std::vector<std::string> dependencies = pbrt->parsedFiles;
+      dependencies.insert(dependencies.end(),semantic.plyFiles.begin(),semantic.plyFiles.end());
+      cache->store(scene,dependencies);
+    }
     return scene;
   }
 
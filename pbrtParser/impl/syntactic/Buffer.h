@@ -85,6 +85,11 @@ namespace pbrt {
         return name_;
       }
 
+      /*! number of bytes read so far */
+      size_t tell() const { return pos_ - data_.cbegin(); }
+      /*! size of the file */
+      size_t size() const { return data_.size(); }
+
     private:
       std::string name_;
 
@@ -14,9 +14,12 @@
 // limitations under the License.                                           //
 // ======================================================================== //
 
+#include <cstdlib>
 #include <fstream>
 #include <stdexcept>
-#ifndef _WIN32
+#ifdef _WIN32
+#include <sys/stat.h>
+#else
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -35,7 +38,7 @@ namespace pbrt {
     with a given name, and parameters of given names and types */
   namespace syntactic {
 
-    FileMapping::FileMapping(const std::string &fname) : mapping(nullptr), num_bytes(0) {
+    FileMapping::FileMapping(const std::string &fname, bool copyOnWrite) : mapping(nullptr), num_bytes(0) {
 #ifdef _WIN32
 	  file = CreateFileA(fname.c_str(), GENERIC_READ,
 	  		FILE_SHARE_READ, nullptr, OPEN_EXISTING,
@@ -50,13 +53,13 @@ namespace pbrt {
 	  	throw std::runtime_error("Cannot map 0 size file");
 	  }
 
-	  mapping_handle = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	  mapping_handle = CreateFileMapping(file, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
 	  if (mapping_handle == INVALID_HANDLE_VALUE) {
 	  	throw std::runtime_error("Failed to create file mapping for " + fname);
 	  }
 
 	  num_bytes = file_size.QuadPart;
-	  mapping = MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, num_bytes);
+	  mapping = MapViewOfFile(mapping_handle, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, num_bytes);
 	  if (!mapping) {
 	  	throw std::runtime_error("Failed to create mapped view of file " + fname);
 	  }
@@ -72,8 +75,12 @@ namespace pbrt {
 	  fstat(file, &stat_buf);
 	  num_bytes = stat_buf.st_size;
 
-	  mapping = mmap(NULL, num_bytes, PROT_READ, MAP_SHARED, file, 0);
-	  if (!mapping) {
+	  mapping = copyOnWrite
+	    ? mmap(NULL, num_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE, file, 0)
+	    : mmap(NULL, num_bytes, PROT_READ, MAP_SHARED, file, 0);
+	  if (mapping == MAP_FAILED) {
+	  	mapping = nullptr;
+	  	close(file);
 	  	throw std::runtime_error("Failed to map file!");
 	  }
 #endif
@@ -124,6 +131,43 @@ namespace pbrt {
 
 	  return *this;
     }
+    std::string FileStamp::toString() const
+    {
+      return canonicalPath+"|"+std::to_string(size)+"|"+std::to_string(mtime);
+    }
+    
+    FileStamp getFileStamp(const std::string &fname)
+    {
+      FileStamp stamp;
+#ifdef _WIN32
+      char fullPath[_MAX_PATH];
+      if (!_fullpath(fullPath,fname.c_str(),_MAX_PATH))
+        throw std::runtime_error("could not resolve path of file " + fname);
+      struct _stat64 stat_buf;
+      if (_stat64(fullPath,&stat_buf) != 0)
+        throw std::runtime_error("could not stat file " + fname);
+      stamp.canonicalPath = fullPath;
+      stamp.size  = stat_buf.st_size;
+      stamp.mtime = int64_t(stat_buf.st_mtime)*1000000000ll;
+#else
+      char *fullPath = realpath(fname.c_str(),nullptr);
+      if (!fullPath)
+        throw std::runtime_error("could not resolve path of file " + fname);
+      stamp.canonicalPath = fullPath;
+      free(fullPath);
+      struct stat stat_buf;
+      if (stat(stamp.canonicalPath.c_str(),&stat_buf) != 0)
+        throw std::runtime_error("could not stat file " + fname);
+      stamp.size  = stat_buf.st_size;
+# ifdef __APPLE__
+      stamp.mtime = int64_t(stat_buf.st_mtimespec.tv_sec)*1000000000ll + stat_buf.st_mtimespec.tv_nsec;
+# else
+      stamp.mtime = int64_t(stat_buf.st_mtim.tv_sec)*1000000000ll + stat_buf.st_mtim.tv_nsec;
+# endif
+#endif
+      return stamp;
+    }
+    
     const uint8_t* FileMapping::data() const {
       return static_cast<uint8_t*>(mapping);
     }
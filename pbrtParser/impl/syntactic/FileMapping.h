@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 #ifdef _WIN32
@@ -43,8 +44,11 @@ namespace pbrt {
 #endif
 
     public:
-      // Map the file into memory
-      FileMapping(const std::string &fname);
+      /*! Map the file into memory. A copy-on-write mapping can be
+          written to (through a const_cast of data()); such writes
+          stay private to this process, and never make it back into
+          the file */
+      FileMapping(const std::string &fname, bool copyOnWrite = false);
       FileMapping(FileMapping &&fm);
       ~FileMapping();
       FileMapping& operator=(FileMapping &&fm);
@@ -56,6 +60,27 @@ namespace pbrt {
       size_t nbytes() const;
     };
 
+    /*! identifies a given version of a file on disk: two stamps are
+        the same only if they refer to the same (canonical) path, and
+        the file's size and modification time haven't changed. We use
+        this to decide whether anything we derived from a file (and
+        cached) is still valid */
+    struct FileStamp {
+      std::string canonicalPath;
+      uint64_t    size  = 0;
+      /*! modification time, in nanoseconds since the epoch */
+      int64_t     mtime = 0;
+
+      /*! string representation, usable as a key */
+      std::string toString() const;
+      bool operator==(const FileStamp &other) const
+      { return canonicalPath == other.canonicalPath && size == other.size && mtime == other.mtime; }
+      bool operator!=(const FileStamp &other) const { return !(*this == other); }
+    };
+
+    /*! compute the stamp of given file; throws if the file does not exist */
+    FileStamp getFileStamp(const std::string &fname);
+    
     template<typename T>
     class BasicStringView {
       const T *ptr;
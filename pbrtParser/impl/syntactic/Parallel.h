@@ -0,0 +1,189 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  namespace syntactic {
+
+    /*! flag that tells whether the calling thread is already one of
+        our worker threads; we use this to make nested parallel loops
+        run serially, rather than spawning ever more threads */
+    inline bool &insideParallelWorker()
+    {
+      static thread_local bool inside = false;
+      return inside;
+    }
+
+    /*! number of threads we'll use for parallel loops */
+    inline size_t getNumParallelThreads()
+    {
+      if (insideParallelWorker()) return 1;
+      const size_t numHWThreads = std::thread::hardware_concurrency();
+      return std::max(size_t(1),numHWThreads);
+    }
+
+    /*! execute 'body(begin,end)' for all blocks of (at most)
+        'blockSize' items in [0,numItems), in parallel. the first
+        exception thrown by any block gets re-thrown on the calling
+        thread, after all threads have terminated */
+    template<typename Lambda>
+    void parallel_for_blocked(size_t numItems, size_t blockSize, const Lambda &body)
+    {
+      if (numItems == 0) return;
+      blockSize = std::max(size_t(1),blockSize);
+      const size_t numBlocks = (numItems+blockSize-1)/blockSize;
+      const size_t numThreads = std::min(numBlocks,getNumParallelThreads());
+      if (numThreads <= 1) {
+        for (size_t begin=0;begin<numItems;begin+=blockSize)
+          body(begin,std::min(numItems,begin+blockSize));
+        return;
+      }
+
+      std::atomic<size_t> nextBlock(0);
+      std::exception_ptr  firstException;
+      std::mutex          exceptionMutex;
+      auto worker = [&]() {
+        insideParallelWorker() = true;
+        while (true) {
+          const size_t blockID = nextBlock++;
+          if (blockID >= numBlocks) break;
+          const size_t begin = blockID*blockSize;
+          try {
+            body(begin,std::min(numItems,begin+blockSize));
+          } catch (...) {
+            std::lock_guard<std::mutex> lock(exceptionMutex);
+            if (!firstException) firstException = std::current_exception();
+            nextBlock = numBlocks;
+          }
+        }
+        insideParallelWorker() = false;
+      };
+      std::vector<std::thread> threads;
+      for (size_t i=1;i<numThreads;i++)
+        threads.push_back(std::thread(worker));
+      worker();
+      for (auto &t : threads) t.join();
+      if (firstException)
+        std::rethrow_exception(firstException);
+    }
+
+    /*! execute 'body(i)' for all i in [0,numItems), in parallel */
+    template<typename Lambda>
+    void parallel_for(size_t numItems, const Lambda &body)
+    {
+      parallel_for_blocked(numItems,1,[&](size_t begin, size_t end) {
+          for (size_t i=begin;i<end;i++) body(i);
+        });
+    }
+
+    /*! a simple pool of worker threads that executes scheduled tasks
+        (in the order they got scheduled) in the background. wait()
+        blocks until all tasks scheduled so far are done, and
+        re-throws the first exception any of those tasks threw */
+    class TaskPool {
+    public:
+      TaskPool(size_t numThreads = getNumParallelThreads())
+      {
+        for (size_t i=0;i<std::max(size_t(1),numThreads);i++)
+          threads.push_back(std::thread([this](){ workerLoop(); }));
+      }
+      
+      ~TaskPool()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          shutdown = true;
+        }
+        taskAvailable.notify_all();
+        for (auto &t : threads) t.join();
+      }
+      
+      TaskPool(const TaskPool &) = delete;
+      TaskPool &operator=(const TaskPool &) = delete;
+
+      /*! schedule given task for background execution */
+      void schedule(const std::function<void()> &task)
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          tasks.push_back(task);
+          ++numPending;
+        }
+        taskAvailable.notify_one();
+      }
+
+      /*! wait for all scheduled tasks to finish */
+      void wait()
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        allDone.wait(lock,[this](){ return numPending == 0; });
+        if (firstException) {
+          std::exception_ptr e = firstException;
+          firstException = nullptr;
+          std::rethrow_exception(e);
+        }
+      }
+      
+    private:
+      void workerLoop()
+      {
+        insideParallelWorker() = true;
+        while (true) {
+          std::function<void()> task;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            taskAvailable.wait(lock,[this](){ return shutdown || !tasks.empty(); });
+            if (tasks.empty()) break;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+          }
+          std::exception_ptr exception;
+          try {
+            task();
+          } catch (...) {
+            exception = std::current_exception();
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          if (exception && !firstException) firstException = exception;
+          if (--numPending == 0) allDone.notify_all();
+        }
+      }
+      
+      std::vector<std::thread>          threads;
+      std::deque<std::function<void()>> tasks;
+      std::mutex                        mutex;
+      std::condition_variable           taskAvailable;
+      std::condition_variable           allDone;
+      size_t                            numPending = 0;
+      bool                              shutdown   = false;
+      std::exception_ptr                firstException;
+    };
+    
+  } // ::syntactic
+} // ::pbrt
@@ -23,6 +23,7 @@
 
 #include "Scene.h"
 #include "Lexer.h"
+#include "Prefetch.h"
 // std
 #include <stack>
 
@@ -61,8 +62,9 @@ namespace pbrt {
       mess with the state of later pbrt file parse's */
     template <typename DataSource>
     struct BasicParser {
-      /*! constructor */
-      BasicParser(const std::string &basePath="");
+      /*! constructor; a non-zero prefetchBudget enables read-ahead
+          of up to that many bytes of included/referenced files */
+      BasicParser(const std::string &basePath="", size_t prefetchBudget=0);
 
       /*! parse given file, and add it to the scene we hold */
       void parse(const std::string &fn);
@@ -99,6 +101,15 @@ namespace pbrt {
       /*! return the scene we have parsed */
       std::shared_ptr<Scene> getScene() { return scene; }
       std::shared_ptr<Texture> getTexture(const std::string &name);
+
+      /*! if set, stop parsing once we get to 'WorldBegin', so the
+          scene will only contain camera, film, sampler, etc */
+      bool stopAtWorldBegin = false;
+      /*! if set, gets called with the number of bytes parsed so far
+          and the number of files parsed completely, at every
+          directive and whenever we start or finish a file; throwing
+          from it aborts the parse */
+      std::function<void(size_t bytesParsed, size_t filesDone)> onProgress;
     private:
       typedef BasicLexer<DataSource> Lexer;
 
@@ -109,6 +120,16 @@ namespace pbrt {
       //! token stream of currently open file
       std::shared_ptr<Lexer> tokens;
 
+      /*! the files we're in the middle of (the root file first), and
+          what we've parsed of those we're done with (\see onProgress) */
+      std::vector<std::shared_ptr<MappedFile>> openFiles;
+      size_t bytesOfFilesDone = 0;
+      size_t numFilesDone     = 0;
+      /*! call onProgress, if set */
+      void reportProgress();
+      /*! we've gotten to the end of the innermost open file */
+      void finishFile();
+
       //! Do _NOT_ replace tokens!
       template <typename OtherSource>
       bool replace_tokens(std::shared_ptr<BasicLexer<OtherSource>>) { return false; }
@@ -148,6 +169,10 @@ namespace pbrt {
       // emit debug status messages...
       const std::string basePath;
       std::string rootNamePath;
+      const size_t prefetchBudget;
+      /*! reads ahead the files we're going to include (only alive
+          while parsing a file) */
+      std::shared_ptr<Prefetcher> prefetcher;
       std::shared_ptr<Scene>      scene;
       std::shared_ptr<Attributes> currentGraphicsState;
       std::shared_ptr<Object>     currentObject;
@@ -252,8 +252,9 @@ namespace pbrt {
     }
 
     template <typename DS>
-    BasicParser<DS>::BasicParser(const std::string &basePath) 
+    BasicParser<DS>::BasicParser(const std::string &basePath, size_t prefetchBudget) 
       : basePath(basePath)
+      , prefetchBudget(prefetchBudget)
       , scene(std::make_shared<Scene>())
       , currentGraphicsState(std::make_shared<Attributes>())
       , dbg(false)
@@ -404,6 +405,7 @@ namespace pbrt {
     {
       if (dbg) std::cout << "Parsing PBRT World" << std::endl;
       while (1) {
+        reportProgress();
         Token token = next();
         assert(token);
         if (dbg) std::cout << "World token : " << token.toString() << std::endl;
@@ -687,6 +689,9 @@ namespace pbrt {
           FileType::SP file = std::make_shared<FileType>(includedFileName);
           if (!replace_tokens(std::make_shared<BasicLexer<FileType>>(file)))
             throw std::runtime_error("incompatible lexers ...");
+          openFiles.push_back(file);
+          scene->parsedFiles.push_back(includedFileName);
+          reportProgress();
           continue;
         }
       
@@ -697,6 +702,7 @@ namespace pbrt {
       
         // last token was invalid, so encountered at least one end of
         // file - see if we can pop back to another one off the stack
+        finishFile();
         if (tokenizerStack.empty())
           // nothing to back off to, return eof indicator
           return Token();
@@ -709,10 +715,32 @@ namespace pbrt {
       return peekQueue[i];
     }
     
+    template <typename DS>
+    void BasicParser<DS>::reportProgress()
+    {
+      if (!onProgress) return;
+      size_t bytesParsed = bytesOfFilesDone;
+      for (auto &file : openFiles)
+        bytesParsed += file->tell();
+      onProgress(bytesParsed,numFilesDone);
+    }
+
+    template <typename DS>
+    void BasicParser<DS>::finishFile()
+    {
+      // (we may get here more than once at the end of the root file)
+      if (openFiles.empty()) return;
+      bytesOfFilesDone += openFiles.back()->size();
+      numFilesDone++;
+      openFiles.pop_back();
+      reportProgress();
+    }
+
     template <typename DS>
     void BasicParser<DS>::parseScene()
     {
       while (peek()) {
+        reportProgress();
       
         Token token = next();
         if (!token) break;
@@ -828,6 +856,7 @@ namespace pbrt {
         }
 
         if (token == "WorldBegin") {
+          if (stopAtWorldBegin) return;
           ctm.reset();
           parseWorld();
           continue;
@@ -907,10 +936,18 @@ namespace pbrt {
         = basePath==""
         ? (std::string)pathOf(fn)
         : (std::string)basePath;
+      if (prefetchBudget > 0) {
+        prefetcher = std::make_shared<Prefetcher>(prefetchBudget);
+        prefetcher->scan(fn,rootNamePath);
+      }
       FileType::SP file = std::make_shared<FileType>(fn);
       this->tokens = std::make_shared<BasicLexer<FileType>>(file);
+      openFiles.push_back(file);
+      scene->parsedFiles.push_back(fn);
       parseScene();
       scene->basePath = rootNamePath;
+      // stops whatever scanning is still going on
+      prefetcher = nullptr;
     }
 
     
@@ -0,0 +1,200 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#include "Prefetch.h"
+#include "FileMapping.h"
+// std
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#ifndef _WIN32
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <sys/types.h>
+# include <unistd.h>
+#endif
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  namespace syntactic {
+
+    Prefetcher::Prefetcher(size_t byteBudget, size_t numIOThreads)
+      : byteBudget(byteBudget),
+        cancelled(false),
+        ioThreads(numIOThreads)
+    {}
+
+    Prefetcher::~Prefetcher()
+    {
+      // all scans that are still queued will see this flag, and
+      // return right away
+      cancelled = true;
+    }
+
+    size_t Prefetcher::getNumBytesRequested()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return bytesRequested;
+    }
+
+    void Prefetcher::wait()
+    {
+      ioThreads.wait();
+    }
+
+    bool Prefetcher::reserve(const std::string &canonicalPath, size_t numBytes)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (alreadySeen.find(canonicalPath) != alreadySeen.end())
+        return false;
+      alreadySeen.insert(canonicalPath);
+      if (bytesRequested + numBytes > byteBudget)
+        return false;
+      bytesRequested += numBytes;
+      return true;
+    }
+
+    void Prefetcher::scan(const std::string &fileName, const std::string &basePath)
+    {
+      scheduleScan(fileName,basePath,/*isRoot*/true);
+    }
+
+    void Prefetcher::scheduleScan(const std::string &fileName, const std::string &basePath,
+                                  bool isRoot)
+    {
+      ioThreads.schedule([this,fileName,basePath,isRoot]() {
+          if (!cancelled) scanNow(fileName,basePath,isRoot);
+        });
+    }
+
+    inline bool endsWith(const std::string &s, const std::string &suffix)
+    {
+      return s.size() >= suffix.size()
+        && s.compare(s.size()-suffix.size(),suffix.size(),suffix) == 0;
+    }
+
+    /*! the part of a pbrt file we care about when scanning for file
+        names - we only need to tell strings and 'Include' keywords
+        apart from everything else */
+    struct ScanToken {
+      enum { OTHER, STRING, INCLUDE } type;
+      std::string text;
+    };
+
+    void Prefetcher::scanNow(const std::string &fileName, const std::string &basePath,
+                             bool isRoot)
+    {
+      std::shared_ptr<FileMapping> file;
+      try {
+        const FileStamp stamp = getFileStamp(fileName);
+        // (the parser reads the root file anyway, no matter what our
+        // budget is)
+        if (!reserve(stamp.canonicalPath,isRoot ? 0 : stamp.size)) return;
+        file = std::make_shared<FileMapping>(fileName);
+      } catch (std::runtime_error &) {
+        // let the parser complain about that file
+        return;
+      }
+
+      const char *p   = (const char *)file->data();
+      const char *end = p + file->nbytes();
+      ScanToken last, current;
+      last.type = ScanToken::OTHER;
+      while (p < end && !cancelled) {
+        // skip whitespace, brackets, and comments
+        const char c = *p;
+        if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '[' || c == ']') {
+          ++p; continue;
+        }
+        if (c == '#') {
+          const char *eol = (const char *)memchr(p,'\n',end-p);
+          p = eol ? eol : end;
+          continue;
+        }
+
+        if (c == '"') {
+          const char *close = (const char *)memchr(p+1,'"',end-p-1);
+          if (!close) break;
+          current.type = ScanToken::STRING;
+          current.text = std::string(p+1,close);
+          p = close+1;
+        } else {
+          const char *wordBegin = p;
+          while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r'
+                 && *p != '"' && *p != '[' && *p != ']' && *p != '#')
+            ++p;
+          current.type
+            = (p-wordBegin == 7 && !memcmp(wordBegin,"Include",7))
+            ? ScanToken::INCLUDE
+            : ScanToken::OTHER;
+          current.text.clear();
+        }
+
+        if (current.type == ScanToken::STRING && !current.text.empty()) {
+          const std::string resolved
+            = (current.text[0] == '/') ? current.text : basePath + "/" + current.text;
+          if (last.type == ScanToken::INCLUDE) {
+            // included pbrt file: scan that one, too
+            scheduleScan(resolved,basePath,false);
+          } else if (last.type == ScanToken::STRING) {
+            // parameter name + value: only care about '"string filename" "..."'
+            std::stringstream declaration(last.text);
+            std::string type, name;
+            declaration >> type >> name;
+            if (type == "string" && name == "filename") {
+              if (endsWith(current.text,".pbrt"))
+                scheduleScan(resolved,basePath,false);
+              else
+                // (read-ahead hints are cheap, so we issue those even
+                // if the parser is done by the time we get to them)
+                ioThreads.schedule([this,resolved]() { prefetchNow(resolved); });
+            }
+          }
+        }
+        last = current;
+      }
+    }
+
+    void Prefetcher::prefetchNow(const std::string &fileName)
+    {
+      FileStamp stamp;
+      try {
+        stamp = getFileStamp(fileName);
+      } catch (std::runtime_error &) {
+        // let the ply loader (or whoever) complain about that file
+        return;
+      }
+      if (!reserve(stamp.canonicalPath,stamp.size)) return;
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+      int fd = open(fileName.c_str(),O_RDONLY);
+      if (fd < 0) return;
+      // have the kernel read the file ahead (asynchronously)
+      posix_fadvise(fd,0,stamp.size,POSIX_FADV_WILLNEED);
+      close(fd);
+#else
+      // no read-ahead hints on this platform - read the file
+      // ourselves, in the background, to get it into the cache
+      std::ifstream in(fileName,std::ios::binary);
+      if (!in.good()) return;
+      std::vector<char> buffer(1<<20);
+      while (!cancelled && in.read(buffer.data(),buffer.size()))
+        ;
+#endif
+    }
+
+  } // ::syntactic
+} // ::pbrt
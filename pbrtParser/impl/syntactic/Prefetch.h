@@ -0,0 +1,79 @@
+// ======================================================================== //
+// Copyright 2015-2020 Ingo Wald                                            //
+//                                                                          //
+// Licensed under the Apache License, Version 2.0 (the "License");          //
+// you may not use this file except in compliance with the License.         //
+// You may obtain a copy of the License at                                  //
+//                                                                          //
+//     http://www.apache.org/licenses/LICENSE-2.0                           //
+//                                                                          //
+// Unless required by applicable law or agreed to in writing, software      //
+// distributed under the License is distributed on an "AS IS" BASIS,        //
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. //
+// See the License for the specific language governing permissions and      //
+// limitations under the License.                                           //
+// ======================================================================== //
+
+#pragma once
+
+#include "Parallel.h"
+// std
+#include <set>
+#include <string>
+
+/*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
+namespace pbrt {
+  namespace syntactic {
+
+    /*! Read-ahead for the files a scene is going to need: the parser
+        only learns about an included file (or a ply file) once it
+        gets to the respective statement, and then blocks on reading
+        it. The prefetcher instead pre-scans each pbrt file (in the
+        background) for 'Include' statements and "string filename"
+        parameters, and tells the OS to read those files ahead (or,
+        where that isn't possible, reads them in the background
+        itself), so that by the time the parser - or the ply loader -
+        gets to those files they're already in the page cache. Included
+        pbrt files get scanned recursively. Stops issuing new reads
+        once the given number of bytes has been requested (not
+        counting the root file, which the parser reads anyway) */
+    class Prefetcher {
+    public:
+      Prefetcher(size_t byteBudget, size_t numIOThreads = 4);
+      /*! stops all scanning that's still going on */
+      ~Prefetcher();
+
+      /*! (asynchronously) scan given pbrt file, and prefetch all
+          files referenced by it; relative file names get resolved
+          against 'basePath' */
+      void scan(const std::string &fileName, const std::string &basePath);
+
+      /*! wait until all scans and reads issued so far are done */
+      void wait();
+
+      /*! number of bytes we've requested so far */
+      size_t getNumBytesRequested();
+
+    private:
+      void scheduleScan(const std::string &fileName, const std::string &basePath,
+                        bool isRoot);
+      void scanNow(const std::string &fileName, const std::string &basePath,
+                   bool isRoot);
+      void prefetchNow(const std::string &fileName);
+      /*! mark the given file (by its canonical path) as seen, and
+          reserve the given number of bytes for it; returns false if
+          we've already seen it, or if this would exceed our budget */
+      bool reserve(const std::string &canonicalPath, size_t numBytes);
+
+      const size_t          byteBudget;
+      size_t                bytesRequested { 0 };
+      std::set<std::string> alreadySeen;
+      std::mutex            mutex;
+      std::atomic<bool>     cancelled;
+      /*! declared last, so it's the first to go, and all its workers
+          are done before the above members get destroyed */
+      TaskPool              ioThreads;
+    };
+
+  } // ::syntactic
+} // ::pbrt
@@ -36,9 +36,22 @@ namespace pbrt {
   namespace syntactic {
   
     /*! parse the given file name, return parsed scene */
-    std::shared_ptr<Scene> Scene::parse(const std::string &fileName, const std::string &basePath)
+    std::shared_ptr<Scene> Scene::parse(const std::string &fileName,
+                                        const std::string &basePath,
+                                        size_t prefetchBudget,
+                                        const std::function<void(size_t,size_t)> &onProgress)
+    {
+      std::shared_ptr<Parser> parser = std::make_shared<Parser>(basePath,prefetchBudget);
+      parser->onProgress = onProgress;
+      parser->parse(fileName);
+      return parser->getScene();
+    }
+
+    std::shared_ptr<Scene> Scene::parseHeader(const std::string &fileName,
+                                              const std::string &basePath)
     {
       std::shared_ptr<Parser> parser = std::make_shared<Parser>(basePath);
+      parser->stopAtWorldBegin = true;
       parser->parse(fileName);
       return parser->getScene();
     }
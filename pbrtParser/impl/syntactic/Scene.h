@@ -22,6 +22,7 @@
 #include "pbrtParser/math.h"
 
 // stl
+#include <functional>
 #include <map>
 #include <vector>
 #include <stack>
@@ -695,8 +696,20 @@ namespace pbrt {
         world = nullptr;
       }
       
-      /*! parse the given file name, return parsed scene */
-      static std::shared_ptr<Scene> parse(const std::string &fileName, const std::string &basePath = "");
+      /*! parse the given file name, return parsed scene. if
+          prefetchBudget is non-zero, up to that many bytes of
+          included and referenced files get read ahead in the
+          background (\see Prefetcher). if given, 'onProgress' gets
+          called every so often (\see BasicParser::onProgress) */
+      static std::shared_ptr<Scene> parse(const std::string &fileName,
+                                          const std::string &basePath = "",
+                                          size_t prefetchBudget = 0,
+                                          const std::function<void(size_t,size_t)> &onProgress
+                                          = nullptr);
+      /*! parse only the part of the given file (and the files it
+          includes) that comes before 'WorldBegin' */
+      static std::shared_ptr<Scene> parseHeader(const std::string &fileName,
+                                                const std::string &basePath = "");
       
     
       //! pretty-print scene info into a std::string 
@@ -743,6 +756,11 @@ namespace pbrt {
         first file we parsed (ie, the "entry point" into the entire
         scene */
       std::string basePath;
+
+      /*! all pbrt files that went into this scene: the one we
+          parsed, and every file that one (directly or indirectly)
+          included */
+      std::vector<std::string> parsedFiles;
     };
 
     template<typename T> std::shared_ptr<ParamArray<T>> Param::as()
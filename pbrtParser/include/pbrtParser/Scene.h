@@ -22,7 +22,10 @@
 
 #include "pbrtParser/math.h"
 // std
+#include <atomic>
+#include <future>
 #include <istream>
+#include <stdexcept>
 #include <ostream>
 #include <map>
 #include <vector>
@@ -30,6 +33,8 @@
 #include <memory>
 #include <assert.h>
 #include <mutex>
+#include <type_traits>
+#include <utility>
 
 /*! namespace for all things pbrt parser, both syntactical *and* semantical parser */
 namespace pbrt {
@@ -64,8 +69,103 @@ namespace pbrt {
   /*! internal class used for serializing a scene graph to/from disk */
   struct BinaryReader;
 
+  /*! internal class that decodes a lazily loaded shape (\see
+      LoadOptions::lazyShapes) */
+  struct LazyShapeLoader;
+
   struct Object;
 
+  /*! allocator for the (potentially huge) per-shape arrays: by
+      default it behaves exactly like std::allocator; but it can also
+      be told to hand out an existing block of memory - such as a
+      range of a memory-mapped file - for the first allocation of
+      exactly the right size, which it then leaves uninitialized
+      rather than value-initializing it. This is what allows \see
+      Scene::mapFrom() to have a shape's arrays point straight into
+      the mapped file; 'keepAlive' is whatever owns that memory, and
+      gets released once the array lets go of it (ie, when it gets
+      destroyed, or reallocated to a different size) */
+  template<typename T>
+  struct ArrayAllocator {
+    typedef T value_type;
+    typedef std::true_type  propagate_on_container_move_assignment;
+    typedef std::true_type  propagate_on_container_swap;
+    typedef std::false_type propagate_on_container_copy_assignment;
+
+    ArrayAllocator() = default;
+    ArrayAllocator(T *external, size_t numExternal, std::shared_ptr<void> keepAlive)
+      : external(external), numExternal(numExternal),
+        externalPending(true), keepAlive(keepAlive)
+    {}
+    /*! rebinding never takes over the external memory */
+    template<typename U>
+    ArrayAllocator(const ArrayAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+      if (externalPending && n == numExternal) {
+        externalPending = false;
+        return external;
+      }
+      return static_cast<T*>(::operator new(n*sizeof(T)));
+    }
+    void deallocate(T *ptr, size_t)
+    {
+      if (ptr && ptr == external) {
+        external    = nullptr;
+        numExternal = 0;
+        keepAlive.reset();
+      } else
+        ::operator delete(ptr);
+    }
+
+    template<typename U, typename... Args>
+    void construct(U *ptr, Args&&... args)
+    { ::new((void*)ptr) U(std::forward<Args>(args)...); }
+    /*! value-initialization - except for external memory, which
+        already holds the values we want */
+    template<typename U>
+    void construct(U *ptr)
+    { if (!isExternal(ptr)) ::new((void*)ptr) U(); }
+
+    /*! copies of an array always live on the heap */
+    ArrayAllocator select_on_container_copy_construction() const
+    { return ArrayAllocator(); }
+
+    /*! whether given address lies in the external memory block */
+    bool isExternal(const void *ptr) const
+    {
+      return external
+        && (const T*)ptr >= external
+        && (const T*)ptr <  external+numExternal;
+    }
+
+    /*! all our allocators can free each other's heap memory, and
+        external memory always travels with the allocator that owns
+        it (see the propagate_* typedefs) */
+    template<typename U>
+    bool operator==(const ArrayAllocator<U> &) const { return true; }
+    template<typename U>
+    bool operator!=(const ArrayAllocator<U> &) const { return false; }
+
+    T                    *external        { nullptr };
+    size_t                numExternal     { 0 };
+    bool                  externalPending { false };
+    std::shared_ptr<void> keepAlive;
+  };
+
+  /*! the type of the shapes' vertex, normal, index, etc arrays:
+      std::vectors in every respect, except that they can also point
+      into a memory-mapped file (\see ArrayAllocator). Note that with
+      the allocator, this is a different type than std::vector<T>
+      (this changed in version 3.0): code that needs a
+      std::vector<T> has to copy, e.g., with
+      std::vector<T>(array.begin(),array.end()), and code that only
+      reads the array can take a pointer and size, or a
+      MappableArray<T> */
+  template<typename T>
+  using MappableArray = std::vector<T,ArrayAllocator<T>>;
+
   /*! base abstraction for any entity in the pbrt scene graph that's
     not a paramter type (eg, it's a shape/shape, a object, a
     instance, matierla, tetxture, etc */
@@ -754,6 +854,52 @@ namespace pbrt {
     virtual box3f getBounds() = 0;
     virtual box3f getPrimBounds(const size_t primID, const affine3f &xfm) = 0;
     virtual box3f getPrimBounds(const size_t primID);
+
+    /*! for scenes loaded with LoadOptions::lazyShapes, a shape's
+        data (arrays, transform, etc - but not its material,
+        textures, or area light) only gets decoded on demand:
+        call this before accessing any of the shape's members.
+        getNumPrims(), getBounds(), and getPrimBounds() do that on
+        their own (and pin the shape while they use its data, \see
+        pin()). It is safe to call this from multiple threads, and
+        does nothing for shapes that are already loaded */
+    void ensureLoaded() const;
+    /*! whether the shape's data has been decoded (always true except
+        for lazily loaded shapes) */
+    bool isLoaded() const;
+
+    /*! for scenes loaded with LoadOptions::residentBudget, a shape's
+        data can get evicted again whenever some other shape gets
+        loaded: pin() loads the shape's data (if required), and makes
+        sure it stays loaded until the matching unpin(). Pins nest,
+        and it's safe to pin and unpin from multiple threads. Code
+        that accesses a shape's members while other threads might be
+        loading other shapes has to pin that shape. For all other
+        shapes, pin() is the same as ensureLoaded(), and unpin() does
+        nothing */
+    void pin() const;
+    void unpin() const;
+
+    /*! keeps given shape pinned for as long as it lives */
+    struct Pin {
+      Pin(const Shape *shape) : shape(shape) { shape->pin(); }
+      ~Pin() { shape->unpin(); }
+      Pin(const Pin &) = delete;
+      Pin &operator=(const Pin &) = delete;
+      const Shape *shape;
+    };
+
+    /*! decodes the shape's data on first access - only set for
+        lazily loaded shapes */
+    std::shared_ptr<LazyShapeLoader> lazyLoader;
+
+    /*! for lazily loaded shapes: bounds and number of primitives as
+        they were when the file got written, so that getBounds() and
+        getNumPrims() can answer without loading the shape's data.
+        Clear haveStoredInfo when changing the shape's geometry */
+    bool   haveStoredInfo { false };
+    box3f  storedBounds;
+    size_t storedNumPrims { 0 };
       
     /*! the pbrt material assigned to the underlying shape */
     Material::SP material;
@@ -779,6 +925,34 @@ namespace pbrt {
     AreaLight::SP                     areaLight;
   };
 
+  /*! alternative, more compact, representation of a mesh's indices,
+      with only as many bytes per index (1, 2, or 4) as the mesh
+      needs (\see LoadOptions::compactIndices) */
+  struct CompactIndices {
+    /*! number of indices (not of triangles or quads) */
+    size_t size() const { return width ? data.size()/width : 0; }
+    bool   empty() const { return data.empty(); }
+    
+    /*! the i'th index, widened to int */
+    int operator[](size_t i) const
+    {
+      switch (width) {
+      case 1: return data[i];
+      case 2: return int(data[2*i]) | (int(data[2*i+1]) << 8);
+      default: return (int)(uint32_t(data[4*i])          | (uint32_t(data[4*i+1]) << 8)
+                            | (uint32_t(data[4*i+2]) << 16) | (uint32_t(data[4*i+3]) << 24));
+      }
+    }
+
+    /*! store given indices, with as few bytes per index as possible */
+    void setFrom(const int *indices, size_t numIndices);
+    
+    /*! bytes per index - 1, 2, or 4 */
+    uint8_t              width = 0;
+    /*! all indices, back to back, 'width' bytes each (little endian) */
+    std::vector<uint8_t> data;
+  };
+
   /*! a plain triangle mesh, with vec3f vertex and normal arrays, and
     vec3i indices for triangle vertex indices. normal and texture
     arrays may be empty, but if they exist, will use the same vertex
@@ -800,21 +974,39 @@ namespace pbrt {
     
     virtual size_t getNumPrims() const override
     {
-      return index.size();
+      if (haveStoredInfo) return storedNumPrims;
+      Pin pin(this);
+      return compactIndex.empty() ? index.size() : compactIndex.size()/3;
     }
     virtual box3f getPrimBounds(const size_t primID, const affine3f &xfm) override;
     virtual box3f getPrimBounds(const size_t primID) override;
     
     virtual box3f getBounds() override;
 
-    std::vector<vec3f> vertex;
-    std::vector<vec3f> normal;
-    std::vector<vec2f> texcoord;
-    std::vector<vec3i> index;
+    /*! the vertex indices of given triangle - no matter whether
+        they're stored in 'index' or in 'compactIndex' */
+    vec3i getIndex(size_t primID) const
+    {
+      if (compactIndex.empty()) return index[primID];
+      return vec3i(compactIndex[3*primID+0],compactIndex[3*primID+1],compactIndex[3*primID+2]);
+    }
+    
+    /*! move the indices from 'compactIndex' into 'index' (if they
+        aren't there already) */
+    void expandIndices();
+
+    MappableArray<vec3f> vertex;
+    MappableArray<vec3f> normal;
+    MappableArray<vec2f> texcoord;
+    MappableArray<vec3i> index;
+    /*! for meshes loaded with LoadOptions::compactIndices, this
+        holds the indices (three per triangle), and 'index' is
+        empty */
+    CompactIndices       compactIndex;
     /*! mutex to lock anything within this object that might get
       changed by multiple threads (eg, computing bbox */
     std::mutex         mutex;
-    bool  haveComputedBounds { false };
+    std::atomic<bool> haveComputedBounds { false };
     box3f bounds;
   };
 
@@ -850,20 +1042,38 @@ namespace pbrt {
     
     virtual size_t getNumPrims() const override
     {
-      return index.size();
+      if (haveStoredInfo) return storedNumPrims;
+      Pin pin(this);
+      return compactIndex.empty() ? index.size() : compactIndex.size()/4;
     }
     virtual box3f getPrimBounds(const size_t primID, const affine3f &xfm) override;
     virtual box3f getPrimBounds(const size_t primID) override;
     virtual box3f getBounds() override;
 
-    std::vector<vec3f> vertex;
-    std::vector<vec3f> normal;
-    // std::vector<vec2f> texcoord;
-    std::vector<vec4i> index;
+    /*! the vertex indices of given quad - no matter whether they're
+        stored in 'index' or in 'compactIndex' */
+    vec4i getIndex(size_t primID) const
+    {
+      if (compactIndex.empty()) return index[primID];
+      return vec4i(compactIndex[4*primID+0],compactIndex[4*primID+1],
+                   compactIndex[4*primID+2],compactIndex[4*primID+3]);
+    }
+    
+    /*! move the indices from 'compactIndex' into 'index' (if they
+        aren't there already) */
+    void expandIndices();
+
+    MappableArray<vec3f> vertex;
+    MappableArray<vec3f> normal;
+    MappableArray<vec2f> texcoord;
+    MappableArray<vec4i> index;
+    /*! for meshes loaded with LoadOptions::compactIndices, this
+        holds the indices (four per quad), and 'index' is empty */
+    CompactIndices       compactIndex;
     /*! mutex to lock anything within this object that might get
       changed by multiple threads (eg, computing bbox */
     std::mutex         mutex;
-    bool  haveComputedBounds { false };
+    std::atomic<bool> haveComputedBounds { false };
     box3f bounds;
   };
 
@@ -909,7 +1119,7 @@ namespace pbrt {
     CurveType type;
     BasisType basis;
     uint8_t   degree { 3 };
-    std::vector<vec3f> P;
+    MappableArray<vec3f> P;
     float width0 { 1.f };
     float width1 { 1.f };
   };
@@ -1005,7 +1215,7 @@ namespace pbrt {
     /*! mutex to lock anything within this object that might get
       changed by multiple threads (eg, computing bbox */
     std::mutex         mutex;
-    bool  haveComputedBounds { false };
+    std::atomic<bool> haveComputedBounds { false };
     box3f bounds;
   };
 
@@ -1027,7 +1237,15 @@ namespace pbrt {
     /*! serialize _in_ from given binary file reader */
     virtual void readFrom(BinaryReader &) override;
 
+    /*! bounds of everything in this object, including its
+        instances. The first call computes them, for this object
+        and everything below it, in parallel: first the shapes'
+        bounds, then the objects', from the bottom up; after that
+        the bounds are cached */
     virtual box3f getBounds();
+    /*! number of primitives in this object, counting those of
+        instanced objects once per instance */
+    size_t getNumPrims();
     
     std::vector<Shape::SP>       shapes;
     /*! all _non_-area light sources; in the pbrt spec area light
@@ -1040,8 +1258,10 @@ namespace pbrt {
     /*! mutex to lock anything within this object that might get
       changed by multiple threads (eg, computing bbox */
     std::mutex         mutex;
-    bool  haveComputedBounds { false };
+    std::atomic<bool> haveComputedBounds { false };
     box3f bounds;
+    std::atomic<bool> haveComputedNumPrims { false };
+    size_t numPrims { 0 };
   };
 
   /*! a camera as specified in the root .pbrt file. Note that unlike
@@ -1174,6 +1394,162 @@ namespace pbrt {
 
   };
 
+  /*! thrown by a load that got cancelled (\see LoadProgress::cancel) */
+  struct LoadCancelled : public std::runtime_error {
+    LoadCancelled() : std::runtime_error("scene load got cancelled") {}
+  };
+
+  /*! how far a load has come (\see loadAsync, LoadOptions::progress,
+      and ImportOptions::progress): the loading thread updates it, and
+      any other thread can look at it, or cancel the load */
+  struct LoadProgress {
+    typedef std::shared_ptr<LoadProgress> SP;
+
+    /*! have the load stop - by throwing LoadCancelled - the next time
+        it checks, i.e., at the next directive or included file (for
+        .pbrt files), or the next entity (for .pbf files) */
+    void cancel() { cancelled = true; }
+    bool isCancelled() const { return cancelled; }
+    /*! throw LoadCancelled if the load got cancelled */
+    void checkCancelled() const { if (cancelled) throw LoadCancelled(); }
+
+    /*! bytes of .pbrt or .pbf files read so far */
+    std::atomic<size_t> bytesConsumed   { 0 };
+    /*! number of files (.pbrt, .pbf, and PLY) read completely */
+    std::atomic<size_t> filesDone       { 0 };
+    /*! number of entities (for .pbf files) or shapes (for .pbrt
+        files) created so far */
+    std::atomic<size_t> entitiesDecoded { 0 };
+    /*! number of entities the load will decode in total, once known
+        (for .pbf files; 0 otherwise) */
+    std::atomic<size_t> entitiesTotal   { 0 };
+
+  private:
+    std::atomic<bool>   cancelled       { false };
+  };
+
+  /*! options for \see Scene::loadFrom() */
+  struct LoadOptions {
+    /*! memory-map the file, and have the shapes' large arrays point
+        straight into that mapping, rather than reading and copying
+        them (\see Scene::mapFrom) */
+    bool mapFile = false;
+    /*! only create (empty) shapes while loading the scene, and decode
+        each shape's data once it first gets accessed (\see
+        Shape::ensureLoaded). Everything else - objects, instances,
+        materials, cameras, etc, as well as the shapes' materials,
+        textures, and area lights - gets loaded right away. Uses the
+        file's entity index (\see Scene::saveTo) to find the shapes'
+        data, so loading only touches the parts of the file that
+        aren't shapes' arrays */
+    bool lazyShapes = false;
+    /*! decode the entities on all available threads, rather than
+        one after another */
+    bool parallel = true;
+    /*! store triangle and quad meshes' indices in their
+        'compactIndex' (with 1, 2, or 4 bytes per index, whatever
+        the mesh needs), rather than in 'index' - for applications
+        that can use such indices directly. \see
+        TriangleMesh::getIndex, TriangleMesh::expandIndices */
+    bool compactIndices = false;
+    /*! directory to look for a sharded file's shards in (\see
+        SaveOptions::shardSize), e.g., where they got pulled to from
+        some object store; if empty, the directory of the file itself */
+    std::string shardPath;
+    /*! if non-zero, shapes get loaded lazily (as with 'lazyShapes'),
+        and their data gets evicted again - least recently used
+        first - once the loaded shapes' data takes more than that
+        many bytes; evicted shapes get re-loaded on their next
+        access. Shapes that are in use have to be pinned (\see
+        Shape::pin). Bounds and primitive counts of shapes come from
+        the file, so getting those doesn't load anything */
+    size_t residentBudget = 0;
+    /*! read the file (and its shards) with few, large requests -
+        several of which are in flight at the same time - that bypass
+        the operating system's page cache where the file system
+        supports that (O_DIRECT). Faster for files that are much
+        larger than what the page cache can hold, or that only get
+        read once; ignored with 'mapFile', and on Windows */
+    bool directIO = false;
+    /*! if set, the load reports its progress there, and stops (by
+        throwing LoadCancelled) once that got cancelled */
+    LoadProgress::SP progress;
+  };
+
+  /*! options for \see Scene::saveTo() */
+  struct SaveOptions {
+    typedef enum : uint8_t {
+      Compression_None=0, Compression_LZ
+        } Compression;
+    
+    /*! have the entities write their data on all available threads;
+        the file will be the same, byte for byte, as when written on
+        a single thread */
+    bool parallel = true;
+    /*! write every entity's data straight into the file, rather than
+        first staging it in memory - which, for large meshes, would
+        temporarily double their memory footprint. this takes two
+        passes over each entity (one to compute its size, one to
+        write it), on a single thread, and overrides 'parallel'; the
+        file is the same either way */
+    bool streaming = false;
+    /*! how to compress large arrays (vertices, indices, etc). with
+        Compression_LZ, arrays get split into blocks that get filtered
+        (byte-shuffled, and - for integers - delta encoded) and then
+        LZ-compressed; those blocks get compressed, and decompressed
+        when loading, in parallel. compressed arrays can't be mapped
+        (\see Scene::mapFrom), so they'll always get copied */
+    Compression compression = Compression_None;
+    /*! 1 (fastest) to 9 (smallest) */
+    int compressionLevel = 1;
+    /*! lossy encoding of the meshes' (and curves') geometry: store
+        positions quantized (with 'positionBits' bits per component)
+        relative to each array's bounds, normals octahedron-encoded
+        with 16 bits per component, and texture coordinates as half
+        floats. positions will be off by at most half the size of a
+        'quantization step', i.e., of the array's extent divided by
+        2^positionBits-1 (per dimension) */
+    bool quantize = false;
+    /*! 16 to 21 */
+    int positionBits = 16;
+    /*! store meshes' indices with only 1 or 2 bytes per index, if
+        the mesh has few enough vertices (this is lossless) */
+    bool narrowIndices = true;
+    /*! if non-zero, entities of 64KB or more (i.e., mostly meshes)
+        don't go into the file itself, but into 'shard' files next to
+        it (named after the file, with '.1', '.2', etc appended), each
+        of which gets filled up to about that many bytes. the file
+        itself then only holds the small entities, plus an index of
+        which entity is in which shard at which offset; loading such
+        a file opens the shards only once it needs something from
+        them (with LoadOptions::lazyShapes, possibly never). only
+        works when saving to a file name */
+    size_t shardSize = 0;
+    /*! when appending to a file (\see Scene::appendTo), rewrite the
+        whole file instead once more than this fraction of it would
+        be data that nothing refers to any more */
+    float maxGarbageFraction = .5f;
+    /*! shapes that got loaded lazily (\see LoadOptions::lazyShapes),
+        and whose data isn't loaded, get their data copied as is from
+        the file they came from - rather than loaded and encoded
+        again, so they keep whatever compression or quantization they
+        had there. Only works for files in the current format; shapes
+        from older files get loaded and encoded as usual */
+    bool copyLazyShapes = false;
+    /*! store materials and textures that are identical - same type,
+        same parameters, same (or identical) textures - only once,
+        and have everything that used any of them use that one
+        instead. Entities then get written one after another, on a
+        single thread; i.e., this overrides 'parallel' and 'streaming' */
+    bool mergeIdenticalMaterials = false;
+    /*! write the file (and its shards) in large blocks, several of
+        which get written at the same time, in the background - and,
+        where the file system supports it, bypassing the operating
+        system's page cache (O_DIRECT). Only when saving (or
+        appending) to a file name; ignored on Windows */
+    bool directIO = false;
+  };
+
   /*! the complete scene - pretty much the 'root' object that
     contains the WorldBegin/WorldEnd entities, plus high-level
     stuff like camera, frame buffer specification, etc */
@@ -1182,14 +1558,55 @@ namespace pbrt {
     typedef std::shared_ptr<Scene> SP;
 
 
-    /*! save scene to given stream, and return number of bytes written */
+    /*! save scene to given stream (followed by an index of all
+        entities in it), and return number of bytes written */
     size_t saveTo(std::ostream &outStream);
     /*! save scene to given file name, and return number of bytes written */
     size_t saveTo(const std::string &outFileName);
+    /*! save scene to given stream, with given options */
+    size_t saveTo(std::ostream &outStream, const SaveOptions &options);
+    /*! save scene to given file name, with given options */
+    size_t saveTo(const std::string &outFileName, const SaveOptions &options);
+    /*! update given .pbf file to hold this scene, by appending only
+        those entities whose data the file doesn't have yet (say, one
+        changed material, or one replaced mesh), plus a new index -
+        which is what loading the file will then use. Every so often
+        (\see SaveOptions::maxGarbageFraction), or if the file is in
+        an older format, the file gets rewritten from scratch (with
+        the given options) instead. Entities that get appended always go into the file itself,
+        even if it's sharded. returns number of bytes written */
+    size_t appendTo(const std::string &fileName,
+                    const SaveOptions &options = SaveOptions());
     /*! load scene from given stream */
     static Scene::SP loadFrom(std::istream &inStream);
-    /*! load scene from given file name */
+    /*! load scene from given file name (with default LoadOptions,
+        i.e., decoding entities in parallel) */
     static Scene::SP loadFrom(const std::string &inFileName);
+    /*! load scene from given file name by memory-mapping it: the
+        large arrays of triangle meshes, quad meshes, and curves will
+        not get read (or copied) at all, but instead point straight
+        into the (copy-on-write) mapping, so pages only get read
+        once they're touched, and get shared with any other process
+        that maps the same file. The mapping stays alive as long as
+        any of those arrays still use it */
+    static Scene::SP mapFrom(const std::string &inFileName);
+    /*! load scene from given file name, with given options */
+    static Scene::SP loadFrom(const std::string &inFileName, const LoadOptions &options);
+    /*! load only that part of given .pbf file that overlaps given
+        (world-space) region: shapes whose bounds, and instances whose
+        object's bounds - in world space, i.e., transformed by all
+        instance transforms above them - don't overlap the region get
+        dropped, and their data never gets read. Objects that are
+        instanced several times keep every shape that overlaps under
+        at least one of those instances. Light sources are always
+        kept. Uses the bounds stored in the file (\see
+        Scene::saveTo), so for files from before those got stored
+        every shape needs to get loaded to find out its bounds. Shapes
+        get loaded as with LoadOptions::lazyShapes, and - unless the
+        given options ask for that - get loaded right away */
+    static Scene::SP loadRegion(const std::string &inFileName,
+                                const box3f &region,
+                                const LoadOptions &options = LoadOptions());
 
     /*! pretty-printer, for debugging */
     virtual std::string toString() const override { return "Scene"; }
@@ -1228,14 +1645,184 @@ namespace pbrt {
     /*! the worldbegin/worldend content */
     Object::SP              world;
   };
-    
+
+  /*! everything one might want to know about a scene without
+      actually loading it: camera(s), film, sampler, etc, plus some
+      statistics about what's in the world. \see loadSceneInfo */
+  struct SceneInfo {
+    typedef std::shared_ptr<SceneInfo> SP;
+
+    /*! compute the info for an already loaded scene (this is what
+        gets stored in .pbf files) */
+    static SceneInfo::SP computeFrom(Scene::SP scene);
+
+    std::vector<Camera::SP> cameras;
+    Film::SP                film;
+    Sampler::SP             sampler;
+    Integrator::SP          integrator;
+    PixelFilter::SP         pixelFilter;
+
+    /*! bounds of the world; only known for .pbf files - for .pbrt
+        files, this would require reading all the geometry, so it
+        stays empty */
+    box3f bounds = box3f::empty_box();
+
+    /*! number of shapes, by type. for .pbrt files these are pbrt's
+        type names ("trianglemesh", "plymesh", "curve", ...); for .pbf
+        files the lower-case names of our shape classes
+        ("trianglemesh", "quadmesh", "sphere", "disk", "curve"). shapes
+        inside objects count once, no matter how often their object
+        gets instantiated */
+    std::map<std::string,size_t> numShapes;
+    /*! number of primitives (triangles, quads, PLY faces, ...) in all
+        shapes of the given type; shapes without an index array count
+        as one primitive each */
+    std::map<std::string,size_t> numPrims;
+    /*! number of (named) objects, not counting the world */
+    size_t numObjects      = 0;
+    size_t numInstances    = 0;
+    size_t numLightSources = 0;
+  };
+
   /* compute some _rough_ storage cost esimate for a scene. this will
      allow bricking builders to greedily split only the most egregious
      objects */
   double computeApproximateStorageWeight(Scene::SP scene);
 
+  /*! options that control how importPBRT() converts a .pbrt file
+      (and all the files it references) into a Scene */
+  struct ImportOptions {
+    /*! path that relative file names get resolved against; if empty,
+        this is the directory of the file being imported */
+    std::string basePath;
+    
+    /*! if enabled, the importer only creates empty triangle meshes
+        for 'plymesh' shapes, and does the actual reading, decoding,
+        and transforming of the PLY files on a pool of worker threads
+        while it goes on with the rest of the scene. all meshes are
+        complete by the time importPBRT() returns */
+    bool asyncPlyLoading = true;
+
+    /*! if enabled, every PLY file (as identified by its canonical
+        path, size, and modification time) gets read only once, no
+        matter how often it is referenced. if all references to a
+        file use the same transform they will all share the same
+        mesh; otherwise the file gets stored only once, in object
+        space, and every reference becomes an Instance of that
+        object */
+    bool instancePlyMeshes = false;
+
+    /*! if non-empty, every PLY file we decode gets stored (as a raw,
+        mmap-friendly blob of its decoded arrays) in this directory,
+        and later imports will read those blobs rather than re-parse
+        the PLY files - or rather, map them, with the meshes' arrays
+        pointing straight into those mappings. blobs are keyed by the
+        PLY file's path, size, and modification time (and by
+        'triangulatePlyPolygons'), so changed files get re-parsed */
+    std::string plyCacheDirectory;
+
+    /*! if enabled, PLY files that contain quads come out as QuadMesh
+        (with triangles stored as degenerate quads); otherwise all
+        quads get split into two triangles each */
+    bool plyQuadsAsQuadMesh = true;
+    
+    /*! if enabled, PLY faces with more than four vertices get fan
+        triangulated; otherwise they are an error */
+    bool triangulatePlyPolygons = false;
+
+    /*! while parsing, scan ahead (in the background) for included
+        pbrt files and files referenced through "string filename"
+        parameters, and have those read into the page cache before the
+        parser gets to them. this is the maximum number of bytes we'll
+        request that way (not counting the root file); 0 disables
+        prefetching. Mostly helps on network file systems - on local
+        disks it's just extra work - so it's off by default; something
+        like 1<<30 is a reasonable budget */
+    size_t prefetchBudget = 0;
+
+    /*! if enabled, the imported scene gets stored as a .pbf file,
+        along with a manifest of all files the import read - the pbrt
+        file, all files it includes, and all PLY files - and their
+        sizes and modification times. Later imports of the same file
+        (with the same options) then just load that .pbf, unless one
+        of those files changed since. The .pbf and its manifest go
+        next to the pbrt file (as "<fileName>.pbf" and
+        "<fileName>.pbf.deps"), or, if set, into 'sceneCacheDirectory' */
+    bool cacheScene = false;
+    std::string sceneCacheDirectory;
+
+    /*! if set, the import reports its progress there, and stops (by
+        throwing LoadCancelled) once that got cancelled */
+    LoadProgress::SP progress;
+  };
+  
   /*! parse a pbrt file (using the pbrt_parser project, and convert
     the result over to a naivescenelayout */
   PBRT_PARSER_INTERFACE Scene::SP importPBRT(const std::string &fileName, const std::string &basePath = "");
-  
+
+  /*! same as importPBRT(fileName,basePath), but with explicit import options */
+  PBRT_PARSER_INTERFACE Scene::SP importPBRT(const std::string &fileName, const ImportOptions &options);
+
+  /*! quickly get a scene's camera(s), film, etc, and statistics on
+      its contents (\see SceneInfo), without loading the scene. for
+      .pbf files this reads only the summary that Scene::saveTo()
+      stores with the scene; for .pbrt files, this parses everything
+      up to WorldBegin, and then only scans the world (and any
+      included files) for shapes, objects, and light sources, getting
+      primitive counts from the lengths of the shapes' index arrays
+      or from the headers of the PLY files they reference */
+  PBRT_PARSER_INTERFACE SceneInfo::SP loadSceneInfo(const std::string &fileName,
+                                                    const std::string &basePath = "");
+
+  /*! handle to a scene that's being loaded in the background (\see
+      loadAsync) */
+  struct AsyncLoad {
+    typedef std::shared_ptr<AsyncLoad> SP;
+
+    /*! whether the load is done (successfully or not) */
+    bool isDone() const;
+    /*! wait until the load is done, but at most for given number of
+        seconds; returns isDone() */
+    bool waitFor(double seconds) const;
+    /*! wait until the load is done, and return the scene - or throw
+        whatever the load threw (LoadCancelled, if it got cancelled) */
+    Scene::SP get() const;
+    /*! have the load stop as soon as possible (\see
+        LoadProgress::cancel); doesn't wait for it to do so */
+    void cancel() { progress->cancel(); }
+
+    /*! how far the load has come */
+    LoadProgress::SP              progress;
+    std::shared_future<Scene::SP> result;
+  };
+
+  /*! start loading given .pbf (with Scene::loadFrom(), and given load
+      options) or .pbrt file (with importPBRT(), and given import
+      options) in the background, and return right away. loads run
+      on a small pool of threads of their own, from where they still
+      use all threads for their parallel parts */
+  PBRT_PARSER_INTERFACE AsyncLoad::SP loadAsync(const std::string &fileName,
+                                                const LoadOptions &loadOptions = LoadOptions(),
+                                                const ImportOptions &importOptions = ImportOptions());
+
+  /*! one of the .pbf files to merge (\see mergePBF) */
+  struct MergeInput {
+    std::string fileName;
+    /*! where to put that file's world in the merged scene */
+    affine3f    xfm = affine3f::identity();
+  };
+
+  /*! write a .pbf file that holds all the given .pbf files' scenes,
+      with each one's world becoming an instance (with the input's
+      transform) in the merged scene's world; camera, film, and the
+      like come from the first file. The inputs' shapes don't get
+      decoded, but get copied as is (\see
+      SaveOptions::copyLazyShapes) - unless they're in an older
+      format. The output may be one of the inputs: it gets written
+      to a temporary file that then replaces the old one. Returns
+      number of bytes written */
+  PBRT_PARSER_INTERFACE size_t mergePBF(const std::vector<MergeInput> &inputs,
+                                        const std::string &outFileName,
+                                        const SaveOptions &options = SaveOptions());
+
 } // ::pbrt
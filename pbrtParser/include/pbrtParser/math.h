@@ -60,6 +60,13 @@
 #include <limits>
 #include <utility>
 #include <vector>
+#if defined(__AVX__)
+#  include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  define PBRT_PARSER_HAVE_SSE 1
+#  include <xmmintrin.h>
+#endif
 
 /*! \file pbrt/Parser.h *Internal* parser class used by \see
   pbrt_parser::Scene::parseFromFile() - as end user, you should
@@ -180,6 +187,130 @@ namespace pbrt {
     inline vec3f xfmVector(const affine3f& m, const vec3f& v) { return m.l * v; }
     inline vec3f xfmNormal(const affine3f& m, const vec3f& n) { return inverse_transpose(m.l) * n; }
 
+    namespace detail {
+#if PBRT_PARSER_HAVE_SSE
+      /*! 4-wide SSE flavor of the batched transform kernel below */
+      struct SSE4 {
+        typedef __m128 type;
+        enum { width = 4 };
+        static type set1(float f) { return _mm_set1_ps(f); }
+        static type add(type a, type b) { return _mm_add_ps(a,b); }
+        static type mul(type a, type b) { return _mm_mul_ps(a,b); }
+        static type min(type a, type b) { return _mm_min_ps(a,b); }
+        static type max(type a, type b) { return _mm_max_ps(a,b); }
+        template<int imm> static type shuffle(type a, type b) { return _mm_shuffle_ps(a,b,imm); }
+        static void load(const float *src, type &a, type &b, type &c)
+        { a = _mm_loadu_ps(src); b = _mm_loadu_ps(src+4); c = _mm_loadu_ps(src+8); }
+        static void store(float *dst, type a, type b, type c)
+        { _mm_storeu_ps(dst,a); _mm_storeu_ps(dst+4,b); _mm_storeu_ps(dst+8,c); }
+      };
+#endif
+#if defined(__AVX__)
+      /*! 8-wide AVX flavor of the batched transform kernel below:
+          each 128-bit lane holds four vectors, exactly as for SSE4 */
+      struct AVX8 {
+        typedef __m256 type;
+        enum { width = 8 };
+        static type set1(float f) { return _mm256_set1_ps(f); }
+        static type add(type a, type b) { return _mm256_add_ps(a,b); }
+        static type mul(type a, type b) { return _mm256_mul_ps(a,b); }
+        static type min(type a, type b) { return _mm256_min_ps(a,b); }
+        static type max(type a, type b) { return _mm256_max_ps(a,b); }
+        template<int imm> static type shuffle(type a, type b) { return _mm256_shuffle_ps(a,b,imm); }
+        static type load2(const float *lo, const float *hi)
+        { return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(lo)),_mm_loadu_ps(hi),1); }
+        static void store2(float *lo, float *hi, type v)
+        { _mm_storeu_ps(lo,_mm256_castps256_ps128(v)); _mm_storeu_ps(hi,_mm256_extractf128_ps(v,1)); }
+        static void load(const float *src, type &a, type &b, type &c)
+        { a = load2(src,src+12); b = load2(src+4,src+16); c = load2(src+8,src+20); }
+        static void store(float *dst, type a, type b, type c)
+        { store2(dst,dst+12,a); store2(dst+4,dst+16,b); store2(dst+8,dst+20,c); }
+      };
+#endif
+
+#if PBRT_PARSER_HAVE_SSE
+      /*! transform 'numBlocks' blocks of S::width vectors each; every
+          block of vectors (x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3)
+          gets shuffled into x, y, and z registers, transformed, and
+          shuffled back */
+      template<typename S, bool withTranslation>
+      inline void xfmBlocks(const mat3f &l, const vec3f &p,
+                            const float *src, float *dst, size_t numBlocks)
+      {
+        typedef typename S::type T;
+        const T l00 = S::set1(l.vx.x), l01 = S::set1(l.vx.y), l02 = S::set1(l.vx.z);
+        const T l10 = S::set1(l.vy.x), l11 = S::set1(l.vy.y), l12 = S::set1(l.vy.z);
+        const T l20 = S::set1(l.vz.x), l21 = S::set1(l.vz.y), l22 = S::set1(l.vz.z);
+        const T px  = S::set1(p.x),    py  = S::set1(p.y),    pz  = S::set1(p.z);
+        for (size_t blockID=0;blockID<numBlocks;blockID++) {
+          T a, b, c;
+          S::load(src,a,b,c);
+          const T x = S::template shuffle<_MM_SHUFFLE(2,0,3,0)>
+            (a,S::template shuffle<_MM_SHUFFLE(1,1,2,2)>(b,c));
+          const T y = S::template shuffle<_MM_SHUFFLE(2,0,2,0)>
+            (S::template shuffle<_MM_SHUFFLE(0,0,1,1)>(a,b),
+             S::template shuffle<_MM_SHUFFLE(2,2,3,3)>(b,c));
+          const T z = S::template shuffle<_MM_SHUFFLE(3,0,2,0)>
+            (S::template shuffle<_MM_SHUFFLE(1,1,2,2)>(a,b),c);
+
+          // same order of operations as 'l * v + p' for a single vec3f
+          T X = S::add(S::add(S::mul(l00,x),S::mul(l10,y)),S::mul(l20,z));
+          T Y = S::add(S::add(S::mul(l01,x),S::mul(l11,y)),S::mul(l21,z));
+          T Z = S::add(S::add(S::mul(l02,x),S::mul(l12,y)),S::mul(l22,z));
+          if (withTranslation) {
+            X = S::add(X,px); Y = S::add(Y,py); Z = S::add(Z,pz);
+          }
+
+          a = S::template shuffle<_MM_SHUFFLE(2,0,2,0)>
+            (S::template shuffle<_MM_SHUFFLE(0,0,0,0)>(X,Y),
+             S::template shuffle<_MM_SHUFFLE(1,1,0,0)>(Z,X));
+          b = S::template shuffle<_MM_SHUFFLE(2,0,2,0)>
+            (S::template shuffle<_MM_SHUFFLE(1,1,1,1)>(Y,Z),
+             S::template shuffle<_MM_SHUFFLE(2,2,2,2)>(X,Y));
+          c = S::template shuffle<_MM_SHUFFLE(2,0,2,0)>
+            (S::template shuffle<_MM_SHUFFLE(3,3,2,2)>(Z,X),
+             S::template shuffle<_MM_SHUFFLE(3,3,3,3)>(Y,Z));
+          S::store(dst,a,b,c);
+          src += 3*S::width;
+          dst += 3*S::width;
+        }
+      }
+#endif
+
+      /*! out[i] = l * in[i] (+ p), for all i in [0,n); uses the widest
+          SIMD flavor we were compiled for, and scalar code for the
+          remainder. results are bit-identical to the scalar code */
+      template<bool withTranslation>
+      inline void xfmArray(const mat3f &l, const vec3f &p,
+                           const vec3f *in, vec3f *out, size_t n)
+      {
+        static_assert(sizeof(vec3f) == 3*sizeof(float),"vec3f must be tightly packed");
+        size_t i = 0;
+#if defined(__AVX__)
+        xfmBlocks<AVX8,withTranslation>(l,p,(const float*)in,(float*)out,n/8);
+        i = n/8*8;
+#endif
+#if PBRT_PARSER_HAVE_SSE
+        xfmBlocks<SSE4,withTranslation>(l,p,(const float*)(in+i),(float*)(out+i),(n-i)/4);
+        i += (n-i)/4*4;
+#endif
+        for (;i<n;i++)
+          out[i] = withTranslation ? l * in[i] + p : l * in[i];
+      }
+    }
+
+    /*! transform n points at once - same as out[i] = xfmPoint(m,in[i]),
+        but vectorized; 'in' and 'out' may be the same array */
+    inline void xfmPoints(const affine3f& m, const vec3f *in, vec3f *out, size_t n)
+    { detail::xfmArray<true>(m.l,m.p,in,out,n); }
+    /*! transform n vectors at once - same as out[i] = xfmVector(m,in[i]) */
+    inline void xfmVectors(const affine3f& m, const vec3f *in, vec3f *out, size_t n)
+    { detail::xfmArray<false>(m.l,m.p,in,out,n); }
+    /*! transform n normals at once - same as out[i] =
+        xfmNormal(m,in[i]), but computes the inverse transpose only once */
+    inline void xfmNormals(const affine3f& m, const vec3f *in, vec3f *out, size_t n)
+    { detail::xfmArray<false>(inverse_transpose(m.l),m.p,in,out,n); }
+
     inline affine3f affine3f::rotate(const vec3f& _u, float r) {
       vec3f u = normalize(_u);
       float s = sinf(r), c = cosf(r);
@@ -196,6 +327,78 @@ namespace pbrt {
     inline void box3f::extend(const vec3f& p) { lower=min(lower,p); upper=max(upper,p); }
     inline void box3f::extend(const box3f& b) { lower=min(lower,b.lower); upper=max(upper,b.upper); }
 
+    namespace detail {
+#if PBRT_PARSER_HAVE_SSE
+      /*! extend 'bounds' by 'numBlocks' blocks of S::width points
+          each. the points' components stay where they got loaded
+          (a block's registers hold x0 y0 z0 x1 | y1 z1 x2 y2 | ...),
+          so the running minima and maxima have the same layout, and
+          only get reduced to a single box at the end */
+      template<typename S>
+      inline void extendBlocks(box3f &bounds, const float *src, size_t numBlocks)
+      {
+        typedef typename S::type T;
+        float lower[3*S::width], upper[3*S::width];
+        for (int i=0;i<S::width;i++) {
+          lower[3*i+0] = bounds.lower.x; lower[3*i+1] = bounds.lower.y; lower[3*i+2] = bounds.lower.z;
+          upper[3*i+0] = bounds.upper.x; upper[3*i+1] = bounds.upper.y; upper[3*i+2] = bounds.upper.z;
+        }
+        T loA, loB, loC, hiA, hiB, hiC;
+        S::load(lower,loA,loB,loC);
+        S::load(upper,hiA,hiB,hiC);
+        for (size_t blockID=0;blockID<numBlocks;blockID++) {
+          T a, b, c;
+          S::load(src,a,b,c);
+          // (point first: like the scalar min/max, this ignores nans)
+          loA = S::min(a,loA); loB = S::min(b,loB); loC = S::min(c,loC);
+          hiA = S::max(a,hiA); hiB = S::max(b,hiB); hiC = S::max(c,hiC);
+          src += 3*S::width;
+        }
+        S::store(lower,loA,loB,loC);
+        S::store(upper,hiA,hiB,hiC);
+        for (int i=0;i<S::width;i++) {
+          bounds.lower = min(bounds.lower,vec3f(lower[3*i+0],lower[3*i+1],lower[3*i+2]));
+          bounds.upper = max(bounds.upper,vec3f(upper[3*i+0],upper[3*i+1],upper[3*i+2]));
+        }
+      }
+#endif
+    }
+
+    /*! extend 'bounds' by n points - same as bounds.extend(p[i]) for
+        all i, but vectorized */
+    inline void extendBounds(box3f &bounds, const vec3f *p, size_t n)
+    {
+      size_t i = 0;
+#if defined(__AVX__)
+      detail::extendBlocks<detail::AVX8>(bounds,(const float*)p,n/8);
+      i = n/8*8;
+#endif
+#if PBRT_PARSER_HAVE_SSE
+      detail::extendBlocks<detail::SSE4>(bounds,(const float*)(p+i),(n-i)/4);
+      i += (n-i)/4*4;
+#endif
+      for (;i<n;i++)
+        bounds.extend(p[i]);
+    }
+
+    /*! bounds of the given box after transformation, i.e., of its
+        eight transformed corners */
+    inline box3f xfmBounds(const affine3f& m, const box3f& b)
+    {
+      const vec3f corners[8] = {
+        vec3f(b.lower.x,b.lower.y,b.lower.z), vec3f(b.lower.x,b.lower.y,b.upper.z),
+        vec3f(b.lower.x,b.upper.y,b.lower.z), vec3f(b.lower.x,b.upper.y,b.upper.z),
+        vec3f(b.upper.x,b.lower.y,b.lower.z), vec3f(b.upper.x,b.lower.y,b.upper.z),
+        vec3f(b.upper.x,b.upper.y,b.lower.z), vec3f(b.upper.x,b.upper.y,b.upper.z)
+      };
+      vec3f transformed[8];
+      xfmPoints(m,corners,transformed,8);
+      box3f result = box3f::empty_box();
+      for (int i=0;i<8;i++)
+        result.extend(transformed[i]);
+      return result;
+    }
+
     inline std::ostream& operator<<(std::ostream& o, const vec2f& v) { return o << "(" << v.x << "," << v.y << ")"; }
     inline std::ostream& operator<<(std::ostream& o, const vec3f& v) { return o << "(" << v.x << "," << v.y << "," << v.z << ")"; }
     inline std::ostream& operator<<(std::ostream& o, const vec4f& v) { return o << "(" << v.x << "," << v.y << "," << v.z << "," << v.w << ")"; }
@@ -14,7 +14,17 @@
 // limitations under the License.                                           //
 // ======================================================================== //
 
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
 #include <sstream>
+#include <thread>
+#ifndef _WIN32
+# include <dirent.h>
+# include <unistd.h>
+#endif
 
 #include <gtest/gtest.h>
 
@@ -827,3 +837,1706 @@ TEST(PbrtParser, AnimatedTransformations)
   EXPECT_FLOAT_EQ(atEnd.p.y, 1.f);
   EXPECT_FLOAT_EQ(atEnd.p.z, 2.f);
 }
+
+
+// =======================================================
+// Ascii PLY fast path (checked against rply)
+// =======================================================
+
+TEST(PbrtParser, AsciiPlyMatchesRPly)
+{
+  const std::string fileName = "pbrtParserTest_ascii.ply";
+  {
+    std::ofstream ply(fileName);
+    ply << "ply\n"
+        << "format ascii 1.0\n"
+        << "comment written by the pbrtParser unittests\n"
+        << "element vertex 4\n"
+        << "property float x\n"
+        << "property float y\n"
+        << "property float z\n"
+        << "property float nx\n"
+        << "property float ny\n"
+        << "property float nz\n"
+        << "property float u\n"
+        << "property float v\n"
+        << "element face 2\n"
+        << "property list uchar int vertex_indices\n"
+        << "end_header\n"
+        << "0 0 0 0 0 1 0 0\n"
+        << "1.5 -2.25e-1 0.1 0 0 1 1 0\r\n"
+        << "-1e3 3.14159265358979323846 .5 0 0 1 1 1\n"
+        << "1e-30 7 +2 0 0 1 0.333333333 0.7\n"
+        << "3 0 1 2\n"
+        << "3 0 2 3\n";
+  }
+
+  MappableArray<vec3f> fastPos, fastNor, rplyPos, rplyNor;
+  MappableArray<vec2f> fastTex, rplyTex;
+  MappableArray<vec3i> fastIdx, rplyIdx;
+  MappableArray<vec4i> fastQuads, rplyQuads;
+  ASSERT_TRUE(ply::parseAscii(fileName,fastPos,fastNor,fastTex,fastIdx,fastQuads));
+  ply::parseWithRPly(fileName,rplyPos,rplyNor,rplyTex,rplyIdx,rplyQuads);
+  EXPECT_TRUE(fastQuads.empty());
+  EXPECT_TRUE(rplyQuads.empty());
+  std::remove(fileName.c_str());
+
+  ASSERT_EQ(fastPos.size(), 4);
+  ASSERT_EQ(fastPos.size(), rplyPos.size());
+  ASSERT_EQ(fastNor.size(), rplyNor.size());
+  ASSERT_EQ(fastTex.size(), rplyTex.size());
+  ASSERT_EQ(fastIdx.size(), rplyIdx.size());
+  for (size_t i=0;i<fastPos.size();i++) {
+    // must be bit-identical, not just close
+    EXPECT_EQ(fastPos[i].x, rplyPos[i].x);
+    EXPECT_EQ(fastPos[i].y, rplyPos[i].y);
+    EXPECT_EQ(fastPos[i].z, rplyPos[i].z);
+    EXPECT_EQ(fastNor[i].z, rplyNor[i].z);
+    EXPECT_EQ(fastTex[i].x, rplyTex[i].x);
+    EXPECT_EQ(fastTex[i].y, rplyTex[i].y);
+  }
+  for (size_t i=0;i<fastIdx.size();i++) {
+    EXPECT_EQ(fastIdx[i].x, rplyIdx[i].x);
+    EXPECT_EQ(fastIdx[i].y, rplyIdx[i].y);
+    EXPECT_EQ(fastIdx[i].z, rplyIdx[i].z);
+  }
+}
+
+TEST(PbrtParser, AsciiPlyRejectsBadIndices)
+{
+  const std::string fileName = "pbrtParserTest_badIndices.ply";
+  auto writePly = [&](const std::string &face) {
+    std::ofstream ply(fileName);
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 4\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 1\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n1 1 0\n0 1 0\n"
+        << face << "\n";
+  };
+  MappableArray<vec3f> pos, nor;
+  MappableArray<vec2f> tex;
+  MappableArray<vec3i> idx;
+  MappableArray<vec4i> quads;
+
+  // integral values are fine, no matter how they're written
+  writePly("3 0 1.0 2e0");
+  ASSERT_TRUE(ply::parseAscii(fileName,pos,nor,tex,idx,quads));
+  ASSERT_EQ(idx.size(), 1);
+  EXPECT_EQ(idx[0].y, 1);
+  EXPECT_EQ(idx[0].z, 2);
+
+  // anything else, the fast path leaves to rply, which complains
+  for (const char *face : { "3 0 1 3000000000", "3 0 1 -1", "3 0 1 4",
+                            "3 0 1 2.5", "3 0 1 1e300" }) {
+    writePly(face);
+    pos.clear(); idx.clear(); quads.clear();
+    EXPECT_FALSE(ply::parseAscii(fileName,pos,nor,tex,idx,quads)) << face;
+    EXPECT_THROW(ply::parse(fileName,pos,nor,tex,idx,quads), std::runtime_error) << face;
+  }
+  std::remove(fileName.c_str());
+}
+
+
+// =======================================================
+// asynchronous PLY loading
+// =======================================================
+
+TEST(PbrtParser, AsyncPlyImportMatchesSyncImport)
+{
+  for (int f=0;f<4;f++) {
+    std::ofstream ply("pbrtParserTest_async"+std::to_string(f)+".ply");
+    const int numVertices = 10+f;
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex " << numVertices << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "element face " << numVertices-2 << "\n"
+        << "property list uchar int vertex_indices\nend_header\n";
+    for (int i=0;i<numVertices;i++)
+      ply << i << " " << f << " " << (i%3) << "\n";
+    for (int i=0;i+2<numVertices;i++)
+      ply << "3 " << i << " " << i+1 << " " << i+2 << "\n";
+  }
+  {
+    std::ofstream pbrt("pbrtParserTest_async.pbrt");
+    pbrt << "WorldBegin\n"
+         << "Material \"matte\"\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_async0.ply\"\n"
+         << "AttributeBegin\n"
+         << "  Translate 5 0 0\n"
+         << "  Shape \"plymesh\" \"string filename\" \"pbrtParserTest_async1.ply\"\n"
+         << "AttributeEnd\n"
+         << "ObjectBegin \"obj\"\n"
+         << "  Shape \"plymesh\" \"string filename\" \"pbrtParserTest_async2.ply\"\n"
+         << "  Shape \"plymesh\" \"string filename\" \"pbrtParserTest_async3.ply\"\n"
+         << "ObjectEnd\n"
+         << "ObjectInstance \"obj\"\n"
+         << "Translate 0 0 7\n"
+         << "ObjectInstance \"obj\"\n"
+         << "WorldEnd\n";
+  }
+
+  std::string imported[2];
+  for (int async=0;async<2;async++) {
+    ImportOptions options;
+    options.asyncPlyLoading = (async != 0);
+    std::stringstream saved;
+    importPBRT("pbrtParserTest_async.pbrt",options)->saveTo(saved);
+    imported[async] = saved.str();
+  }
+  EXPECT_EQ(imported[1], imported[0]);
+
+  // errors in PLY files that get read in the background still reach
+  // the caller
+  {
+    std::ofstream ply("pbrtParserTest_async3.ply");
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 5\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 1\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n1 1 0\n0 1 0\n2 0 0\n"
+        << "5 0 1 2 3 4\n";
+  }
+  for (int async=0;async<2;async++) {
+    ImportOptions options;
+    options.asyncPlyLoading = (async != 0);
+    EXPECT_THROW(importPBRT("pbrtParserTest_async.pbrt",options), std::runtime_error);
+  }
+
+  for (int f=0;f<4;f++)
+    std::remove(("pbrtParserTest_async"+std::to_string(f)+".ply").c_str());
+  std::remove("pbrtParserTest_async.pbrt");
+}
+
+
+// =======================================================
+// prefetching of included and referenced files
+// =======================================================
+
+TEST(PbrtParser, PrefetcherFollowsIncludesWithinBudget)
+{
+  const size_t plySize[3] = { 1000, 2000, 100000 };
+  for (int f=0;f<3;f++) {
+    std::ofstream ply("pbrtParserTest_prefetch"+std::to_string(f)+".ply");
+    ply << std::string(plySize[f],'x');
+  }
+  {
+    std::ofstream inc("pbrtParserTest_prefetch_inc.pbrt");
+    inc << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_prefetch1.ply\"\n"
+        << "Shape \"plymesh\" \"string filename\" [ \"pbrtParserTest_prefetch2.ply\" ]\n"
+        // same file as in the root file, under another name
+        << "Shape \"plymesh\" \"string filename\" \"./pbrtParserTest_prefetch0.ply\"\n"
+        << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_doesNotExist.ply\"\n";
+  }
+  {
+    // root file is larger than any budget below, which must not keep
+    // us from prefetching the rest
+    std::ofstream root("pbrtParserTest_prefetch.pbrt");
+    root << "# " << std::string(200000,'-') << "\n"
+         << "# Include \"pbrtParserTest_commentedOut.pbrt\"\n"
+         << "WorldBegin\n"
+         << "Include \"pbrtParserTest_prefetch_inc.pbrt\"\n"
+         << "Texture \"t\" \"color\" \"imagemap\" \"string mapping\" \"uv\"\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_prefetch0.ply\"\n"
+         << "WorldEnd\n";
+  }
+  const size_t incSize = syntactic::getFileStamp("pbrtParserTest_prefetch_inc.pbrt").size;
+
+  {
+    syntactic::Prefetcher prefetcher(size_t(1)<<30);
+    prefetcher.scan("pbrtParserTest_prefetch.pbrt",".");
+    prefetcher.wait();
+    EXPECT_EQ(prefetcher.getNumBytesRequested(),
+              incSize+plySize[0]+plySize[1]+plySize[2]);
+  }
+  {
+    // whatever order the files get visited in, the largest one never
+    // fits, and all others always do
+    const size_t byteBudget = incSize+plySize[0]+plySize[1]+100;
+    syntactic::Prefetcher prefetcher(byteBudget);
+    prefetcher.scan("pbrtParserTest_prefetch.pbrt",".");
+    prefetcher.wait();
+    EXPECT_EQ(prefetcher.getNumBytesRequested(),incSize+plySize[0]+plySize[1]);
+    EXPECT_LE(prefetcher.getNumBytesRequested(),byteBudget);
+  }
+
+  for (int f=0;f<3;f++)
+    std::remove(("pbrtParserTest_prefetch"+std::to_string(f)+".ply").c_str());
+  std::remove("pbrtParserTest_prefetch_inc.pbrt");
+  std::remove("pbrtParserTest_prefetch.pbrt");
+}
+
+
+// =======================================================
+// PLY instancing
+// =======================================================
+
+TEST(PbrtParser, PlyInstancing)
+{
+  {
+    std::ofstream ply("pbrtParserTest_tri.ply");
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 3\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 1\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n0 1 0\n3 0 1 2\n";
+    std::ofstream pbrt("pbrtParserTest_instancing.pbrt");
+    pbrt << "WorldBegin\n"
+         << "AttributeBegin\n"
+         << "  Translate 10 0 0\n"
+         << "  Shape \"plymesh\" \"string filename\" \"pbrtParserTest_tri.ply\"\n"
+         << "AttributeEnd\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_tri.ply\"\n"
+         << "ObjectBegin \"twice\"\n"
+         << "  Shape \"plymesh\" \"string filename\" \"pbrtParserTest_tri.ply\"\n"
+         << "ObjectEnd\n"
+         << "WorldEnd\n";
+  }
+
+  ImportOptions options;
+  options.instancePlyMeshes = true;
+  Scene::SP scene = importPBRT("pbrtParserTest_instancing.pbrt",options);
+  std::remove("pbrtParserTest_tri.ply");
+  std::remove("pbrtParserTest_instancing.pbrt");
+
+  ASSERT_NE(scene->world, nullptr);
+  EXPECT_EQ(scene->world->shapes.size(), 0);
+  ASSERT_EQ(scene->world->instances.size(), 2);
+  // both references share the same object-space mesh ...
+  EXPECT_EQ(scene->world->instances[0]->object, scene->world->instances[1]->object);
+  ASSERT_EQ(scene->world->instances[0]->object->shapes.size(), 1);
+  TriangleMesh::SP mesh
+    = std::dynamic_pointer_cast<TriangleMesh>(scene->world->instances[0]->object->shapes[0]);
+  ASSERT_NE(mesh, nullptr);
+  ASSERT_EQ(mesh->vertex.size(), 3);
+  EXPECT_FLOAT_EQ(mesh->vertex[1].x, 1.f);
+  // ... and the per-reference transforms moved into the instances
+  EXPECT_FLOAT_EQ(scene->world->instances[0]->xfm.p.x, 10.f);
+  EXPECT_FLOAT_EQ(scene->world->instances[1]->xfm.p.x, 0.f);
+  EXPECT_FLOAT_EQ(scene->getBounds().upper.x, 11.f);
+}
+
+
+// =======================================================
+// cache of decoded PLY files
+// =======================================================
+
+TEST(PbrtParser, PlyCacheMapsBlobsUntilFileChanges)
+{
+  const std::string fileName = "pbrtParserTest_cachedply.ply";
+  const std::string cacheDir = "pbrtParserTest_plycache";
+  auto writePly = [&](int numVertices) {
+    std::ofstream ply(fileName);
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex " << numVertices << "\n"
+        << "property float x\nproperty float y\nproperty float z\n"
+        << "element face " << numVertices-2 << "\n"
+        << "property list uchar int vertex_indices\nend_header\n";
+    for (int i=0;i<numVertices;i++)
+      ply << i << " " << (i%2) << " 0\n";
+    for (int i=0;i+2<numVertices;i++)
+      ply << "3 " << i << " " << i+1 << " " << i+2 << "\n";
+  };
+  writePly(100);
+
+  MappableArray<vec3f> pos, nor;
+  MappableArray<vec2f> tex;
+  MappableArray<vec3i> idx;
+  MappableArray<vec4i> quads;
+  // (no blob yet)
+  EXPECT_FALSE(ply::readFromCache(cacheDir,fileName,pos,nor,tex,idx,quads,false));
+  ply::parse(fileName,pos,nor,tex,idx,quads,false,cacheDir);
+  ASSERT_EQ(pos.size(), 100);
+  ASSERT_EQ(idx.size(), 98);
+
+  MappableArray<vec3f> cachedPos, cachedNor;
+  MappableArray<vec2f> cachedTex;
+  MappableArray<vec3i> cachedIdx;
+  MappableArray<vec4i> cachedQuads;
+  ASSERT_TRUE(ply::readFromCache(cacheDir,fileName,cachedPos,cachedNor,cachedTex,
+                                 cachedIdx,cachedQuads,false));
+  ASSERT_EQ(cachedPos.size(), pos.size());
+  ASSERT_EQ(cachedIdx.size(), idx.size());
+  EXPECT_EQ(memcmp(cachedPos.data(),pos.data(),pos.size()*sizeof(vec3f)), 0);
+  EXPECT_EQ(memcmp(cachedIdx.data(),idx.data(),idx.size()*sizeof(vec3i)), 0);
+  EXPECT_TRUE(cachedNor.empty());
+  EXPECT_TRUE(cachedQuads.empty());
+  // the arrays point into the blob, rather than being copies of it
+  EXPECT_TRUE(cachedPos.get_allocator().isExternal(cachedPos.data()));
+  EXPECT_TRUE(cachedIdx.get_allocator().isExternal(cachedIdx.data()));
+
+  // decoding with polygon triangulation has a blob of its own
+  EXPECT_FALSE(ply::readFromCache(cacheDir,fileName,cachedPos,cachedNor,cachedTex,
+                                  cachedIdx,cachedQuads,true));
+
+  // once the file changes, its old blob no longer gets used
+  writePly(101);
+  EXPECT_FALSE(ply::readFromCache(cacheDir,fileName,cachedPos,cachedNor,cachedTex,
+                                  cachedIdx,cachedQuads,false));
+  ply::parse(fileName,pos,nor,tex,idx,quads,false,cacheDir);
+  EXPECT_EQ(pos.size(), 101);
+
+  std::remove(fileName.c_str());
+#ifndef _WIN32
+  if (DIR *dir = opendir(cacheDir.c_str())) {
+    while (struct dirent *entry = readdir(dir))
+      std::remove((cacheDir+"/"+entry->d_name).c_str());
+    closedir(dir);
+  }
+  rmdir(cacheDir.c_str());
+#endif
+}
+
+
+// =======================================================
+// PLY files with quads and polygons
+// =======================================================
+
+TEST(PbrtParser, PlyQuadsAndPolygons)
+{
+  const std::string fileName = "pbrtParserTest_quads.ply";
+  {
+    std::ofstream ply(fileName);
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 6\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 3\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n1 1 0\n0 1 0\n2 0 0\n2 1 0\n"
+        << "4 0 1 2 3\n"
+        << "3 1 4 2\n"
+        << "5 0 1 4 5 3\n";
+  }
+
+  MappableArray<vec3f> pos, nor;
+  MappableArray<vec2f> tex;
+  MappableArray<vec3i> idx;
+  MappableArray<vec4i> fastQuads, rplyQuads;
+  // polygons with more than four vertices are only ok if we triangulate them
+  EXPECT_THROW(ply::parse(fileName,pos,nor,tex,idx,fastQuads), std::runtime_error);
+  
+  pos.clear(); idx.clear(); fastQuads.clear();
+  ASSERT_TRUE(ply::parseAscii(fileName,pos,nor,tex,idx,fastQuads,true));
+  ply::parseWithRPly(fileName,pos,nor,tex,idx,rplyQuads,true);
+  EXPECT_TRUE(idx.empty());
+  // one quad, one triangle, and three triangles for the pentagon
+  ASSERT_EQ(fastQuads.size(), 5);
+  ASSERT_EQ(rplyQuads.size(), fastQuads.size());
+  for (size_t i=0;i<fastQuads.size();i++) {
+    EXPECT_EQ(fastQuads[i].x, rplyQuads[i].x);
+    EXPECT_EQ(fastQuads[i].y, rplyQuads[i].y);
+    EXPECT_EQ(fastQuads[i].z, rplyQuads[i].z);
+    EXPECT_EQ(fastQuads[i].w, rplyQuads[i].w);
+  }
+  EXPECT_EQ(fastQuads[0].w, 3);
+  // triangles become degenerate quads
+  EXPECT_EQ(fastQuads[1].w, fastQuads[1].z);
+
+  // without any quads, polygons just become triangles
+  {
+    std::ofstream ply(fileName);
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 6\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 2\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n1 1 0\n0 1 0\n2 0 0\n2 1 0\n"
+        << "3 1 4 2\n"
+        << "5 0 1 4 5 3\n";
+  }
+  MappableArray<vec3i> fastIdx, rplyIdx;
+  fastQuads.clear(); rplyQuads.clear();
+  ASSERT_TRUE(ply::parseAscii(fileName,pos,nor,tex,fastIdx,fastQuads,true));
+  ply::parseWithRPly(fileName,pos,nor,tex,rplyIdx,rplyQuads,true);
+  EXPECT_TRUE(fastQuads.empty());
+  EXPECT_TRUE(rplyQuads.empty());
+  ASSERT_EQ(fastIdx.size(), 4);
+  ASSERT_EQ(rplyIdx.size(), fastIdx.size());
+  for (size_t i=0;i<fastIdx.size();i++) {
+    EXPECT_EQ(fastIdx[i].x, rplyIdx[i].x);
+    EXPECT_EQ(fastIdx[i].y, rplyIdx[i].y);
+    EXPECT_EQ(fastIdx[i].z, rplyIdx[i].z);
+  }
+  EXPECT_EQ(fastIdx[0].y, 4);
+  EXPECT_EQ(fastIdx[3].x, 0);
+  EXPECT_EQ(fastIdx[3].z, 3);
+  std::remove(fileName.c_str());
+}
+
+TEST(PbrtParser, PlyQuadsImportAsQuadMesh)
+{
+  {
+    std::ofstream ply("pbrtParserTest_mixed.ply");
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 5\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 2\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n1 1 0\n0 1 0\n2 0 0\n"
+        << "4 0 1 2 3\n"
+        << "3 1 4 2\n";
+    std::ofstream pbrt("pbrtParserTest_mixed.pbrt");
+    pbrt << "WorldBegin\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_mixed.ply\"\n"
+         << "WorldEnd\n";
+  }
+
+  for (bool async : { false, true }) {
+    ImportOptions options;
+    options.asyncPlyLoading = async;
+    Scene::SP scene = importPBRT("pbrtParserTest_mixed.pbrt",options);
+    ASSERT_EQ(scene->world->shapes.size(), 1);
+    QuadMesh::SP mesh = std::dynamic_pointer_cast<QuadMesh>(scene->world->shapes[0]);
+    ASSERT_NE(mesh, nullptr);
+    EXPECT_EQ(mesh->vertex.size(), 5);
+    ASSERT_EQ(mesh->index.size(), 2);
+    EXPECT_EQ(mesh->index[0].w, 3);
+    // the triangle is a degenerate quad
+    EXPECT_EQ(mesh->index[1].x, 1);
+    EXPECT_EQ(mesh->index[1].y, 4);
+    EXPECT_EQ(mesh->index[1].z, 2);
+    EXPECT_EQ(mesh->index[1].w, 2);
+
+    // ... or everything gets split into triangles
+    options.plyQuadsAsQuadMesh = false;
+    scene = importPBRT("pbrtParserTest_mixed.pbrt",options);
+    ASSERT_EQ(scene->world->shapes.size(), 1);
+    TriangleMesh::SP triangles = std::dynamic_pointer_cast<TriangleMesh>(scene->world->shapes[0]);
+    ASSERT_NE(triangles, nullptr);
+    EXPECT_EQ(triangles->index.size(), 3);
+  }
+
+  // instanced, with two different materials - ie, two prototypes
+  // that share the file's data
+  {
+    std::ofstream pbrt("pbrtParserTest_mixed.pbrt");
+    pbrt << "WorldBegin\n"
+         << "Material \"matte\"\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_mixed.ply\"\n"
+         << "Translate 5 0 0\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_mixed.ply\"\n"
+         << "Material \"mirror\"\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_mixed.ply\"\n"
+         << "WorldEnd\n";
+  }
+  ImportOptions options;
+  options.instancePlyMeshes = true;
+  Scene::SP scene = importPBRT("pbrtParserTest_mixed.pbrt",options);
+  std::set<QuadMesh::SP> prototypes;
+  for (auto inst : scene->world->instances)
+    for (auto shape : inst->object->shapes)
+      prototypes.insert(std::dynamic_pointer_cast<QuadMesh>(shape));
+  ASSERT_EQ(prototypes.size(), 2);
+  for (auto mesh : prototypes) {
+    ASSERT_NE(mesh, nullptr);
+    EXPECT_EQ(mesh->vertex.size(), 5);
+    ASSERT_EQ(mesh->index.size(), 2);
+    EXPECT_EQ(mesh->index[1].y, 4);
+  }
+  std::remove("pbrtParserTest_mixed.ply");
+  std::remove("pbrtParserTest_mixed.pbrt");
+}
+
+TEST(PbrtParser, Format9QuadMeshesStillLoad)
+{
+  // a scene with one quad mesh (with a degenerate quad), as written
+  // by the library when it was still at format 9 - before quad
+  // meshes had texture coordinates
+  const uint8_t format9[] = {
+    0x09,0x00,0x00,0x00,0x85,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x33,0x00,0x00,0x00,
+    0xff,0xff,0xff,0xff,0x00,0x00,0x00,0x00,0xff,0xff,0xff,0xff,0x00,0x00,0x00,0x80,
+    0x3f,0x05,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x80,0x3f,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x80,0x3f,0x00,0x00,0x80,0x3f,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x80,0x3f,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x40,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x02,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,0x00,0x02,0x00,0x00,
+    0x00,0x03,0x00,0x00,0x00,0x01,0x00,0x00,0x00,0x04,0x00,0x00,0x00,0x02,0x00,0x00,
+    0x00,0x02,0x00,0x00,0x00,0x14,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x02,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+    0x00,0x00,0x00,0x00,0x00,0x10,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,
+    0x00,0xff,0xff,0xff,0xff,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,0x00,0x00,
+    0x00
+  };
+  const std::string fileName = "pbrtParserTest_format9.pbf";
+  std::ofstream(fileName,std::ios::binary).write((const char *)format9,sizeof(format9));
+
+  std::ifstream in(fileName,std::ios::binary);
+  Scene::SP fromStream = Scene::loadFrom(in);
+  in.close();
+  for (int variant=0;variant<3;variant++) {
+    LoadOptions options;
+    options.mapFile    = (variant == 1);
+    options.lazyShapes = (variant == 2);
+    Scene::SP scene = Scene::loadFrom(fileName,options);
+    ASSERT_EQ(scene->world->shapes.size(), 1);
+    QuadMesh::SP mesh = std::dynamic_pointer_cast<QuadMesh>(scene->world->shapes[0]);
+    ASSERT_NE(mesh, nullptr);
+    mesh->ensureLoaded();
+    EXPECT_EQ(mesh->vertex.size(), 5);
+    EXPECT_TRUE(mesh->texcoord.empty());
+    ASSERT_EQ(mesh->index.size(), 2);
+    EXPECT_EQ(mesh->index[1].y, 4);
+    EXPECT_EQ(mesh->index[1].w, 2);
+  }
+  ASSERT_EQ(fromStream->world->shapes.size(), 1);
+  EXPECT_EQ(fromStream->world->shapes[0]->getNumPrims(), 2);
+  std::remove(fileName.c_str());
+}
+
+TEST(PbrtParser, BatchedTransformsMatchScalar)
+{
+  const affine3f xfm
+    = affine3f::translate(vec3f(1.f,-2.f,3.5f))
+    * affine3f::rotate(vec3f(1.f,2.f,3.f),0.7f)
+    * affine3f::scale(vec3f(2.f,.5f,-1.f));
+  // odd count, so we also cover the scalar remainder
+  std::vector<vec3f> in(1027);
+  for (size_t i=0;i<in.size();i++)
+    in[i] = vec3f(sinf(float(i)),cosf(3.f*i),float(i)*0.01f-5.f);
+
+  std::vector<vec3f> points(in.size()), normals(in.size());
+  xfmPoints(xfm,in.data(),points.data(),in.size());
+  xfmNormals(xfm,in.data(),normals.data(),in.size());
+  for (size_t i=0;i<in.size();i++) {
+    const vec3f p = xfmPoint(xfm,in[i]);
+    const vec3f n = xfmNormal(xfm,in[i]);
+    EXPECT_EQ(points[i].x, p.x); EXPECT_EQ(points[i].y, p.y); EXPECT_EQ(points[i].z, p.z);
+    EXPECT_EQ(normals[i].x, n.x); EXPECT_EQ(normals[i].y, n.y); EXPECT_EQ(normals[i].z, n.z);
+  }
+
+  // in-place
+  std::vector<vec3f> inPlace = in;
+  xfmPoints(xfm,inPlace.data(),inPlace.data(),inPlace.size());
+  for (size_t i=0;i<in.size();i++)
+    EXPECT_EQ(inPlace[i].x, points[i].x);
+}
+
+TEST(PbrtParser, MapFromPointsIntoFile)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+  for (int i=0;i<1000;i++) {
+    mesh->vertex.push_back(vec3f(float(i),float(2*i),float(3*i)));
+    mesh->index.push_back(vec3i(i,(i+1)%1000,(i+2)%1000));
+  }
+  // too small to be worth mapping
+  mesh->texcoord.push_back(vec2f(.5f,.5f));
+  scene->world->shapes.push_back(mesh);
+
+  const std::string fileName = "mapFrom_test.pbf";
+  // (narrow indices would get widened, rather than mapped)
+  SaveOptions options;
+  options.narrowIndices = false;
+  scene->saveTo(fileName,options);
+  {
+    Scene::SP mapped = Scene::mapFrom(fileName);
+    ASSERT_EQ(mapped->world->shapes.size(), 1);
+    TriangleMesh::SP ours = mapped->world->shapes[0]->as<TriangleMesh>();
+    ASSERT_TRUE(ours);
+    ASSERT_EQ(ours->vertex.size(), mesh->vertex.size());
+    ASSERT_EQ(ours->index.size(),  mesh->index.size());
+    ASSERT_EQ(ours->texcoord.size(), 1);
+    EXPECT_TRUE(ours->vertex.get_allocator().isExternal(ours->vertex.data()));
+    EXPECT_TRUE(ours->index.get_allocator().isExternal(ours->index.data()));
+    EXPECT_FALSE(ours->texcoord.get_allocator().isExternal(ours->texcoord.data()));
+    EXPECT_EQ((size_t)ours->vertex.data() % 64, 0);
+    for (size_t i=0;i<mesh->vertex.size();i++) {
+      EXPECT_EQ(ours->vertex[i].y, mesh->vertex[i].y);
+      EXPECT_EQ(ours->index[i].z, mesh->index[i].z);
+    }
+    
+    // writes stay private, and growing the array moves it to the heap
+    ours->vertex[0].x = 42.f;
+    ours->vertex.push_back(vec3f(1.f));
+    EXPECT_FALSE(ours->vertex.get_allocator().isExternal(ours->vertex.data()));
+    EXPECT_EQ(ours->vertex[0].x, 42.f);
+    EXPECT_EQ(ours->vertex[1].y, 2.f);
+  }
+  Scene::SP loaded = Scene::loadFrom(fileName);
+  TriangleMesh::SP ours = loaded->world->shapes[0]->as<TriangleMesh>();
+  EXPECT_EQ(ours->vertex[0].x, 0.f);
+  EXPECT_FALSE(ours->vertex.get_allocator().isExternal(ours->vertex.data()));
+  std::remove(fileName.c_str());
+}
+
+TEST(PbrtParser, LazyShapesLoadOnFirstAccess)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  Material::SP material = std::make_shared<MatteMaterial>();
+  for (int m=0;m<2;m++) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(material);
+    for (int i=0;i<100;i++) {
+      mesh->vertex.push_back(vec3f(float(m),float(i),0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%100,(i+2)%100));
+    }
+    scene->world->shapes.push_back(mesh);
+  }
+
+  const std::string fileName = "lazy_test.pbf";
+  scene->saveTo(fileName);
+  for (int mapFile=0;mapFile<2;mapFile++) {
+    LoadOptions options;
+    options.mapFile    = (mapFile != 0);
+    options.lazyShapes = true;
+    Scene::SP lazy = Scene::loadFrom(fileName,options);
+    ASSERT_EQ(lazy->world->shapes.size(), 2);
+    TriangleMesh::SP first  = lazy->world->shapes[0]->as<TriangleMesh>();
+    TriangleMesh::SP second = lazy->world->shapes[1]->as<TriangleMesh>();
+    ASSERT_TRUE(first && second);
+    EXPECT_FALSE(first->isLoaded());
+    EXPECT_FALSE(second->isLoaded());
+
+    // (those come from the file's shape table)
+    EXPECT_EQ(first->getNumPrims(), 100);
+    EXPECT_EQ(first->getBounds().upper.y, 99.f);
+    EXPECT_FALSE(first->isLoaded());
+
+    first->ensureLoaded();
+    EXPECT_TRUE(first->isLoaded());
+    EXPECT_FALSE(second->isLoaded());
+    EXPECT_EQ(first->vertex[7].y, 7.f);
+    EXPECT_TRUE(first->material);
+
+    second->ensureLoaded();
+    EXPECT_EQ(second->vertex[0].x, 1.f);
+    EXPECT_EQ(second->material, first->material);
+  }
+  // files written from a lazily loaded scene contain all shapes' data
+  const std::string copyName = "lazy_test_copy.pbf";
+  {
+    LoadOptions options;
+    options.lazyShapes = true;
+    Scene::loadFrom(fileName,options)->saveTo(copyName);
+  }
+  Scene::SP loaded = Scene::loadFrom(copyName);
+  EXPECT_EQ(loaded->world->shapes[1]->as<TriangleMesh>()->vertex[99].y, 99.f);
+  std::remove(fileName.c_str());
+  std::remove(copyName.c_str());
+}
+
+TEST(PbrtParser, LazilyLoadedScenesGetReleased)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  Material::SP material = std::make_shared<MatteMaterial>();
+  for (int m=0;m<2;m++) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(material);
+    for (int i=0;i<1000;i++)
+      mesh->vertex.push_back(vec3f(float(m),float(i),0.f));
+    for (int i=0;i<998;i++)
+      mesh->index.push_back(vec3i(i,i+1,i+2));
+    // (a header that doesn't fit into what gets read for it at first)
+    mesh->textures[std::string(1000,'t')] = std::make_shared<ConstantTexture>();
+    scene->world->shapes.push_back(mesh);
+  }
+  const std::string fileName = "pbrtParserTest_lazyRelease.pbf";
+  SaveOptions saveOptions;
+  saveOptions.shardSize = 1<<20;
+  scene->saveTo(fileName,saveOptions);
+
+  for (int variant=0;variant<4;variant++) {
+    LoadOptions options;
+    options.mapFile        = (variant & 1);
+    options.lazyShapes     = true;
+    options.residentBudget = (variant & 2) ? 1 : 0;
+    std::weak_ptr<Scene>    weakScene;
+    std::weak_ptr<Material> weakMaterial;
+    {
+      Scene::SP lazy = Scene::loadFrom(fileName,options);
+      Shape::SP first = lazy->world->shapes[0];
+      // the shapes' headers are there right away ...
+      EXPECT_FALSE(first->isLoaded());
+      ASSERT_TRUE(first->material);
+      EXPECT_EQ(first->material, lazy->world->shapes[1]->material);
+      ASSERT_EQ(first->textures.size(), 1);
+      EXPECT_EQ(first->textures.begin()->first.size(), 1000);
+      // ... and the rest once we ask for it
+      first->ensureLoaded();
+      EXPECT_EQ(first->as<TriangleMesh>()->vertex[999].y, 999.f);
+      EXPECT_EQ(first->as<TriangleMesh>()->index.size(), 998);
+      weakScene    = lazy;
+      weakMaterial = first->material;
+    }
+    EXPECT_TRUE(weakScene.expired());
+    EXPECT_TRUE(weakMaterial.expired());
+  }
+  std::remove(fileName.c_str());
+  std::remove((fileName+".1").c_str());
+}
+
+TEST(PbrtParser, ParallelLoadMatchesSerialLoad)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  Object::SP object = std::make_shared<Object>();
+  for (int m=0;m<20;m++) {
+    Material::SP material = std::make_shared<MatteMaterial>();
+    material->name = "material" + std::to_string(m);
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(material);
+    for (int i=0;i<1000;i++) {
+      mesh->vertex.push_back(vec3f(float(m),float(i),float(m*i)));
+      mesh->index.push_back(vec3i(i,(i+1)%1000,(i+2)%1000));
+    }
+    object->shapes.push_back(mesh);
+  }
+  for (int i=0;i<10;i++)
+    scene->world->instances.push_back
+      (std::make_shared<Instance>(object,affine3f::translate(vec3f(float(i)))));
+
+  const std::string fileName = "parallel_test.pbf";
+  scene->saveTo(fileName);
+  LoadOptions serialOptions;
+  serialOptions.parallel = false;
+  Scene::SP serial   = Scene::loadFrom(fileName,serialOptions);
+  Scene::SP parallel = Scene::loadFrom(fileName);
+  std::remove(fileName.c_str());
+
+  ASSERT_EQ(parallel->world->instances.size(), 10);
+  Object::SP parallelObject = parallel->world->instances[0]->object;
+  for (auto inst : parallel->world->instances)
+    EXPECT_EQ(inst->object, parallelObject);
+  Object::SP serialObject = serial->world->instances[0]->object;
+  ASSERT_EQ(parallelObject->shapes.size(), serialObject->shapes.size());
+  for (size_t m=0;m<serialObject->shapes.size();m++) {
+    TriangleMesh::SP a = serialObject->shapes[m]->as<TriangleMesh>();
+    TriangleMesh::SP b = parallelObject->shapes[m]->as<TriangleMesh>();
+    ASSERT_TRUE(a && b);
+    EXPECT_EQ(a->material->name, b->material->name);
+    EXPECT_EQ(a->vertex.size(), b->vertex.size());
+    EXPECT_TRUE(std::equal(a->vertex.begin(),a->vertex.end(),b->vertex.begin(),
+                           [](const vec3f &x, const vec3f &y) { return x.x == y.x && x.y == y.y && x.z == y.z; }));
+  }
+  EXPECT_EQ(parallel->getBounds().upper.z, serial->getBounds().upper.z);
+}
+
+TEST(PbrtParser, ParallelSaveIsByteIdentical)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  Object::SP object = std::make_shared<Object>();
+  Texture::SP texture = std::make_shared<ConstantTexture>();
+  for (int m=0;m<50;m++) {
+    MatteMaterial::SP material = std::make_shared<MatteMaterial>();
+    material->map_kd = texture;
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(material);
+    for (int i=0;i<100*m;i++) {
+      mesh->vertex.push_back(vec3f(float(m),float(i),0.f));
+      mesh->index.push_back(vec3i(i,i,i));
+    }
+    (m%2 ? object : scene->world)->shapes.push_back(mesh);
+  }
+  scene->world->instances.push_back(std::make_shared<Instance>(object,affine3f::translate(vec3f(1.f))));
+  scene->world->instances.push_back(std::make_shared<Instance>(object,affine3f::translate(vec3f(2.f))));
+
+  SaveOptions serialOptions;
+  serialOptions.parallel = false;
+  SaveOptions streamingOptions;
+  streamingOptions.streaming = true;
+  std::stringstream serial, parallel, streaming;
+  scene->saveTo(serial,serialOptions);
+  scene->saveTo(parallel);
+  scene->saveTo(streaming,streamingOptions);
+  EXPECT_EQ(serial.str(), parallel.str());
+  EXPECT_EQ(serial.str(), streaming.str());
+}
+
+TEST(PbrtParser, CompressedArraysRoundTrip)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+  // large enough for more than one compression block
+  const int numVertices = 200000;
+  for (int i=0;i<numVertices;i++) {
+    mesh->vertex.push_back(vec3f(float(i%100),float(i/100),.5f*i));
+    mesh->normal.push_back(vec3f(0.f,0.f,1.f));
+    mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+2)%numVertices));
+  }
+  mesh->texcoord.push_back(vec2f(.25f,.75f));
+  scene->world->shapes.push_back(mesh);
+
+  std::stringstream raw;
+  scene->saveTo(raw);
+  for (int level : { 1, 9 }) {
+    SaveOptions options;
+    options.compression      = SaveOptions::Compression_LZ;
+    options.compressionLevel = level;
+    std::stringstream compressed, streamed;
+    scene->saveTo(compressed,options);
+    options.streaming = true;
+    scene->saveTo(streamed,options);
+    EXPECT_EQ(compressed.str(), streamed.str());
+    EXPECT_LT(compressed.str().size()*3, raw.str().size());
+
+    Scene::SP loaded = Scene::loadFrom(compressed);
+    TriangleMesh::SP ours = loaded->world->shapes[0]->as<TriangleMesh>();
+    ASSERT_TRUE(ours);
+    ASSERT_EQ(ours->vertex.size(), mesh->vertex.size());
+    ASSERT_EQ(ours->index.size(),  mesh->index.size());
+    ASSERT_EQ(ours->texcoord.size(), 1);
+    EXPECT_EQ(memcmp(ours->vertex.data(),mesh->vertex.data(),mesh->vertex.size()*sizeof(vec3f)), 0);
+    EXPECT_EQ(memcmp(ours->normal.data(),mesh->normal.data(),mesh->normal.size()*sizeof(vec3f)), 0);
+    EXPECT_EQ(memcmp(ours->index.data(),mesh->index.data(),mesh->index.size()*sizeof(vec3i)), 0);
+  }
+}
+
+TEST(PbrtParser, QuantizedAttributesStayWithinBounds)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+  for (int i=0;i<1000;i++) {
+    const float t = .01f*i;
+    mesh->vertex.push_back(vec3f(10.f*std::sin(t),-5.f+.003f*i,std::cos(3.f*t)));
+    mesh->normal.push_back(normalize(vec3f(std::sin(t),std::cos(t),std::sin(2.f*t)-.5f)));
+    mesh->texcoord.push_back(vec2f(.001f*i,1.f-.001f*i));
+    mesh->index.push_back(vec3i(i,(i+1)%1000,(i+2)%1000));
+  }
+  scene->world->shapes.push_back(mesh);
+
+  for (int bits : { 16, 21 }) {
+    SaveOptions options;
+    options.quantize     = true;
+    options.positionBits = bits;
+    std::stringstream quantized;
+    scene->saveTo(quantized,options);
+    Scene::SP loaded = Scene::loadFrom(quantized);
+    TriangleMesh::SP ours = loaded->world->shapes[0]->as<TriangleMesh>();
+    ASSERT_TRUE(ours);
+    ASSERT_EQ(ours->vertex.size(),   mesh->vertex.size());
+    ASSERT_EQ(ours->normal.size(),   mesh->normal.size());
+    ASSERT_EQ(ours->texcoord.size(), mesh->texcoord.size());
+
+    const box3f bounds = mesh->getBounds();
+    // half a quantization step, plus float rounding (for |x| <= 10)
+    const vec3f maxError
+      = (bounds.upper-bounds.lower) * (.5f/float((1<<bits)-1)) + vec3f(4.f*FLT_EPSILON*10.f);
+    for (size_t i=0;i<mesh->vertex.size();i++) {
+      EXPECT_LE(std::fabs(ours->vertex[i].x-mesh->vertex[i].x), maxError.x);
+      EXPECT_LE(std::fabs(ours->vertex[i].y-mesh->vertex[i].y), maxError.y);
+      EXPECT_LE(std::fabs(ours->vertex[i].z-mesh->vertex[i].z), maxError.z);
+      EXPECT_GT(dot(ours->normal[i],mesh->normal[i]), .9999f);
+      EXPECT_NEAR(ours->texcoord[i].x, mesh->texcoord[i].x, 1e-3f);
+      EXPECT_NEAR(ours->texcoord[i].y, mesh->texcoord[i].y, 1e-3f);
+      EXPECT_EQ(ours->index[i].y, mesh->index[i].y);
+    }
+  }
+}
+
+TEST(PbrtParser, NarrowAndCompactIndices)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  // one mesh each for 8-bit, 16-bit, and 32-bit indices
+  for (int numVertices : { 200, 60000, 70000 }) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    mesh->vertex.resize(numVertices,vec3f(0.f));
+    for (int i=0;i<numVertices;i++)
+      mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+7)%numVertices));
+    scene->world->shapes.push_back(mesh);
+  }
+
+  SaveOptions wideOptions;
+  wideOptions.narrowIndices = false;
+  std::stringstream wide, narrow;
+  scene->saveTo(wide,wideOptions);
+  scene->saveTo(narrow);
+  EXPECT_LT(narrow.str().size(), wide.str().size());
+
+  Scene::SP loaded = Scene::loadFrom(narrow);
+  for (size_t m=0;m<3;m++) {
+    TriangleMesh::SP mesh = scene->world->shapes[m]->as<TriangleMesh>();
+    TriangleMesh::SP ours = loaded->world->shapes[m]->as<TriangleMesh>();
+    ASSERT_EQ(ours->index.size(), mesh->index.size());
+    EXPECT_TRUE(ours->compactIndex.empty());
+    EXPECT_EQ(memcmp(ours->index.data(),mesh->index.data(),mesh->index.size()*sizeof(vec3i)), 0);
+  }
+
+  const std::string fileName = "compact_test.pbf";
+  scene->saveTo(fileName);
+  LoadOptions options;
+  options.compactIndices = true;
+  Scene::SP compact = Scene::loadFrom(fileName,options);
+  std::remove(fileName.c_str());
+  const int expectedWidth[3] = { 1, 2, 4 };
+  for (size_t m=0;m<3;m++) {
+    TriangleMesh::SP mesh = scene->world->shapes[m]->as<TriangleMesh>();
+    TriangleMesh::SP ours = compact->world->shapes[m]->as<TriangleMesh>();
+    EXPECT_TRUE(ours->index.empty());
+    EXPECT_EQ(ours->compactIndex.width, expectedWidth[m]);
+    ASSERT_EQ(ours->getNumPrims(), mesh->getNumPrims());
+    EXPECT_EQ(ours->getIndex(5).z, mesh->index[5].z);
+    ours->expandIndices();
+    EXPECT_EQ(memcmp(ours->index.data(),mesh->index.data(),mesh->index.size()*sizeof(vec3i)), 0);
+  }
+
+  // compact indices get written just like regular ones
+  std::stringstream fromCompact;
+  compact->saveTo(fromCompact);
+  EXPECT_EQ(fromCompact.str(), narrow.str());
+}
+
+
+// =======================================================
+// metadata-only loading
+// =======================================================
+
+TEST(PbrtParser, SceneInfoWithoutLoadingTheWorld)
+{
+  {
+    std::ofstream ply("pbrtParserTest_info.ply");
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 4\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 2\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n1 1 0\n0 1 0\n3 0 1 2\n3 0 2 3\n";
+    std::ofstream pbrt("pbrtParserTest_info.pbrt");
+    pbrt << "LookAt 0 0 5  0 0 0  0 1 0\n"
+         << "Camera \"perspective\" \"float fov\" [ 30 ]\n"
+         << "Film \"image\" \"integer xresolution\" [ 640 ] \"integer yresolution\" [ 480 ]\n"
+         << "Sampler \"stratified\" \"integer xsamples\" 4 \"integer ysamples\" 4\n"
+         << "WorldBegin\n"
+         << "LightSource \"point\" \"rgb I\" [ 1 1 1 ]\n"
+         << "# Shape \"sphere\" (commented out)\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_info.ply\"\n"
+         << "ObjectBegin \"tris\"\n"
+         << "  Shape \"trianglemesh\" \"point P\" [ 0 0 0  1 0 0  1 1 0  0 1 0 ]\n"
+         << "    \"integer indices\" [ 0 1 2  0 2 3 ]\n"
+         << "ObjectEnd\n"
+         << "ObjectInstance \"tris\"\n"
+         << "Translate 5 0 0\n"
+         << "ObjectInstance \"tris\"\n"
+         << "WorldEnd\n";
+  }
+
+  SceneInfo::SP info = loadSceneInfo("pbrtParserTest_info.pbrt");
+  ASSERT_NE(info->film, nullptr);
+  EXPECT_EQ(info->film->resolution.x, 640);
+  EXPECT_EQ(info->film->resolution.y, 480);
+  ASSERT_EQ(info->cameras.size(), 1);
+  EXPECT_FLOAT_EQ(info->cameras[0]->fov, 30.f);
+  ASSERT_NE(info->sampler, nullptr);
+  EXPECT_EQ(info->sampler->xSamples, 4);
+  EXPECT_EQ(info->numShapes["plymesh"], 1);
+  EXPECT_EQ(info->numPrims["plymesh"], 2);
+  EXPECT_EQ(info->numShapes["trianglemesh"], 1);
+  EXPECT_EQ(info->numPrims["trianglemesh"], 2);
+  EXPECT_EQ(info->numShapes.count("sphere"), 0);
+  EXPECT_EQ(info->numObjects, 1);
+  EXPECT_EQ(info->numInstances, 2);
+  EXPECT_EQ(info->numLightSources, 1);
+  EXPECT_TRUE(info->bounds.empty());
+
+  // .pbf files store the summary - including the scene's bounds
+  Scene::SP scene = importPBRT("pbrtParserTest_info.pbrt");
+  std::remove("pbrtParserTest_info.ply");
+  std::remove("pbrtParserTest_info.pbrt");
+  const std::string fileName = "pbrtParserTest_info.pbf";
+  scene->saveTo(fileName);
+  info = loadSceneInfo(fileName);
+  std::remove(fileName.c_str());
+  ASSERT_NE(info->film, nullptr);
+  EXPECT_EQ(info->film->resolution.x, 640);
+  ASSERT_EQ(info->cameras.size(), 1);
+  EXPECT_FLOAT_EQ(info->cameras[0]->fov, 30.f);
+  EXPECT_EQ(info->cameras[0]->simplified.lens_center.z,
+            scene->cameras[0]->simplified.lens_center.z);
+  ASSERT_NE(info->sampler, nullptr);
+  EXPECT_EQ(info->sampler->xSamples, 4);
+  EXPECT_EQ(info->numShapes["trianglemesh"], 2);
+  EXPECT_EQ(info->numPrims["trianglemesh"], 4);
+  EXPECT_EQ(info->numInstances, scene->world->instances.size());
+  EXPECT_EQ(info->numLightSources, 1);
+  EXPECT_EQ(info->bounds.lower.x, scene->getBounds().lower.x);
+  EXPECT_EQ(info->bounds.upper.x, scene->getBounds().upper.x);
+}
+
+
+// =======================================================
+// sharded files
+// =======================================================
+
+TEST(PbrtParser, ShardedFilesRoundTrip)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  // four meshes of ~400KB each, plus one that's too small for a shard
+  for (int numVertices : { 20000, 20000, 20000, 20000, 10 }) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    for (int i=0;i<numVertices;i++) {
+      mesh->vertex.push_back(vec3f((float)i,(float)(i%7),0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+2)%numVertices));
+    }
+    scene->world->shapes.push_back(mesh);
+  }
+  std::stringstream unsharded;
+  scene->saveTo(unsharded);
+
+  const std::string fileName = "pbrtParserTest_sharded.pbf";
+  SaveOptions options;
+  options.shardSize = size_t(1)<<20;
+  for (bool streaming : { false, true }) {
+    options.streaming = streaming;
+    const size_t numBytes = scene->saveTo(fileName,options);
+    // two meshes per shard, and the small stuff in the file itself
+    EXPECT_TRUE(std::ifstream(fileName+".1").good());
+    EXPECT_TRUE(std::ifstream(fileName+".2").good());
+    EXPECT_FALSE(std::ifstream(fileName+".3").good());
+    EXPECT_GT(numBytes, unsharded.str().size());
+    EXPECT_LT(std::ifstream(fileName,std::ios::ate|std::ios::binary).tellg(), 64*1024);
+
+    for (int variant=0;variant<3;variant++) {
+      LoadOptions loadOptions;
+      loadOptions.mapFile    = (variant == 1);
+      loadOptions.lazyShapes = (variant == 2);
+      Scene::SP loaded = Scene::loadFrom(fileName,loadOptions);
+      std::stringstream resaved;
+      loaded->saveTo(resaved);
+      EXPECT_EQ(resaved.str(), unsharded.str());
+    }
+    // the summary is still in the file itself
+    EXPECT_EQ(loadSceneInfo(fileName)->numPrims["trianglemesh"], 80010);
+
+    // shards aren't in a stream
+    std::ifstream in(fileName,std::ios::binary);
+    EXPECT_THROW(Scene::loadFrom(in), std::runtime_error);
+  }
+  std::remove(fileName.c_str());
+  std::remove((fileName+".1").c_str());
+  std::remove((fileName+".2").c_str());
+
+  std::stringstream notAFile;
+  EXPECT_THROW(scene->saveTo(notAFile,options), std::runtime_error);
+}
+
+
+// =======================================================
+// paging shapes in and out
+// =======================================================
+
+TEST(PbrtParser, PagedShapesStayWithinBudget)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  const int numMeshes = 8, numVertices = 1000;
+  for (int m=0;m<numMeshes;m++) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    for (int i=0;i<numVertices;i++) {
+      mesh->vertex.push_back(vec3f(float(m),float(i),0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+2)%numVertices));
+    }
+    scene->world->shapes.push_back(mesh);
+  }
+  const std::string fileName = "pbrtParserTest_paged.pbf";
+  scene->saveTo(fileName);
+
+  const size_t meshBytes = numVertices*(sizeof(vec3f)+sizeof(vec3i));
+  for (int mapFile=0;mapFile<2;mapFile++) {
+    LoadOptions options;
+    options.mapFile        = (mapFile != 0);
+    options.residentBudget = 3*meshBytes;
+    Scene::SP paged = Scene::loadFrom(fileName,options);
+    std::vector<TriangleMesh::SP> meshes;
+    for (auto shape : paged->world->shapes)
+      meshes.push_back(shape->as<TriangleMesh>());
+    auto numLoaded = [&]() {
+      int count = 0;
+      for (auto mesh : meshes) count += mesh->isLoaded();
+      return count;
+    };
+
+    // bounds and prim counts don't need the data ...
+    EXPECT_EQ(paged->getBounds().upper.x, float(numMeshes-1));
+    EXPECT_EQ(meshes[5]->getNumPrims(), numVertices);
+    EXPECT_EQ(numLoaded(), 0);
+
+    // ... and a pinned shape never gets evicted
+    meshes[0]->pin();
+    for (int pass=0;pass<2;pass++)
+      for (int m=1;m<numMeshes;m++) {
+        meshes[m]->pin();
+        EXPECT_EQ(meshes[m]->vertex[17].x, float(m));
+        EXPECT_EQ(meshes[m]->index[numVertices-1].z, 1);
+        meshes[m]->unpin();
+        EXPECT_TRUE(meshes[0]->isLoaded());
+        EXPECT_LE(numLoaded(), 3);
+      }
+    EXPECT_EQ(meshes[0]->vertex[numVertices-1].y, float(numVertices-1));
+    meshes[0]->unpin();
+
+    // once unpinned, it's just as evictable as the others
+    for (int m=1;m<numMeshes;m++)
+      meshes[m]->ensureLoaded();
+    EXPECT_FALSE(meshes[0]->isLoaded());
+    EXPECT_LE(numLoaded(), 3);
+  }
+  std::remove(fileName.c_str());
+}
+
+TEST(PbrtParser, PagedShapesStayPinnedWhileInUse)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  const int numMeshes = 64, numVertices = 1000;
+  for (int m=0;m<numMeshes;m++) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    for (int i=0;i<numVertices;i++) {
+      mesh->vertex.push_back(vec3f(float(m),float(i),0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+2)%numVertices));
+    }
+    scene->world->shapes.push_back(mesh);
+  }
+  const std::string fileName = "pbrtParserTest_pagedPins.pbf";
+  scene->saveTo(fileName);
+  std::stringstream expected;
+  scene->saveTo(expected);
+
+  for (int mapFile=0;mapFile<2;mapFile++) {
+    LoadOptions options;
+    options.mapFile        = (mapFile != 0);
+    // (less than a single mesh, so every access evicts something)
+    options.residentBudget = 1;
+    Scene::SP paged = Scene::loadFrom(fileName,options);
+
+    // other threads keep loading (and thus evicting) shapes while
+    // we're saving ...
+    std::vector<std::thread> threads;
+    std::atomic<int> numWrongBounds { 0 };
+    for (int t=0;t<4;t++)
+      threads.push_back(std::thread([&,t]() {
+            for (int pass=0;pass<4;pass++)
+              for (int m=0;m<numMeshes;m++) {
+                Shape::SP shape = paged->world->shapes[(m+17*t)%numMeshes];
+                const box3f bounds = shape->getPrimBounds(numVertices-3);
+                numWrongBounds += (bounds.upper.y != float(numVertices-1));
+              }
+          }));
+    // ... in parallel
+    SaveOptions saveOptions;
+    saveOptions.parallel = true;
+    std::stringstream saved;
+    paged->saveTo(saved,saveOptions);
+    for (auto &thread : threads)
+      thread.join();
+    EXPECT_EQ(numWrongBounds, 0);
+    EXPECT_TRUE(saved.str() == expected.str());
+  }
+  std::remove(fileName.c_str());
+}
+
+
+// =======================================================
+// appending updates to existing files
+// =======================================================
+
+TEST(PbrtParser, AppendOnlyWritesWhatChanged)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  auto makeMesh = [](float offset) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(std::make_shared<MatteMaterial>());
+    for (int i=0;i<20000;i++) {
+      mesh->vertex.push_back(vec3f(offset+i,0.f,0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%20000,(i+2)%20000));
+    }
+    return mesh;
+  };
+  for (int m=0;m<4;m++)
+    scene->world->shapes.push_back(makeMesh(float(m)));
+  const std::string fileName = "pbrtParserTest_append.pbf";
+  const size_t fullSize = scene->saveTo(fileName);
+
+  // one changed material, one replaced mesh
+  scene->world->shapes[1]->material->as<MatteMaterial>()->kd = vec3f(1.f,0.f,0.f);
+  scene->world->shapes[2] = makeMesh(42.f);
+  // (the world caches its bounds)
+  scene->world->haveComputedBounds = false;
+  const size_t appended = scene->appendTo(fileName);
+  EXPECT_LT(appended, fullSize/3);
+
+  std::stringstream expected;
+  scene->saveTo(expected);
+  for (int mapFile=0;mapFile<2;mapFile++) {
+    LoadOptions options;
+    options.mapFile = (mapFile != 0);
+    std::stringstream resaved;
+    Scene::loadFrom(fileName,options)->saveTo(resaved);
+    EXPECT_EQ(resaved.str(), expected.str());
+  }
+  // (a stream reader would see both versions)
+  std::ifstream in(fileName,std::ios::binary);
+  EXPECT_THROW(Scene::loadFrom(in), std::runtime_error);
+  in.close();
+
+  // nothing changed, nothing but a new index
+  EXPECT_LT(scene->appendTo(fileName), 4096);
+
+  // too much garbage: the file gets rewritten
+  SaveOptions options;
+  options.maxGarbageFraction = 0.f;
+  EXPECT_EQ(scene->appendTo(fileName,options), expected.str().size());
+  EXPECT_EQ(std::ifstream(fileName,std::ios::ate|std::ios::binary).tellg(),
+            std::streamoff(expected.str().size()));
+  std::remove(fileName.c_str());
+}
+
+
+TEST(PbrtParser, RewritingShardedFilesKeepsReadersWorking)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  auto makeMesh = [](float offset) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    for (int i=0;i<20000;i++) {
+      mesh->vertex.push_back(vec3f(offset+i,0.f,0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%20000,(i+2)%20000));
+    }
+    return mesh;
+  };
+  for (int m=0;m<2;m++)
+    scene->world->shapes.push_back(makeMesh(float(m)));
+  const std::string fileName = "pbrtParserTest_rewrite.pbf";
+  SaveOptions options;
+  options.shardSize = size_t(1)<<20;
+  scene->saveTo(fileName,options);
+
+  // a reader that has both the file and its shard open
+  LoadOptions loadOptions;
+  loadOptions.lazyShapes = true;
+  Scene::SP old = Scene::loadFrom(fileName,loadOptions);
+  old->world->shapes[0]->ensureLoaded();
+
+  // too much garbage: the file and its shard get rewritten
+  scene->world->shapes[0] = makeMesh(42.f);
+  scene->world->haveComputedBounds = false;
+  options.maxGarbageFraction = 0.f;
+  scene->appendTo(fileName,options);
+  EXPECT_FALSE(std::ifstream(fileName+".tmp").good());
+  EXPECT_FALSE(std::ifstream(fileName+".1.tmp").good());
+
+  // ... which the old reader doesn't notice
+  old->world->shapes[1]->ensureLoaded();
+  EXPECT_EQ(old->world->shapes[1]->as<TriangleMesh>()->vertex[0].x, 1.f);
+  // ... and the new file has the new mesh
+  std::stringstream expected, resaved;
+  scene->saveTo(expected);
+  Scene::loadFrom(fileName)->saveTo(resaved);
+  EXPECT_EQ(resaved.str(), expected.str());
+  std::remove(fileName.c_str());
+  std::remove((fileName+".1").c_str());
+}
+
+
+// =======================================================
+// asynchronous loading
+// =======================================================
+
+TEST(PbrtParser, AsyncLoadReportsProgressAndCancels)
+{
+  {
+    std::ofstream pbrt("pbrtParserTest_async.pbrt");
+    pbrt << "WorldBegin\n"
+         << "Shape \"sphere\" \"float radius\" 1\n"
+         << "Include \"pbrtParserTest_async_world.pbrt\"\n"
+         << "WorldEnd\n";
+    std::ofstream included("pbrtParserTest_async_world.pbrt");
+    for (int i=0;i<3;i++)
+      included << "Shape \"trianglemesh\" \"point P\" [ 0 0 0  1 0 0  1 1 0 ]\n"
+               << "  \"integer indices\" [ 0 1 2 ]\n";
+  }
+  const size_t numBytes
+    = std::ifstream("pbrtParserTest_async.pbrt",std::ios::ate).tellg()
+    + std::ifstream("pbrtParserTest_async_world.pbrt",std::ios::ate).tellg();
+
+  AsyncLoad::SP load = loadAsync("./pbrtParserTest_async.pbrt");
+  Scene::SP scene = load->get();
+  EXPECT_TRUE(load->isDone());
+  EXPECT_EQ(scene->world->shapes.size(), 4);
+  EXPECT_EQ(load->progress->bytesConsumed, numBytes);
+  EXPECT_EQ(load->progress->filesDone, 2);
+  EXPECT_EQ(load->progress->entitiesDecoded, 4);
+
+  const std::string fileName = "pbrtParserTest_async.pbf";
+  scene->saveTo(fileName);
+  load = loadAsync(fileName);
+  EXPECT_EQ(load->get()->world->shapes.size(), 4);
+  EXPECT_GT(load->progress->entitiesTotal, 4);
+  EXPECT_EQ(load->progress->entitiesDecoded, load->progress->entitiesTotal);
+  EXPECT_EQ(load->progress->filesDone, 1);
+
+  // cancelled loads stop at the first chance they get
+  LoadProgress::SP cancelled = std::make_shared<LoadProgress>();
+  cancelled->cancel();
+  ImportOptions importOptions;
+  importOptions.progress = cancelled;
+  EXPECT_THROW(importPBRT("./pbrtParserTest_async.pbrt",importOptions), LoadCancelled);
+  LoadOptions loadOptions;
+  loadOptions.progress = cancelled;
+  EXPECT_THROW(Scene::loadFrom(fileName,loadOptions), LoadCancelled);
+  EXPECT_EQ(cancelled->entitiesDecoded, 0);
+
+  load = loadAsync(fileName);
+  load->cancel();
+  try {
+    load->get();
+  } catch (const LoadCancelled &) {
+    // (unless it was done already)
+  }
+  std::remove(fileName.c_str());
+  std::remove("pbrtParserTest_async.pbrt");
+  std::remove("pbrtParserTest_async_world.pbrt");
+}
+
+
+// =======================================================
+// stored bounds, and loading only a region
+// =======================================================
+
+TEST(PbrtParser, LoadRegionOnlyKeepsWhatOverlaps)
+{
+  auto unitMesh = [](const vec3f &lower) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    mesh->vertex = { lower, lower+vec3f(1.f,0.f,0.f), lower+vec3f(1.f,1.f,1.f) };
+    mesh->index  = { vec3i(0,1,2) };
+    return mesh;
+  };
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  scene->world->shapes.push_back(unitMesh(vec3f(0.f)));
+  scene->world->shapes.push_back(unitMesh(vec3f(10.f,0.f,0.f)));
+  Object::SP object = std::make_shared<Object>("twoMeshes");
+  object->shapes.push_back(unitMesh(vec3f(0.f)));
+  object->shapes.push_back(unitMesh(vec3f(0.f,5.f,0.f)));
+  for (int i=0;i<2;i++)
+    scene->world->instances.push_back
+      (std::make_shared<Instance>(object,affine3f::translate(vec3f(20.f+10.f*i,0.f,0.f))));
+  const std::string fileName = "pbrtParserTest_region.pbf";
+  scene->saveTo(fileName);
+
+  // objects' and instances' bounds and prim counts come from the file
+  LoadOptions lazy;
+  lazy.lazyShapes = true;
+  Scene::SP loaded = Scene::loadFrom(fileName,lazy);
+  EXPECT_EQ(loaded->getBounds().upper.x, 31.f);
+  EXPECT_EQ(loaded->getBounds().upper.y, 6.f);
+  EXPECT_EQ(loaded->world->getNumPrims(), 6);
+  EXPECT_EQ(loaded->world->instances[1]->getBounds().lower.x, 30.f);
+  for (auto shape : loaded->world->shapes)
+    EXPECT_FALSE(shape->isLoaded());
+
+  // only the first of the world's own meshes
+  Scene::SP region = Scene::loadRegion(fileName,box3f(vec3f(-1.f),vec3f(2.f)));
+  ASSERT_EQ(region->world->shapes.size(), 1);
+  EXPECT_TRUE(region->world->shapes[0]->isLoaded());
+  EXPECT_TRUE(region->world->instances.empty());
+  EXPECT_EQ(region->getBounds().upper.x, 1.f);
+
+  // only the second instance, and only the lower of its object's meshes
+  region = Scene::loadRegion(fileName,box3f(vec3f(29.5f,-1.f,-1.f),vec3f(30.5f,2.f,2.f)),lazy);
+  EXPECT_TRUE(region->world->shapes.empty());
+  ASSERT_EQ(region->world->instances.size(), 1);
+  Object::SP kept = region->world->instances[0]->object;
+  ASSERT_EQ(kept->shapes.size(), 1);
+  EXPECT_FALSE(kept->shapes[0]->isLoaded());
+  EXPECT_EQ(region->getBounds().lower.x, 30.f);
+  EXPECT_EQ(region->getBounds().upper.y, 1.f);
+  kept->shapes[0]->ensureLoaded();
+  EXPECT_EQ(kept->shapes[0]->as<TriangleMesh>()->vertex[2].y, 1.f);
+
+  // nothing at all
+  region = Scene::loadRegion(fileName,box3f(vec3f(100.f),vec3f(101.f)));
+  EXPECT_TRUE(region->world->shapes.empty());
+  EXPECT_TRUE(region->world->instances.empty());
+  std::remove(fileName.c_str());
+}
+
+
+TEST(PbrtParser, LoadRegionVisitsSharedObjectsOnce)
+{
+  // each level instances the one below twice, so there are 2^40
+  // paths down to the leaf - all with the same transform
+  const int numLevels = 40;
+  Object::SP object = std::make_shared<Object>("leaf");
+  for (int i=0;i<2;i++) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>();
+    const vec3f lower(10.f*i,0.f,0.f);
+    mesh->vertex = { lower, lower+vec3f(1.f,0.f,0.f), lower+vec3f(1.f,1.f,1.f) };
+    mesh->index  = { vec3i(0,1,2) };
+    object->shapes.push_back(mesh);
+  }
+  for (int level=0;level<numLevels;level++) {
+    Object::SP parent = std::make_shared<Object>("level"+std::to_string(level));
+    for (int i=0;i<2;i++)
+      parent->instances.push_back(std::make_shared<Instance>(object,affine3f::identity()));
+    object = parent;
+  }
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = object;
+  const std::string fileName = "pbrtParserTest_regionDAG.pbf";
+  scene->saveTo(fileName);
+
+  LoadOptions lazy;
+  lazy.lazyShapes = true;
+  for (int fully=0;fully<2;fully++) {
+    // either only the first of the leaf's meshes, or everything
+    const box3f region = fully
+      ? box3f(vec3f(-1.f),vec3f(12.f))
+      : box3f(vec3f(-1.f),vec3f(2.f));
+    Scene::SP loaded = Scene::loadRegion(fileName,region,lazy);
+    Object::SP leaf = loaded->world;
+    for (int level=0;level<numLevels;level++) {
+      ASSERT_EQ(leaf->instances.size(), 2);
+      leaf = leaf->instances[0]->object;
+    }
+    EXPECT_EQ(leaf->shapes.size(), fully ? 2 : 1);
+    EXPECT_EQ(loaded->getBounds().upper.x, fully ? 11.f : 1.f);
+  }
+  std::remove(fileName.c_str());
+}
+
+
+// =======================================================
+// scene cache
+// =======================================================
+
+TEST(PbrtParser, SceneCacheSkipsUnchangedImports)
+{
+  {
+    std::ofstream ply("pbrtParserTest_cached.ply");
+    ply << "ply\nformat ascii 1.0\n"
+        << "element vertex 3\nproperty float x\nproperty float y\nproperty float z\n"
+        << "element face 1\nproperty list uchar int vertex_indices\nend_header\n"
+        << "0 0 0\n1 0 0\n0 1 0\n3 0 1 2\n";
+    std::ofstream pbrt("pbrtParserTest_cached.pbrt");
+    pbrt << "WorldBegin\n"
+         << "Shape \"plymesh\" \"string filename\" \"pbrtParserTest_cached.ply\"\n"
+         << "Include \"pbrtParserTest_cached_world.pbrt\"\n"
+         << "WorldEnd\n";
+    std::ofstream included("pbrtParserTest_cached_world.pbrt");
+    included << "Shape \"sphere\" \"float radius\" 1\n";
+  }
+  const std::string fileName = "./pbrtParserTest_cached.pbrt";
+  ImportOptions options;
+  options.cacheScene = true;
+  EXPECT_EQ(importPBRT(fileName,options)->world->shapes.size(), 2);
+
+  // the manifest lists the pbrt files and the ply file
+  int numDependencies = 0;
+  std::ifstream manifest(fileName+".pbf.deps");
+  for (std::string line;std::getline(manifest,line);)
+    numDependencies += (line.find('|') != std::string::npos);
+  EXPECT_EQ(numDependencies, 3);
+
+  // as long as nothing changed, we get whatever is in the cache ...
+  Scene::SP cached = std::make_shared<Scene>();
+  cached->world = std::make_shared<Object>();
+  cached->saveTo(fileName+".pbf");
+  EXPECT_EQ(importPBRT(fileName,options)->world->shapes.size(), 0);
+
+  // ... but once an included file changes, we import again
+  {
+    std::ofstream included("pbrtParserTest_cached_world.pbrt",std::ios::app);
+    included << "Shape \"sphere\" \"float radius\" 2\n";
+  }
+  EXPECT_EQ(importPBRT(fileName,options)->world->shapes.size(), 3);
+  EXPECT_EQ(importPBRT(fileName,options)->world->shapes.size(), 3);
+
+  std::remove((fileName+".pbf").c_str());
+  std::remove((fileName+".pbf.deps").c_str());
+  std::remove("pbrtParserTest_cached.ply");
+  std::remove("pbrtParserTest_cached.pbrt");
+  std::remove("pbrtParserTest_cached_world.pbrt");
+}
+
+
+// =======================================================
+// merging pbf files
+// =======================================================
+
+TEST(PbrtParser, MergeCopiesShapesAndSharesMaterials)
+{
+  const int numVertices = 10000;
+  SaveOptions quantized;
+  quantized.quantize = true;
+  for (int f=0;f<2;f++) {
+    Scene::SP scene = std::make_shared<Scene>();
+    scene->world = std::make_shared<Object>();
+    MatteMaterial::SP material = std::make_shared<MatteMaterial>();
+    material->kd = vec3f(.25f);
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(material);
+    for (int i=0;i<numVertices;i++) {
+      mesh->vertex.push_back(vec3f(float(f),float(i),0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+2)%numVertices));
+    }
+    scene->world->shapes.push_back(mesh);
+    scene->saveTo("pbrtParserTest_merge"+std::to_string(f)+".pbf",quantized);
+  }
+
+  std::vector<MergeInput> inputs(2);
+  for (int f=0;f<2;f++) {
+    inputs[f].fileName = "pbrtParserTest_merge"+std::to_string(f)+".pbf";
+    inputs[f].xfm      = affine3f::translate(vec3f(0.f,0.f,10.f*f));
+  }
+  SaveOptions options;
+  options.mergeIdenticalMaterials = true;
+  const size_t numBytes = mergePBF(inputs,"pbrtParserTest_merged.pbf",options);
+
+  Scene::SP merged = Scene::loadFrom("pbrtParserTest_merged.pbf");
+  // the meshes stayed quantized, rather than got written at full precision
+  std::stringstream reencoded;
+  EXPECT_LT(numBytes, merged->saveTo(reencoded)*3/4);
+  ASSERT_EQ(merged->world->instances.size(), 2);
+  TriangleMesh::SP meshes[2];
+  for (int f=0;f<2;f++) {
+    Instance::SP inst = merged->world->instances[f];
+    EXPECT_EQ(inst->xfm.p.z, 10.f*f);
+    ASSERT_EQ(inst->object->shapes.size(), 1);
+    meshes[f] = inst->object->shapes[0]->as<TriangleMesh>();
+    ASSERT_EQ(meshes[f]->vertex.size(), numVertices);
+    EXPECT_NEAR(meshes[f]->vertex[numVertices-1].y, numVertices-1, .5f);
+    EXPECT_EQ(meshes[f]->index[numVertices-1].z, 1);
+  }
+  ASSERT_NE(meshes[0]->material, nullptr);
+  EXPECT_EQ(meshes[0]->material, meshes[1]->material);
+  EXPECT_EQ(meshes[0]->material->as<MatteMaterial>()->kd.x, .25f);
+
+  // merging into one of the inputs - under another name for it -
+  // still reads all of that input before replacing it
+  inputs[1].fileName = "./pbrtParserTest_merged.pbf";
+  mergePBF(inputs,"pbrtParserTest_merged.pbf",options);
+  merged = Scene::loadFrom("pbrtParserTest_merged.pbf");
+  ASSERT_EQ(merged->world->instances.size(), 2);
+  Object::SP nested = merged->world->instances[1]->object;
+  ASSERT_EQ(nested->instances.size(), 2);
+  for (int f=0;f<2;f++) {
+    ASSERT_EQ(nested->instances[f]->object->shapes.size(), 1);
+    TriangleMesh::SP mesh = nested->instances[f]->object->shapes[0]->as<TriangleMesh>();
+    ASSERT_EQ(mesh->vertex.size(), numVertices);
+    EXPECT_NEAR(mesh->vertex[numVertices-1].y, numVertices-1, .5f);
+    EXPECT_EQ(mesh->vertex[0].x, float(f));
+  }
+
+  std::remove("pbrtParserTest_merge0.pbf");
+  std::remove("pbrtParserTest_merge1.pbf");
+  std::remove("pbrtParserTest_merged.pbf");
+}
+
+
+// =======================================================
+// direct i/o
+// =======================================================
+
+TEST(PbrtParser, DirectIORoundTrip)
+{
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  auto makeMesh = [](int numVertices, float offset) {
+    TriangleMesh::SP mesh = std::make_shared<TriangleMesh>(std::make_shared<MatteMaterial>());
+    for (int i=0;i<numVertices;i++) {
+      mesh->vertex.push_back(vec3f(offset+i,(float)(i%7),0.f));
+      mesh->index.push_back(vec3i(i,(i+1)%numVertices,(i+2)%numVertices));
+    }
+    return mesh;
+  };
+  // one mesh that's larger than a single write request, and some
+  // that aren't - with sizes that aren't multiples of a block
+  scene->world->shapes.push_back(makeMesh(1000001,0.f));
+  for (int m=0;m<3;m++)
+    scene->world->shapes.push_back(makeMesh(20000+m,float(m)));
+  std::stringstream expected;
+  scene->saveTo(expected);
+
+  const std::string fileName = "pbrtParserTest_direct.pbf";
+  SaveOptions saveOptions;
+  saveOptions.directIO = true;
+  for (size_t shardSize : { size_t(0), size_t(1)<<20 }) {
+    saveOptions.shardSize = shardSize;
+    const size_t numBytes = scene->saveTo(fileName,saveOptions);
+    if (!shardSize) {
+      EXPECT_EQ(numBytes, expected.str().size());
+    }
+    for (bool directIO : { false, true }) {
+      LoadOptions loadOptions;
+      loadOptions.directIO = directIO;
+      std::stringstream resaved;
+      Scene::loadFrom(fileName,loadOptions)->saveTo(resaved);
+      EXPECT_EQ(resaved.str(), expected.str());
+    }
+  }
+  for (int shard=1;shard<=3;shard++)
+    std::remove((fileName+"."+std::to_string(shard)).c_str());
+
+  // appending starts in the middle of a block
+  saveOptions.shardSize = 0;
+  scene->saveTo(fileName,saveOptions);
+  scene->world->shapes[2] = makeMesh(30000,42.f);
+  scene->world->haveComputedBounds = false;
+  EXPECT_GT(scene->appendTo(fileName,saveOptions), 0);
+  std::stringstream updated;
+  scene->saveTo(updated);
+  LoadOptions loadOptions;
+  loadOptions.directIO = true;
+  std::stringstream resaved;
+  Scene::loadFrom(fileName,loadOptions)->saveTo(resaved);
+  EXPECT_EQ(resaved.str(), updated.str());
+  std::remove(fileName.c_str());
+}
+
+
+// =======================================================
+// parallel bounds
+// =======================================================
+
+inline bool sameVector(const vec3f &a, const vec3f &b)
+{
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+TEST(PbrtParser, ParallelBoundsMatchSerialBounds)
+{
+  // vectorized reduction, with a remainder, and a nan that gets ignored
+  std::vector<vec3f> points;
+  for (int i=0;i<23;i++)
+    points.push_back(vec3f(float(i%5)-2.f,float(i*i),-float(i)));
+  points[7].y = std::numeric_limits<float>::quiet_NaN();
+  box3f expected = box3f::empty_box();
+  for (auto p : points) expected.extend(p);
+  box3f vectorized = box3f::empty_box();
+  extendBounds(vectorized,points.data(),points.size());
+  EXPECT_TRUE(sameVector(vectorized.lower, expected.lower));
+  EXPECT_TRUE(sameVector(vectorized.upper, expected.upper));
+
+  // a mesh that's large enough to get reduced in blocks, a few
+  // levels of instances, and an object that's instanced twice
+  TriangleMesh::SP large = std::make_shared<TriangleMesh>();
+  for (int i=0;i<(3<<20)+5;i++)
+    large->vertex.push_back(vec3f(float(i%1000),float(i%777)-100.f,float(i)*1e-3f));
+  large->vertex[12345] = vec3f(-7.f,2000.f,-3.f);
+  QuadMesh::SP quads = std::make_shared<QuadMesh>();
+  quads->vertex.push_back(vec3f(0.f,0.f,0.f));
+  quads->vertex.push_back(vec3f(1.f,2.f,3.f));
+
+  Object::SP leaf = std::make_shared<Object>();
+  leaf->shapes.push_back(quads);
+  Object::SP middle = std::make_shared<Object>();
+  middle->shapes.push_back(large);
+  for (int i=0;i<2;i++)
+    middle->instances.push_back
+      (std::make_shared<Instance>(leaf,affine3f::translate(vec3f(0.f,0.f,100.f*(i+1)))));
+  Scene::SP scene = std::make_shared<Scene>();
+  scene->world = std::make_shared<Object>();
+  scene->world->instances.push_back
+    (std::make_shared<Instance>(middle,affine3f::translate(vec3f(10.f,0.f,0.f))));
+  scene->world->instances.push_back
+    (std::make_shared<Instance>(leaf,affine3f::scale(vec3f(-50.f))));
+
+  box3f largeBounds = box3f::empty_box();
+  for (auto v : large->vertex) largeBounds.extend(v);
+  box3f middleBounds = largeBounds;
+  middleBounds.extend(box3f(vec3f(0.f,0.f,100.f),vec3f(1.f,2.f,203.f)));
+  box3f worldBounds = xfmBounds(affine3f::translate(vec3f(10.f,0.f,0.f)),middleBounds);
+  worldBounds.extend(box3f(vec3f(-50.f,-100.f,-150.f),vec3f(0.f)));
+
+  const box3f bounds = scene->getBounds();
+  EXPECT_TRUE(sameVector(bounds.lower, worldBounds.lower));
+  EXPECT_TRUE(sameVector(bounds.upper, worldBounds.upper));
+  // everything below the world got its bounds on the way
+  EXPECT_TRUE(middle->haveComputedBounds);
+  EXPECT_TRUE(leaf->haveComputedBounds);
+  EXPECT_TRUE(large->haveComputedBounds);
+  EXPECT_TRUE(sameVector(large->getBounds().lower, largeBounds.lower));
+  EXPECT_TRUE(sameVector(large->getBounds().upper, largeBounds.upper));
+}